@@ -135,7 +135,7 @@ set_from_url(char * const var,
 }
 
 static struct q_conn * __attribute__((nonnull))
-get(struct w_engine * const w,
+get(struct q_engine * const w,
     struct conn_cache * const cc,
     const char * const dest,
     const char * const port,
@@ -303,7 +303,7 @@ int main(int argc, char * argv[])
         }
     }
 
-    struct w_engine * const w =
+    struct q_engine * const w =
         q_init(ifname, 0, 0, cache, tls_log, verify_certs, flip_keys);
     struct conn_cache cc = splay_initializer(cc);
     struct http_parser_url u = {0};
@@ -20,7 +20,10 @@ function run_test() {
         local base
         base=$(basename -s .qv "$1")
         local dc="docker-compose -p $base"
-        local size=10000
+        local size
+        # tests can ask for a different transfer size with a "# size" line
+        size=$(sed -n -E "s/^# size ([0-9]+)$/\\1/p" "$1")
+        size=${size:-10000}
 
         $dc up --no-start 2> /dev/null
         local cmd="$dc run --detach --no-deps -T --service-ports"
@@ -55,7 +55,8 @@ static void __attribute__((noreturn)) usage(const char * const name,
                                             const char * const dir,
                                             const char * const cert,
                                             const char * const key,
-                                            const uint64_t timeout)
+                                            const uint64_t timeout,
+                                            const uint8_t workers)
 {
     printf("%s [options]\n", name);
     printf("\t[-i interface]\tinterface to run over; default %s\n", ifname);
@@ -65,6 +66,7 @@ static void __attribute__((noreturn)) usage(const char * const name,
     printf("\t[-k key]\tTLS key; default %s\n", key);
     printf("\t[-t timeout]\tidle timeout in seconds; default %" PRIu64 "\n",
            timeout);
+    printf("\t[-w workers]\tnumber of worker threads; default %u\n", workers);
 #ifndef NDEBUG
     printf("\t[-v verbosity]\tverbosity level (0-%d, default %d)\n", DLEVEL,
            util_dlevel);
@@ -76,7 +78,7 @@ static void __attribute__((noreturn)) usage(const char * const name,
 struct cb_data {
     struct q_stream * s;
     struct q_conn * c;
-    struct w_engine * w;
+    struct q_engine * w;
     int dir;
     uint32_t _dummy;
 };
@@ -120,7 +122,7 @@ static int serve_cb(http_parser * parser, const char * at, size_t len)
     uint32_t n = (uint32_t)MIN(UINT32_MAX, strtoul(&path[2], 0, 10));
     if (n) {
         struct w_iov_sq out = w_iov_sq_initializer(out);
-        q_alloc(d->w, &out, n);
+        q_alloc_stream(d->s, &out, n);
         // check whether we managed to allow enough buffers
         if (w_iov_sq_len(&out) != n) {
             warn(ERR, "could only allocate %u/%u bytes of buffer",
@@ -169,99 +171,48 @@ static int serve_cb(http_parser * parser, const char * at, size_t len)
 
 #define MAXPORTS 16
 
-int main(int argc, char * argv[])
-{
-    uint64_t timeout = 10;
-#ifndef NDEBUG
-    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
-#endif
-    char ifname[IFNAMSIZ] = "lo"
-#ifndef __linux__
-                            "0"
-#endif
-        ;
-    char dir[MAXPATHLEN] = "/Users/lars/Sites/lars/output";
-    char cert[MAXPATHLEN] =
-        "/etc/letsencrypt/live/slate.eggert.org/fullchain.pem";
-    char key[MAXPATHLEN] = "/etc/letsencrypt/live/slate.eggert.org/privkey.pem";
-    uint16_t port[MAXPORTS] = {4433, 4434};
-    size_t num_ports = 0;
-    int ch;
-    int ret = 0;
-
-    while ((ch = getopt(argc, argv, "hi:p:d:v:c:k:t:")) != -1) {
-        switch (ch) {
-        case 'i':
-            strncpy(ifname, optarg, sizeof(ifname) - 1);
-            break;
-        case 'd':
-            strncpy(dir, optarg, sizeof(dir) - 1);
-            break;
-        case 'c':
-            strncpy(cert, optarg, sizeof(cert) - 1);
-            break;
-        case 'k':
-            strncpy(key, optarg, sizeof(key) - 1);
-            break;
-        case 'p':
-            port[num_ports++] =
-                (uint16_t)MIN(UINT16_MAX, strtoul(optarg, 0, 10));
-            ensure(num_ports < MAXPORTS, "can only listen on at most %u ports",
-                   MAXPORTS);
-            break;
-        case 't':
-            timeout = MIN(IDLE_TIMEOUT_MAX, strtoul(optarg, 0, 10));
-            break;
-        case 'v':
-#ifndef NDEBUG
-            util_dlevel = (short)MIN(DLEVEL, strtoul(optarg, 0, 10));
-#endif
-            break;
-        case 'h':
-        case '?':
-        default:
-            usage(basename(argv[0]), ifname, port[0], dir, cert, key, timeout);
-        }
-    }
-
-    if (num_ports == 0)
-        // if no -p args were given, we listen on two ports by default
-        num_ports = 2;
+struct serv_cfg {
+    uint16_t port[MAXPORTS];
+    size_t num_ports;
+    uint64_t timeout;
+    int dir_fd;
+    int ret;
+};
 
-    const int dir_fd = open(dir, O_RDONLY | O_CLOEXEC);
-    ensure(dir_fd != -1, "%s does not exist", dir);
 
-    struct w_engine * const w = q_init(ifname, cert, key, 0, 0, false, false);
+static void __attribute__((nonnull))
+serve(struct q_engine * const w, void * const arg)
+{
+    struct serv_cfg * const cfg = arg;
     struct q_conn * conn[MAXPORTS];
-    for (size_t i = 0; i < num_ports; i++) {
-        conn[i] = q_bind(w, port[i]);
-        warn(DBG, "%s waiting on %s port %d", basename(argv[0]), ifname,
-             port[i]);
+    for (size_t i = 0; i < cfg->num_ports; i++) {
+        conn[i] = q_bind(w, cfg->port[i]);
+        warn(DBG, "waiting on port %d", cfg->port[i]);
     }
 
     bool first_conn = true;
     http_parser_settings settings = {.on_url = serve_cb};
 
     while (1) {
-        struct q_conn * c = q_rx_ready(first_conn ? 0 : timeout);
+        struct q_conn * c = q_rx_ready(w, first_conn ? 0 : cfg->timeout);
         if (c == 0)
             break;
         first_conn = false;
 
         // do we need to q_accept?
         size_t i = 0;
-        for (; i < num_ports; i++)
+        for (; i < cfg->num_ports; i++)
             if (c == conn[i]) {
-                q_accept(0);
+                q_accept(w, 0);
                 break;
             }
-        if (i < num_ports)
+        if (i < cfg->num_ports)
             continue;
 
 
         while (1) {
             // do we need to handle a request?
-            struct cb_data d = {.c = c, .w = w, .dir = dir_fd};
+            struct cb_data d = {.c = c, .w = w, .dir = cfg->dir_fd};
             http_parser parser = {.data = &d};
 
             http_parser_init(&parser, HTTP_REQUEST);
@@ -279,7 +230,7 @@ int main(int argc, char * argv[])
                 if (parsed != v->len) {
                     warn(ERR, "HTTP parser error: %.*s", v->len - parsed,
                          &v->buf[parsed]);
-                    ret = 1;
+                    cfg->ret = 1;
                     break;
                 }
                 if (q_peer_has_closed_stream(s)) {
@@ -291,8 +242,76 @@ int main(int argc, char * argv[])
         }
         q_close(c);
     }
+}
+
+
+int main(int argc, char * argv[])
+{
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+#endif
+    char ifname[IFNAMSIZ] = "lo"
+#ifndef __linux__
+                            "0"
+#endif
+        ;
+    char dir[MAXPATHLEN] = "/Users/lars/Sites/lars/output";
+    char cert[MAXPATHLEN] =
+        "/etc/letsencrypt/live/slate.eggert.org/fullchain.pem";
+    char key[MAXPATHLEN] = "/etc/letsencrypt/live/slate.eggert.org/privkey.pem";
+    struct serv_cfg cfg = {.port = {4433, 4434}, .timeout = 10};
+    uint8_t workers = 1;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "hi:p:d:v:c:k:t:w:")) != -1) {
+        switch (ch) {
+        case 'i':
+            strncpy(ifname, optarg, sizeof(ifname) - 1);
+            break;
+        case 'd':
+            strncpy(dir, optarg, sizeof(dir) - 1);
+            break;
+        case 'c':
+            strncpy(cert, optarg, sizeof(cert) - 1);
+            break;
+        case 'k':
+            strncpy(key, optarg, sizeof(key) - 1);
+            break;
+        case 'p':
+            cfg.port[cfg.num_ports++] =
+                (uint16_t)MIN(UINT16_MAX, strtoul(optarg, 0, 10));
+            ensure(cfg.num_ports < MAXPORTS,
+                   "can only listen on at most %u ports", MAXPORTS);
+            break;
+        case 't':
+            cfg.timeout = MIN(IDLE_TIMEOUT_MAX, strtoul(optarg, 0, 10));
+            break;
+        case 'w':
+            workers = (uint8_t)MAX(1, MIN(UINT8_MAX, strtoul(optarg, 0, 10)));
+            break;
+        case 'v':
+#ifndef NDEBUG
+            util_dlevel = (short)MIN(DLEVEL, strtoul(optarg, 0, 10));
+#endif
+            break;
+        case 'h':
+        case '?':
+        default:
+            usage(basename(argv[0]), ifname, cfg.port[0], dir, cert, key,
+                  cfg.timeout, workers);
+        }
+    }
+
+    if (cfg.num_ports == 0)
+        // if no -p args were given, we listen on two ports by default
+        cfg.num_ports = 2;
+
+    cfg.dir_fd = open(dir, O_RDONLY | O_CLOEXEC);
+    ensure(cfg.dir_fd != -1, "%s does not exist", dir);
 
-    q_cleanup(w);
+    struct q_workers * const wrk = q_init_workers(
+        workers, serve, &cfg, ifname, cert, key, 0, 0, false, false);
+    q_cleanup_workers(wrk);
     warn(DBG, "%s exiting", basename(argv[0]));
-    return ret;
+    return cfg.ret;
 }
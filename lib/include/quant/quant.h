@@ -39,12 +39,15 @@ extern "C" {
 #include <quant/config.h> // IWYU pragma: export
 
 struct w_iov_sq;
+struct q_conn;
 struct q_stream;
+struct q_engine;
+struct q_workers;
 
 #define IDLE_TIMEOUT_MAX 600 // 10 minutes
 
 
-extern struct w_engine * __attribute__((nonnull(1)))
+extern struct q_engine * __attribute__((nonnull(1)))
 q_init(const char * const ifname,
        const char * const cert,
        const char * const key,
@@ -53,10 +56,72 @@ q_init(const char * const ifname,
        const bool verify_certs,
        const bool flip_keys);
 
-extern void __attribute__((nonnull)) q_cleanup(struct w_engine * const w);
+extern void __attribute__((nonnull)) q_cleanup(struct q_engine * const qe);
+
+/// Callbacks for driving an engine without blocking, via q_run_once(). Any of
+/// them may be zero. They are called from within the event loop, i.e., from
+/// q_run_once() or any blocking API call, and must not themselves call any API
+/// function that blocks.
+struct q_callbacks {
+    /// Connection @p c is established (client) or was accepted (server).
+    /// Server connections are only passed here, and not queued for q_accept().
+    void (*on_conn_ready)(struct q_conn * const c, void * const arg);
+    /// Stream @p s has new data that can be obtained with q_read().
+    void (*on_stream_readable)(struct q_stream * const s, void * const arg);
+    /// Stream @p s was blocked by flow control and can now send again.
+    void (*on_stream_writable)(struct q_stream * const s, void * const arg);
+    /// All data written to stream @p s so far was acknowledged by the peer.
+    void (*on_write_acked)(struct q_stream * const s, void * const arg);
+    /// Connection @p c is closed and should be released with q_close().
+    void (*on_conn_closed)(struct q_conn * const c, void * const arg);
+    void * arg; ///< Passed to all callbacks.
+};
+
+extern void __attribute__((nonnull))
+q_set_callbacks(struct q_engine * const qe,
+                const struct q_callbacks * const cb);
+
+extern void __attribute__((nonnull))
+q_run_once(struct q_engine * const qe, const double timeout);
+
+/// Limit the number of datagrams engine @p qe reads and processes from a socket
+/// before it lets timers and TX run, so that a flood of packets can't starve
+/// them. Remaining datagrams are read in the next event loop iteration. Zero
+/// reads until the socket is drained. The default is 1024.
+extern void __attribute__((nonnull))
+q_set_rx_budget(struct q_engine * const qe, const uint32_t budget);
+
+/// Hold back all datagrams engine @p qe sends for @p delay seconds, to emulate
+/// a path with a large RTT, e.g., to test congestion control at a large
+/// bandwidth-delay product. For testing only. The default is zero, i.e., no
+/// delay.
+extern void __attribute__((nonnull))
+q_set_tx_delay(struct q_engine * const qe, const double delay);
+
+/// Function run by each worker thread of a q_workers group.
+typedef void (*q_worker_fn)(struct q_engine * const qe, void * const arg);
+
+/// Run @p fn on @p n worker threads, each with its own engine. The workers
+/// bind the same server port and steer packets to each other by CID. If
+/// warpcore lacks W_REUSEPORT, worker 0 owns the only server socket, and sends
+/// and receives on behalf of the others.
+extern struct q_workers * __attribute__((nonnull(2, 4)))
+q_init_workers(const uint8_t n,
+               const q_worker_fn fn,
+               void * const arg,
+               const char * const ifname,
+               const char * const cert,
+               const char * const key,
+               const char * const cache,
+               const char * const tls_log,
+               const bool verify_certs,
+               const bool flip_keys);
+
+extern void __attribute__((nonnull))
+q_cleanup_workers(struct q_workers * const wrk);
 
 extern struct q_conn * __attribute__((nonnull(1, 2, 3)))
-q_connect(struct w_engine * const w,
+q_connect(struct q_engine * const qe,
           const struct sockaddr_in * const peer,
           const char * const peer_name,
           struct w_iov_sq * const early_data,
@@ -64,26 +129,184 @@ q_connect(struct w_engine * const w,
           const bool fin,
           const uint64_t idle_timeout);
 
+extern struct q_conn * __attribute__((nonnull(1, 2, 3)))
+q_connect_async(struct q_engine * const qe,
+                const struct sockaddr_in * const peer,
+                const char * const peer_name,
+                struct w_iov_sq * const early_data,
+                struct q_stream ** const early_data_stream,
+                const bool fin,
+                const uint64_t idle_timeout);
+
 extern void __attribute__((nonnull)) q_close(struct q_conn * const c);
 
 extern struct q_conn * __attribute__((nonnull))
-q_bind(struct w_engine * const w, const uint16_t port);
+q_bind(struct q_engine * const qe, const uint16_t port);
 
-extern struct q_conn * q_accept(const uint64_t timeout);
+extern struct q_conn * __attribute__((nonnull))
+q_accept(struct q_engine * const qe, const uint64_t timeout);
 
 extern bool __attribute__((nonnull))
 q_write(struct q_stream * const s, struct w_iov_sq * const q, const bool fin);
 
+/// Queue the data in @p q for transmission on stream @p s and return without
+/// waiting for it to be ACKed. Ownership of the buffers passes to the stream,
+/// which frees them as they are ACKed; @p q is empty on return. Register an
+/// on_write_acked callback to learn when all data on the stream was ACKed.
+/// Small writes that are still unsent share packets, with other data of the
+/// same stream, and with small writes on other streams.
+///
+/// @param      s     Stream to write to.
+/// @param      q     Data to write.
+/// @param[in]  fin   Whether to close the stream after the data.
+///
+/// @return     True if the data was queued, false otherwise (in which case the
+///             caller retains ownership of @p q).
+///
+extern bool __attribute__((nonnull))
+q_write_async(struct q_stream * const s,
+              struct w_iov_sq * const q,
+              const bool fin);
+
 extern struct q_stream * __attribute__((nonnull))
 q_read(struct q_conn * const c, struct w_iov_sq * const q, const bool block);
 
+/// Policies for interleaving the data of several streams of a connection. In
+/// each scheduling round, every stream picked by the policy may send up to its
+/// quantum of packets, until the congestion window is full.
+typedef enum {
+    q_sched_rr = 0,  ///< Round-robin, one packet per stream and round.
+    q_sched_wfq = 1, ///< Weighted fair, by the packet weight of each stream.
+    q_sched_prio = 2 ///< Strict priority by urgency, round-robin among equals.
+} q_sched_t;
+
+/// Use scheduler @p sched for the streams of connection @p c. The default is
+/// q_sched_rr.
+extern void __attribute__((nonnull))
+q_set_scheduler(struct q_conn * const c, const q_sched_t sched);
+
+/// Set the scheduling parameters of stream @p s.
+///
+/// @param      s        Stream to prioritize.
+/// @param[in]  urgency  Urgency for q_sched_prio, lower values are sent first.
+///                      The default is 3.
+/// @param[in]  weight   Packets per round for q_sched_wfq, at least one. The
+///                      default is 1.
+///
+extern void __attribute__((nonnull))
+q_stream_set_priority(struct q_stream * const s,
+                      const uint8_t urgency,
+                      const uint8_t weight);
+
+/// Cork stream @p s: hold back data that doesn't fill a packet, so that small
+/// writes are sent in as few packets as possible. While corked, q_write()
+/// copies the data into the stream and returns without waiting for it to be
+/// ACKed. Closing the stream with a FIN sends the held-back data.
+extern void __attribute__((nonnull)) q_stream_cork(struct q_stream * const s);
+
+/// Uncork stream @p s, and send any data held back since q_stream_cork(). The
+/// data is sent the next time the event loop runs, e.g., in q_read().
+extern void __attribute__((nonnull))
+q_stream_uncork(struct q_stream * const s);
+
+/// Congestion controllers.
+typedef enum {
+    q_cc_newreno = 0, ///< NewReno, as in the QUIC recovery draft.
+    q_cc_cubic = 1,   ///< CUBIC [RFC8312], for paths with a large BDP.
+    q_cc_bbr = 2      ///< BBR, which doesn't treat random loss as congestion.
+} q_cc_t;
+
+/// Use congestion controller @p cc for connection @p c. Switching resets the
+/// state of the controller, but not the current cwnd.
+extern void __attribute__((nonnull))
+q_set_cc(struct q_conn * const c, const q_cc_t cc);
+
+/// Use congestion controller @p cc for new connections of engine @p qe. The
+/// default is q_cc_newreno.
+extern void __attribute__((nonnull))
+q_set_default_cc(struct q_engine * const qe, const q_cc_t cc);
+
+/// Counters of an engine, see q_engine_stats(). The TX and RX counters count
+/// calls into warpcore, not syscalls; how many syscalls a w_tx() or w_rx() call
+/// takes depends on the warpcore backend.
+struct q_engine_stats {
+    uint64_t tx_dgrams;      ///< Datagrams handed to w_tx().
+    uint64_t tx_w_calls;     ///< Calls to w_tx() they were handed over in.
+    uint64_t rx_dgrams;      ///< Datagrams returned by w_rx().
+    uint64_t rx_w_calls;     ///< Calls to w_rx() that returned them.
+    uint64_t ss_exits_delay; ///< Slow starts ended by HyStart++.
+    uint64_t ss_exits_loss;  ///< Slow starts ended by loss.
+};
+
+/// Copy the counters of engine @p qe, accumulated over all its connections so
+/// far, into @p st.
+extern void __attribute__((nonnull))
+q_engine_stats(const struct q_engine * const qe,
+               struct q_engine_stats * const st);
+
+/// Loss detection counters of a connection, see q_conn_stats().
+struct q_conn_stats {
+    uint64_t pkts_lost;     ///< Packets declared lost.
+    uint64_t pkts_spurious; ///< Packets declared lost that were ACKed later.
+    uint64_t rec_undone;    ///< Recovery periods undone as spurious.
+};
+
+/// Copy the loss detection counters of connection @p c into @p st.
+extern void __attribute__((nonnull))
+q_conn_stats(const struct q_conn * const c, struct q_conn_stats * const st);
+
+/// Let the receive windows of all connections of engine @p qe together grow to
+/// at most @p budget bytes, which bounds the received data the app has not yet
+/// read. Each stream window is also capped at @p budget. Windows grow when the
+/// app reads a window's worth of data within two RTTs, i.e., when they limit
+/// throughput. They never shrink below their initial sizes. The default is 16
+/// MB.
+extern void __attribute__((nonnull))
+q_set_fc_budget(struct q_engine * const qe, const uint64_t budget);
+
+/// Let the peers of new connections of engine @p qe initially open @p bidi
+/// bidirectional and @p uni unidirectional streams. More are granted ahead of
+/// demand, and the faster a peer opens streams, the more are granted at once.
+/// The defaults are 6 and 2.
+extern void __attribute__((nonnull))
+q_set_init_streams(struct q_engine * const qe,
+                   const uint16_t bidi,
+                   const uint16_t uni);
+
+/// Make new connections of engine @p qe ACK after every @p pkts ACK-eliciting
+/// packets, or @p delay seconds after the first one, whichever comes first.
+/// Out-of-order packets are always ACKed right away. The defaults are two
+/// packets and 25 ms; @p delay is capped at 255 ms.
+extern void __attribute__((nonnull))
+q_set_default_ack_freq(struct q_engine * const qe,
+                       const uint16_t pkts,
+                       const double delay);
+
+/// Ask the peer of connection @p c to ACK after every @p pkts ACK-eliciting
+/// packets, or @p delay seconds after the first one, by sending an
+/// ACK_FREQUENCY frame [draft-iyengar-quic-delayed-ack]. Does nothing if the
+/// peer did not indicate support for the frame.
+extern void __attribute__((nonnull))
+q_request_ack_freq(struct q_conn * const c,
+                   const uint16_t pkts,
+                   const double delay);
+
 extern struct q_stream * __attribute__((nonnull))
 q_rsv_stream(struct q_conn * const c, const bool bidi);
 
 extern void __attribute__((nonnull)) q_close_stream(struct q_stream * const s);
 
+extern void __attribute__((nonnull)) q_alloc(struct q_engine * const qe,
+                                             struct w_iov_sq * const q,
+                                             const size_t len);
+
+/// Like q_alloc(), but chunks the data to fill the packets of the connection
+/// of stream @p s, which grow once path MTU discovery found larger ones to
+/// work.
 extern void __attribute__((nonnull))
-q_alloc(struct w_engine * const w, struct w_iov_sq * const q, const size_t len);
+q_alloc_stream(const struct q_stream * const s,
+               struct w_iov_sq * const q,
+               const size_t len);
 
 extern void __attribute__((nonnull)) q_free(struct w_iov_sq * const q);
 
@@ -91,18 +314,18 @@ extern char * __attribute__((nonnull)) q_cid(struct q_conn * const c);
 
 extern uint64_t __attribute__((nonnull)) q_sid(const struct q_stream * const s);
 
-extern void __attribute__((nonnull)) q_chunk_str(struct w_engine * const w,
+extern void __attribute__((nonnull)) q_chunk_str(struct q_engine * const qe,
                                                  const char * const str,
                                                  const size_t len,
                                                  struct w_iov_sq * o);
 
-extern void __attribute__((nonnull)) q_write_str(struct w_engine * const w,
+extern void __attribute__((nonnull)) q_write_str(struct q_engine * const qe,
                                                  struct q_stream * const s,
                                                  const char * const str,
                                                  const size_t len,
                                                  const bool fin);
 
-extern void __attribute__((nonnull)) q_write_file(struct w_engine * const w,
+extern void __attribute__((nonnull)) q_write_file(struct q_engine * const qe,
                                                   struct q_stream * const s,
                                                   const int f,
                                                   const size_t len,
@@ -114,7 +337,8 @@ q_peer_has_closed_stream(struct q_stream * const s);
 extern void __attribute__((nonnull))
 q_readall_str(struct q_stream * const s, struct w_iov_sq * const q);
 
-extern struct q_conn * q_rx_ready(const uint64_t timeout);
+extern struct q_conn * __attribute__((nonnull))
+q_rx_ready(struct q_engine * const qe, const uint64_t timeout);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,405 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2018, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/param.h>
+
+#include <ev.h>
+#include <warpcore/warpcore.h>
+
+#include "cc.h"
+#include "conn.h"
+#include "pn.h"
+#include "quic.h"
+#include "recovery.h"
+
+
+/// Pacing gains of the PROBE_BW phases.
+static const double pacing_gain_cycle[] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+
+#define CYCLE_LEN (sizeof(pacing_gain_cycle) / sizeof(pacing_gain_cycle[0]))
+
+
+static ev_tstamp __attribute__((nonnull))
+now(const struct q_conn * const c)
+{
+    return ev_now(ped(c->w)->loop);
+}
+
+
+/// The amount of data in flight that a gain of @p gain would allow.
+static uint64_t __attribute__((nonnull))
+inflight(const struct q_conn * const c, const double gain)
+{
+    const struct bbr * const b = &c->rec.bbr;
+    if (is_inf(b->min_rtt))
+        return kInitialWindow;
+
+    // allow for some delayed and stretched ACKs
+    const double bdp = b->btl_bw * b->min_rtt;
+    return (uint64_t)(gain * bdp) + 3 * kMaxDatagramSize;
+}
+
+
+static void __attribute__((nonnull))
+update_max_filter(struct bbr * const b, const double bw)
+{
+    // Kathleen Nichols' algorithm: keep the best, second-best and third-best
+    // samples of the window, each newer than the previous one
+    const struct bw_sample s = {.rnd = b->rnd, .bw = bw};
+    if (bw >= b->bw[0].bw || b->rnd - b->bw[2].rnd >= kBbrBwWindow) {
+        // new max, or nothing in the window
+        b->bw[0] = b->bw[1] = b->bw[2] = s;
+        return;
+    }
+
+    if (bw >= b->bw[1].bw)
+        b->bw[1] = b->bw[2] = s;
+    else if (bw >= b->bw[2].bw)
+        b->bw[2] = s;
+
+    // expire samples that have left the window
+    if (b->rnd - b->bw[0].rnd >= kBbrBwWindow) {
+        b->bw[0] = b->bw[1];
+        b->bw[1] = b->bw[2];
+        b->bw[2] = s;
+        if (b->rnd - b->bw[0].rnd >= kBbrBwWindow) {
+            b->bw[0] = b->bw[1];
+            b->bw[1] = b->bw[2];
+        }
+    } else if (b->bw[1].rnd == b->bw[0].rnd &&
+               b->rnd - b->bw[1].rnd >= kBbrBwWindow / 4)
+        // a quarter of the window passed without a second-best sample
+        b->bw[1] = b->bw[2] = s;
+    else if (b->bw[2].rnd == b->bw[1].rnd &&
+             b->rnd - b->bw[2].rnd >= kBbrBwWindow / 2)
+        // half of the window passed without a third-best sample
+        b->bw[2] = s;
+}
+
+
+static void __attribute__((nonnull))
+update_btl_bw(struct q_conn * const c, const struct rate_sample * const rs)
+{
+    struct bbr * const b = &c->rec.bbr;
+
+    // a round trip ends when a pkt sent after its start is ACKed
+    b->rnd_start = false;
+    if (rs->prior_delivered >= b->next_rnd_delivered) {
+        b->next_rnd_delivered = c->rec.delivered;
+        b->rnd++;
+        b->rnd_start = true;
+    }
+
+    // app-limited samples only underestimate the bandwidth, unless they are
+    // larger than what we have
+    if (rs->rate > 0 && (rs->rate >= b->btl_bw || !rs->is_app_limited)) {
+        update_max_filter(b, rs->rate);
+        b->btl_bw = b->bw[0].bw;
+    }
+}
+
+
+static void __attribute__((nonnull)) enter_probe_bw(struct q_conn * const c)
+{
+    struct bbr * const b = &c->rec.bbr;
+    b->state = bbr_probe_bw;
+    b->cwnd_gain = kBbrCwndGain;
+    // start in a random phase, but not in the one that drains the queue
+    b->cycle_idx = (uint8_t)(w_rand() % (CYCLE_LEN - 1));
+    if (b->cycle_idx > 0)
+        b->cycle_idx++;
+    b->cycle_t = now(c);
+    b->pacing_gain = pacing_gain_cycle[b->cycle_idx];
+}
+
+
+static void __attribute__((nonnull))
+check_cycle_phase(struct q_conn * const c, const struct rate_sample * const rs)
+{
+    struct bbr * const b = &c->rec.bbr;
+    if (b->state != bbr_probe_bw)
+        return;
+
+    const bool full_len = now(c) - b->cycle_t > b->min_rtt;
+    bool next;
+    if (b->pacing_gain > 1)
+        // probe until the queue is built up, or until there is loss
+        next = full_len && (rs->lost || rs->prior_in_flight >=
+                                            inflight(c, b->pacing_gain));
+    else if (b->pacing_gain < 1)
+        // drain until the queue is gone
+        next = full_len || rs->prior_in_flight <= inflight(c, 1);
+    else
+        next = full_len;
+
+    if (next) {
+        b->cycle_idx = (uint8_t)((b->cycle_idx + 1) % CYCLE_LEN);
+        b->cycle_t = now(c);
+        b->pacing_gain = pacing_gain_cycle[b->cycle_idx];
+    }
+}
+
+
+static void __attribute__((nonnull))
+check_full_pipe(struct q_conn * const c, const struct rate_sample * const rs)
+{
+    struct bbr * const b = &c->rec.bbr;
+    if (b->filled_pipe || !b->rnd_start || rs->is_app_limited)
+        return;
+
+    if (b->btl_bw >= b->full_bw * 1.25) {
+        // still growing
+        b->full_bw = b->btl_bw;
+        b->full_bw_cnt = 0;
+        return;
+    }
+
+    // three rounds without 25% growth mean the pipe is full
+    if (++b->full_bw_cnt >= 3) {
+        b->filled_pipe = true;
+        warn(INF, "BBR filled pipe on %s conn %s, btl_bw %.0f B/s",
+             conn_type(c), cid2str(c->scid), b->btl_bw);
+    }
+}
+
+
+static void __attribute__((nonnull)) check_drain(struct q_conn * const c)
+{
+    struct bbr * const b = &c->rec.bbr;
+    if (b->state == bbr_startup && b->filled_pipe) {
+        // drain the queue that STARTUP built
+        b->state = bbr_drain;
+        b->pacing_gain = 1 / kBbrHighGain;
+        b->cwnd_gain = kBbrHighGain;
+    }
+
+    if (b->state == bbr_drain && c->rec.in_flight <= inflight(c, 1))
+        enter_probe_bw(c);
+}
+
+
+static void __attribute__((nonnull))
+exit_probe_rtt(struct q_conn * const c)
+{
+    struct bbr * const b = &c->rec.bbr;
+    c->rec.cwnd = MAX(c->rec.cwnd, b->prior_cwnd);
+    if (b->filled_pipe)
+        enter_probe_bw(c);
+    else {
+        b->state = bbr_startup;
+        b->pacing_gain = b->cwnd_gain = kBbrHighGain;
+    }
+}
+
+
+static void __attribute__((nonnull))
+update_min_rtt(struct q_conn * const c, const struct rate_sample * const rs)
+{
+    struct bbr * const b = &c->rec.bbr;
+    const ev_tstamp t = now(c);
+    const bool expired = t > b->min_rtt_t + kBbrMinRttWindow;
+    if (rs->rtt > 0 && (rs->rtt <= b->min_rtt || expired)) {
+        b->min_rtt = rs->rtt;
+        b->min_rtt_t = t;
+    }
+
+    if (expired && b->state != bbr_probe_rtt) {
+        // drain the queue to measure min_rtt again
+        b->state = bbr_probe_rtt;
+        b->pacing_gain = 1;
+        b->prior_cwnd = c->rec.cwnd;
+        b->probe_rtt_end_t = 0;
+    }
+
+    if (b->state != bbr_probe_rtt)
+        return;
+
+    if (is_zero(b->probe_rtt_end_t)) {
+        if (c->rec.in_flight <= kBbrMinPipeCwnd) {
+            b->probe_rtt_end_t = t + kBbrProbeRttTime;
+            b->probe_rtt_rnd_done = false;
+            b->next_rnd_delivered = c->rec.delivered;
+        }
+        return;
+    }
+
+    if (b->rnd_start)
+        b->probe_rtt_rnd_done = true;
+    if (b->probe_rtt_rnd_done && t > b->probe_rtt_end_t) {
+        b->min_rtt_t = t;
+        exit_probe_rtt(c);
+    }
+}
+
+
+static void __attribute__((nonnull))
+set_pacing_rate(struct q_conn * const c)
+{
+    struct bbr * const b = &c->rec.bbr;
+    const double rate = b->pacing_gain * b->btl_bw;
+    // don't slow down before the pipe is known to be full
+    if (rate > 0 && (b->filled_pipe || rate > b->pacing_rate))
+        b->pacing_rate = rate;
+}
+
+
+static void __attribute__((nonnull))
+set_cwnd(struct q_conn * const c, const struct rate_sample * const rs)
+{
+    struct bbr * const b = &c->rec.bbr;
+
+    if (b->in_rec && b->conserve) {
+        // packet conservation for the first round of recovery
+        c->rec.cwnd = MAX(c->rec.cwnd, c->rec.in_flight + rs->acked);
+        if (b->rnd > b->rec_rnd)
+            b->conserve = false;
+    } else {
+        const uint64_t target = inflight(c, b->cwnd_gain);
+        if (b->filled_pipe)
+            c->rec.cwnd = MIN(c->rec.cwnd + rs->acked, target);
+        else if (c->rec.cwnd < target || c->rec.delivered < kInitialWindow)
+            c->rec.cwnd += rs->acked;
+    }
+
+    c->rec.cwnd = MAX(c->rec.cwnd, kBbrMinPipeCwnd);
+    if (b->state == bbr_probe_rtt)
+        c->rec.cwnd = MIN(c->rec.cwnd, kBbrMinPipeCwnd);
+}
+
+
+static void __attribute__((nonnull)) bbr_init(struct q_conn * const c)
+{
+    struct bbr * const b = &c->rec.bbr;
+    *b = (struct bbr){.state = bbr_startup,
+                      .pacing_gain = kBbrHighGain,
+                      .cwnd_gain = kBbrHighGain,
+                      .min_rtt = HUGE_VAL,
+                      .min_rtt_t = now(c)};
+
+    const ev_tstamp rtt =
+        is_zero(c->rec.srtt) ? kDefaultInitialRtt : c->rec.srtt;
+    b->pacing_rate = kBbrHighGain * (double)c->rec.cwnd / rtt;
+}
+
+
+static void __attribute__((nonnull))
+bbr_on_sent(struct q_conn * const c __attribute__((unused)),
+            const struct w_iov * const v __attribute__((unused)))
+{
+}
+
+
+static void __attribute__((nonnull))
+bbr_on_acked(struct q_conn * const c, const struct w_iov * const v)
+{
+    struct bbr * const b = &c->rec.bbr;
+    if (b->in_rec && !in_recovery(c, meta(v).hdr.nr)) {
+        // recovery is over, restore cwnd
+        b->in_rec = b->conserve = false;
+        c->rec.cwnd = MAX(c->rec.cwnd, b->prior_cwnd);
+    }
+}
+
+
+static void __attribute__((nonnull))
+bbr_on_spurious_loss(struct q_conn * const c)
+{
+    // end recovery early
+    struct bbr * const b = &c->rec.bbr;
+    b->in_rec = b->conserve = false;
+    c->rec.cwnd = MAX(c->rec.cwnd, b->prior_cwnd);
+}
+
+
+static void __attribute__((nonnull)) bbr_on_lost(struct q_conn * const c)
+{
+    // loss is no congestion signal for the model, so only conserve packets
+    // for a round, and restore cwnd once recovery is over
+    struct bbr * const b = &c->rec.bbr;
+    if (b->in_rec == false)
+        b->prior_cwnd =
+            b->state == bbr_probe_rtt ? MAX(b->prior_cwnd, c->rec.cwnd)
+                                      : c->rec.cwnd;
+    b->in_rec = b->conserve = true;
+    b->rec_rnd = b->rnd;
+    c->rec.cwnd = MAX(c->rec.in_flight + kMaxDatagramSize, kBbrMinPipeCwnd);
+}
+
+
+static void __attribute__((nonnull))
+bbr_on_rto_verified(struct q_conn * const c)
+{
+    struct bbr * const b = &c->rec.bbr;
+    if (b->in_rec == false)
+        b->prior_cwnd = c->rec.cwnd;
+    b->in_rec = true;
+    b->conserve = false;
+    c->rec.cwnd = kMinimumWindow;
+}
+
+
+static bool __attribute__((nonnull))
+bbr_can_send(const struct q_conn * const c)
+{
+    return c->rec.in_flight + w_mtu(c->w) < c->rec.cwnd;
+}
+
+
+static void __attribute__((nonnull))
+bbr_on_rate_sample(struct q_conn * const c,
+                   const struct rate_sample * const rs)
+{
+    update_btl_bw(c, rs);
+    check_cycle_phase(c, rs);
+    check_full_pipe(c, rs);
+    check_drain(c);
+    update_min_rtt(c, rs);
+    set_pacing_rate(c);
+    set_cwnd(c, rs);
+}
+
+
+static double __attribute__((nonnull))
+bbr_pacing_rate(const struct q_conn * const c)
+{
+    return c->rec.bbr.pacing_rate;
+}
+
+
+const struct cc_ops cc_bbr = {.name = "BBR",
+                              .init = bbr_init,
+                              .on_sent = bbr_on_sent,
+                              .on_acked = bbr_on_acked,
+                              .on_lost = bbr_on_lost,
+                              .on_rto_verified = bbr_on_rto_verified,
+                              .on_spurious_loss = bbr_on_spurious_loss,
+                              .can_send = bbr_can_send,
+                              .on_rate_sample = bbr_on_rate_sample,
+                              .pacing_rate = bbr_pacing_rate};
@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2018, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <ev.h>
+
+struct q_conn;
+struct w_iov;
+
+
+/// A delivery rate sample, accumulated over the packets newly ACKed by an ACK
+/// frame [draft-cheng-iccrg-delivery-rate-estimation].
+struct rate_sample {
+    uint64_t prior_delivered; ///< Delivered bytes at TX of newest ACKed pkt.
+    uint64_t prior_in_flight; ///< Bytes in flight before the ACK.
+    uint64_t delivered;       ///< Bytes delivered over the sample interval.
+    uint64_t acked;           ///< Bytes newly ACKed.
+    uint64_t lost;            ///< Bytes newly declared lost.
+    ev_tstamp send_elapsed;   ///< TX time covered by the sample.
+    ev_tstamp ack_elapsed;    ///< ACK time covered by the sample.
+    ev_tstamp rtt;            ///< RTT of the newest ACKed pkt.
+    double rate;              ///< Delivery rate (in bytes/sec), or zero.
+    bool is_app_limited;      ///< Was the sender app-limited at the time?
+    uint8_t _unused[7];
+};
+
+
+/// Congestion controller. recovery.c does loss detection and RTT estimation,
+/// and calls these to let the controller manage cwnd and ssthresh.
+struct cc_ops {
+    const char * name;
+
+    /// Reset the controller-specific state; cwnd and ssthresh are reset by the
+    /// caller.
+    void (*init)(struct q_conn * const c);
+
+    /// Retransmittable packet @p v is about to be sent; not yet counted in
+    /// in_flight.
+    void (*on_sent)(struct q_conn * const c, const struct w_iov * const v);
+
+    /// Retransmittable packet @p v was ACKed; already removed from in_flight.
+    void (*on_acked)(struct q_conn * const c, const struct w_iov * const v);
+
+    /// A packet sent after the end of the previous recovery period was lost,
+    /// i.e., this starts a new recovery period.
+    void (*on_lost)(struct q_conn * const c);
+
+    /// An RTO was verified, i.e., packets sent before it were lost.
+    void (*on_rto_verified)(struct q_conn * const c);
+
+    /// All packets lost in the last recovery period were ACKed after all, and
+    /// cwnd and ssthresh were restored to their values before it. May be zero.
+    void (*on_spurious_loss)(struct q_conn * const c);
+
+    /// Whether the window allows sending another full-sized packet.
+    bool (*can_send)(const struct q_conn * const c);
+
+    /// An ACK frame newly ACKed some packets; @p rs describes the delivery
+    /// rate they indicate. May be zero.
+    void (*on_rate_sample)(struct q_conn * const c,
+                           const struct rate_sample * const rs);
+
+    /// Rate to pace at (in bytes/sec). May be zero, in which case a multiple
+    /// of cwnd/srtt is used.
+    double (*pacing_rate)(const struct q_conn * const c);
+};
+
+
+/// State of the CUBIC congestion controller [RFC8312].
+struct cubic {
+    ev_tstamp epoch_t;        ///< Start of the CA epoch, or zero.
+    ev_tstamp k;              ///< Time to grow cwnd to @p origin (in sec).
+    uint64_t origin;          ///< cwnd the cubic function plateaus at.
+    uint64_t w_max;           ///< cwnd before the last reduction (in bytes).
+    uint64_t w_last_max;      ///< @p w_max before the last reduction.
+    uint64_t undo_w_max;      ///< @p w_max before the last loss.
+    uint64_t undo_w_last_max; ///< @p w_last_max before the last loss.
+    double w_est;             ///< Reno-friendly cwnd estimate (in bytes).
+    double w_inc;             ///< cwnd growth not yet applied (in bytes).
+};
+
+
+/// State of HyStart++ [RFC9406], used during the slow start of cc_newreno and
+/// cc_cubic.
+struct hystart {
+    ev_tstamp last_rnd_min_rtt; ///< Min RTT of the previous round.
+    ev_tstamp cur_rnd_min_rtt;  ///< Min RTT of the current round so far.
+    ev_tstamp css_base_min_rtt; ///< Min RTT when CSS was entered.
+    uint64_t rnd_end;           ///< Delivered bytes that end the round.
+    uint32_t rtt_cnt;           ///< RTT samples in the current round.
+    uint8_t css_rnds;           ///< Rounds spent in CSS.
+    bool in_css;                ///< In conservative slow start (CSS)?
+    uint8_t _unused[2];
+};
+
+
+/// Modes of the BBR congestion controller.
+typedef enum {
+    bbr_startup = 0,
+    bbr_drain = 1,
+    bbr_probe_bw = 2,
+    bbr_probe_rtt = 3
+} bbr_state_t;
+
+
+/// A sample of a windowed max filter.
+struct bw_sample {
+    uint64_t rnd; ///< Round trip the sample was taken in.
+    double bw;    ///< Delivery rate (in bytes/sec).
+};
+
+
+/// State of the BBR congestion controller [draft-cardwell-iccrg-bbr].
+struct bbr {
+    struct bw_sample bw[3]; ///< Max filter of delivery rates over rounds.
+    double btl_bw;          ///< Bottleneck bandwidth estimate (in bytes/sec).
+    double full_bw;         ///< @p btl_bw when STARTUP last saw it grow.
+    double pacing_rate;     ///< Current pacing rate (in bytes/sec).
+    double pacing_gain;     ///< Multiplier of @p btl_bw for pacing.
+    double cwnd_gain;       ///< Multiplier of the BDP for cwnd.
+
+    ev_tstamp min_rtt;         ///< min_rtt estimate, HUGE_VAL if none.
+    ev_tstamp min_rtt_t;       ///< When @p min_rtt was last set.
+    ev_tstamp cycle_t;         ///< Start of the current PROBE_BW phase.
+    ev_tstamp probe_rtt_end_t; ///< When PROBE_RTT may end, or zero.
+
+    uint64_t rnd;                ///< Round trip count.
+    uint64_t next_rnd_delivered; ///< Delivered bytes that end the round.
+    uint64_t prior_cwnd;         ///< cwnd before recovery or PROBE_RTT.
+    uint64_t rec_rnd;            ///< Round at which recovery started.
+
+    bbr_state_t state;
+    uint8_t cycle_idx;       ///< Phase of the PROBE_BW gain cycle.
+    uint8_t full_bw_cnt;     ///< Rounds without @p btl_bw growth.
+    bool filled_pipe;        ///< Has STARTUP found the bottleneck?
+    bool rnd_start;          ///< Did this ACK start a new round?
+    bool probe_rtt_rnd_done; ///< Has PROBE_RTT lasted a round?
+    bool in_rec;             ///< Is the connection in recovery?
+    bool conserve;           ///< Packet conservation during recovery?
+    uint8_t _unused[5];
+};
+
+
+extern const struct cc_ops cc_newreno;
+extern const struct cc_ops cc_cubic;
+extern const struct cc_ops cc_bbr;
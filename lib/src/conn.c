@@ -28,6 +28,7 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -52,6 +53,7 @@
 #include "quic.h"
 #include "recovery.h"
 #include "stream.h"
+#include "tls.h"
 
 
 #undef CONN_STATE
@@ -59,12 +61,6 @@
 
 const char * const conn_state_str[] = {CONN_STATES};
 
-struct q_conn_sl c_ready = sl_head_initializer(c_ready);
-
-khash_t(conns_by_ipnp) * conns_by_ipnp;
-khash_t(conns_by_id) * conns_by_id;
-
-
 static inline int __attribute__((nonnull))
 sockaddr_in_cmp(const struct sockaddr_in * const a,
                 const struct sockaddr_in * const b)
@@ -102,9 +98,6 @@ bool vers_supported(const uint32_t v)
 }
 
 
-struct ooo_0rtt_by_cid ooo_0rtt_by_cid = splay_initializer(&ooo_0rtt_by_cid);
-
-
 SPLAY_GENERATE(ooo_0rtt_by_cid, ooo_0rtt, node, ooo_0rtt_by_cid_cmp)
 
 
@@ -150,25 +143,27 @@ conns_by_ipnp_key(const uint16_t sport,
 
 
 static struct q_conn * __attribute__((nonnull))
-get_conn_by_ipnp(const uint16_t sport, const struct sockaddr_in * const peer)
+get_conn_by_ipnp(const struct q_engine * const e,
+                 const uint16_t sport,
+                 const struct sockaddr_in * const peer)
 {
     const khiter_t k =
-        kh_get(conns_by_ipnp, conns_by_ipnp,
+        kh_get(conns_by_ipnp, e->conns_by_ipnp,
                (khint64_t)conns_by_ipnp_key(sport, peer->sin_port,
                                             peer->sin_addr.s_addr));
-    if (unlikely(k == kh_end(conns_by_ipnp)))
+    if (unlikely(k == kh_end(e->conns_by_ipnp)))
         return 0;
-    return kh_val(conns_by_ipnp, k);
+    return kh_val(e->conns_by_ipnp, k);
 }
 
 
 static struct q_conn * __attribute__((nonnull))
-get_conn_by_cid(struct cid * const scid)
+get_conn_by_cid(const struct q_engine * const e, struct cid * const scid)
 {
-    const khiter_t k = kh_get(conns_by_id, conns_by_id, scid);
-    if (unlikely(k == kh_end(conns_by_id)))
+    const khiter_t k = kh_get(conns_by_id, e->conns_by_id, scid);
+    if (unlikely(k == kh_end(e->conns_by_id)))
         return 0;
-    return kh_val(conns_by_id, k);
+    return kh_val(e->conns_by_id, k);
 }
 
 
@@ -214,7 +209,7 @@ static void log_sent_pkts(struct q_conn * const c)
         uint64_t prev = UINT64_MAX;
         struct pkt_meta * p = 0;
         struct pn_space * const pn = pn_for_epoch(c, e);
-        splay_foreach (p, pm_by_nr, &pn->sent_pkts) {
+        pmr_foreach (p, &pn->sent_pkts) {
             char tmp[1024] = "";
             const bool ack_only = is_ack_only(&p->frames);
             snprintf(tmp, sizeof(tmp), "%s%s" FMT_PNR_OUT "%s ",
@@ -248,10 +243,17 @@ rtx_pkt(struct q_stream * const s, struct w_iov * const v)
     sl_insert_head(&meta(v).rtx, &meta(r), rtx_next);
     sl_insert_head(&meta(r).rtx, &meta(v), rtx_next);
 
+    // the RTX only repeats the stream frame of v, so the frames v carried for
+    // other streams stay with the earlier TX
+    meta(r).carried = meta(v).carried;
+    sl_init(&meta(v).carried);
+    for (struct pkt_meta * cm = sl_first(&meta(r).carried); cm;
+         cm = sl_next(cm, carried_next))
+        cm->carrier = &meta(r);
+
     // we reinsert meta(v) with its new pkt nr in on_pkt_sent()
-    ensure(splay_remove(pm_by_nr, &meta(v).pn->sent_pkts, &meta(v)), "removed");
-    ensure(splay_insert(pm_by_nr, &meta(r).pn->sent_pkts, &meta(r)) == 0,
-           "inserted");
+    ensure(pmr_remove(&meta(v).pn->sent_pkts, &meta(v)), "removed");
+    pmr_insert(&meta(r).pn->sent_pkts, &meta(r));
 }
 
 
@@ -266,25 +268,212 @@ static void __attribute__((nonnull)) do_tx(struct q_conn * const c)
                  pkt_type(*sq_first(&c->txq)->buf) != F_SH))
         coalesce(&c->txq);
 
-    // transmit encrypted/protected packets
-    w_tx(c->sock, &c->txq);
-    while (w_tx_pending(&c->txq))
-        w_nic_tx(c->w);
+    // the encrypted/protected packets are transmitted by tx_flush()
+    sq_concat(&c->txq_pend, &c->txq);
+    if (c->in_tx_pend == false) {
+        sl_insert_head(&ped(c->w)->tx_pend, c, node_tx);
+        c->in_tx_pend = true;
+    }
+}
+
+
+static void __attribute__((nonnull))
+tx_batch(struct q_engine * const e,
+         const struct w_sock * const ws,
+         struct w_iov_sq * const q)
+{
+    e->tx_dgrams += sq_len(q);
+    e->tx_w_calls++;
+
+    w_tx(ws, q);
+    while (w_tx_pending(q))
+        w_nic_tx(e->w);
 
     // txq was allocated straight from warpcore, no metadata needs to be freed
-    // const uint64_t avail = sq_len(&c->w->iov);
-    // const uint64_t sql = sq_len(&c->txq);
-    w_free(&c->txq);
+    // const uint64_t avail = sq_len(&e->w->iov);
+    // const uint64_t sql = sq_len(q);
+    w_free(q);
     // warn(CRT, "w_free %" PRIu64 " (avail %" PRIu64 "->%" PRIu64 ")", sql,
-    // avail, sq_len(&c->w->iov));
+    // avail, sq_len(&e->w->iov));
+}
+
+
+static void __attribute__((nonnull))
+tx_batch_or_delay(struct q_engine * const e,
+                  const struct w_sock * const ws,
+                  struct w_iov_sq * const q)
+{
+    if (likely(is_zero(e->tx_delay))) {
+        tx_batch(e, ws, q);
+        return;
+    }
+
+    struct q_delayed * const d = calloc(1, sizeof(*d));
+    ensure(d, "could not calloc");
+    d->t = ev_now(e->loop) + e->tx_delay;
+    d->ws = ws;
+    sq_init(&d->q);
+    sq_concat(&d->q, q);
+    sq_insert_tail(&e->delay_q, d, next);
+
+    if (ev_is_active(&e->delay_alarm) == false) {
+        ev_timer_set(&e->delay_alarm, e->tx_delay, 0);
+        ev_timer_start(e->loop, &e->delay_alarm);
+    }
+}
+
+
+void tx_delay_alarm(struct ev_loop * const l,
+                    ev_timer * const w,
+                    int e __attribute__((unused)))
+{
+    struct q_engine * const qe = w->data;
+    const ev_tstamp now = ev_now(l);
+    while (!sq_empty(&qe->delay_q)) {
+        struct q_delayed * const d = sq_first(&qe->delay_q);
+        if (d->t > now) {
+            // the delay is the same for all, so the rest is due later
+            ev_timer_set(w, d->t - now, 0);
+            ev_timer_start(l, w);
+            return;
+        }
+        sq_remove_head(&qe->delay_q, next);
+        tx_batch(qe, d->ws, &d->q);
+        free(d);
+    }
+}
+
+
+/// Immediately send the datagrams held back for socket @p ws, or for all
+/// sockets if @p ws is zero.
+///
+/// @param      e     Engine.
+/// @param      ws    Socket, or zero.
+///
+void tx_flush_delayed(struct q_engine * const e,
+                      const struct w_sock * const ws)
+{
+    struct q_delayed_sq keep;
+    sq_init(&keep);
+    while (!sq_empty(&e->delay_q)) {
+        struct q_delayed * const d = sq_first(&e->delay_q);
+        sq_remove_head(&e->delay_q, next);
+        if (ws == 0 || d->ws == ws) {
+            tx_batch(e, d->ws, &d->q);
+            free(d);
+        } else
+            sq_insert_tail(&keep, d, next);
+    }
+    sq_concat(&e->delay_q, &keep);
+}
+
+
+/// Copy @p v into a newly allocated q_steered for local port @p sport.
+///
+/// @param      v      Packet or datagram.
+/// @param      sport  Local port @p v was received on or is to be sent from.
+///
+/// @return     The copy.
+///
+static struct q_steered * __attribute__((nonnull))
+new_steered(const struct w_iov * const v, const uint16_t sport)
+{
+    struct q_steered * const p = malloc(sizeof(*p) + v->len);
+    ensure(p, "could not malloc");
+    p->ip = v->ip;
+    p->port = v->port;
+    p->sport = sport;
+    p->len = v->len;
+    p->flags = v->flags;
+    memcpy(p->buf, v->buf, v->len);
+    return p;
 }
 
 
+/// Hand the datagrams in @p q over to worker 0 for transmission from its
+/// server socket on port @p sport, see one_serv_sock().
+///
+/// @param      e      Engine.
+/// @param      sport  Server port.
+/// @param      q      Datagrams to send; freed.
+///
 static void __attribute__((nonnull))
+relay_dgrams(struct q_engine * const e,
+             const uint16_t sport,
+             struct w_iov_sq * const q)
+{
+    if (unlikely(e->wrk == 0)) {
+        // the worker group is being torn down, worker 0 may be gone
+        w_free(q);
+        return;
+    }
+
+    struct q_steered_sq r;
+    sq_init(&r);
+    const struct w_iov * v;
+    sq_foreach (v, q, next)
+        sq_insert_tail(&r, new_steered(v, sport), next);
+    w_free(q);
+
+    struct q_engine * const to = e->wrk->e[0];
+    pthread_mutex_lock(&to->steer_lock);
+    sq_concat(&to->relay_q, &r);
+    pthread_mutex_unlock(&to->steer_lock);
+    ev_async_send(to->loop, &to->steer_w);
+}
+
+
+void tx_flush(struct q_engine * const e)
+{
+    // hand the datagrams of all connections that share a socket to warpcore
+    // in one go, so it can send them with as few syscalls as possible
+    struct w_iov_sq q = w_iov_sq_initializer(q);
+    const struct w_sock * ws = 0;
+    while (!sl_empty(&e->tx_pend)) {
+        struct q_conn * const c = sl_first(&e->tx_pend);
+        sl_remove_head(&e->tx_pend, node_tx);
+        c->in_tx_pend = false;
+        if (unlikely(e->relay_ws && c->sock == e->relay_ws)) {
+            relay_dgrams(e, c->sport, &c->txq_pend);
+            continue;
+        }
+        if (ws && ws != c->sock)
+            tx_batch_or_delay(e, ws, &q);
+        ws = c->sock;
+        sq_concat(&q, &c->txq_pend);
+    }
+
+    if (!sq_empty(&q))
+        tx_batch_or_delay(e, ws, &q);
+}
+
+
+void tx_prepare(struct ev_loop * const l __attribute__((unused)),
+                ev_prepare * const w,
+                int e __attribute__((unused)))
+{
+    tx_flush(w->data);
+}
+
+
+static bool __attribute__((nonnull))
+held_by_cork(const struct q_stream * const s)
+{
+    // a corked stream holds back its last buffer until it fills a packet
+    const struct w_iov * const v = s->out_nxt;
+    return unlikely(s->corked) && s->state < strm_hclo && v &&
+           v == sq_last(&s->out, w_iov, next) &&
+           v->len < s->c->pmtu - AEAD_LEN - meta(v).stream_data_start;
+}
+
+
+static uint32_t __attribute__((nonnull))
 tx_stream_data(struct q_stream * const s, const uint32_t limit)
 {
     uint32_t encoded = 0;
-    struct w_iov * v = s->out_una;
+    // resume where the previous scheduling round of this tx() stopped
+    struct w_iov * v = s->tx_pos ? s->tx_pos : s->out_una;
+    s->tx_pos = 0;
     struct q_conn * const c = s->c;
     sq_foreach_from (v, &s->out, next) {
         ensure(has_wnd(c), "in_flight %" PRIu64 " vs. cwnd %" PRIu64,
@@ -301,14 +490,20 @@ tx_stream_data(struct q_stream * const s, const uint32_t limit)
             continue;
         }
 
-        if (unlikely(meta(v).is_lost))
+        if (unlikely(v == s->out_nxt && held_by_cork(s)))
+            break;
+
+        // a lost frame that was carried in another pkt has no TX to keep
+        if (unlikely(meta(v).is_lost) && meta(v).pn)
             rtx_pkt(s, v);
 
         if (likely(c->state == conn_estb)) {
             // add one MTU, so we can still encode this stream frame
             if (s->id >= 0 &&
-                s->out_data + v->len + w_mtu(c->w) > s->out_data_max)
+                s->out_data + v->len + w_mtu(c->w) > s->out_data_max) {
                 s->blocked = true;
+                sched_stream_ctrl(s);
+            }
             if (c->out_data + v->len + w_mtu(c->w) > c->tp_out.max_data)
                 c->blocked = true;
         }
@@ -333,25 +528,24 @@ tx_stream_data(struct q_stream * const s, const uint32_t limit)
             break;
 
         if (unlikely(limit && encoded == limit)) {
-            warn(NTE, "tx limit %u reached", limit);
+            s->tx_pos = sq_next(v, next);
             break;
         }
     }
 
-#ifndef NDEBUG
-    log_sent_pkts(c);
-#endif
+    return encoded;
 }
 
 
-static void __attribute__((nonnull)) tx_stream_ctrl(struct q_stream * const s)
+static void __attribute__((nonnull))
+tx_stream_ctrl(struct q_stream * const s, const bool fin)
 {
-    struct w_iov * const v = alloc_iov(s->c->w, 0, s->tx_fin ? OFFSET_ESTB : 0);
-    if (s->tx_fin) {
+    struct w_iov * const v = alloc_iov(s->c->w, 0, fin ? OFFSET_ESTB : 0);
+    if (fin) {
         v->len = 0;
         sq_insert_tail(&s->out, v, next);
     }
-    enc_pkt(s, false, s->tx_fin, v);
+    enc_pkt(s, false, fin, v);
     do_tx(s->c);
 }
 
@@ -361,13 +555,55 @@ void do_conn_fc(struct q_conn * const c)
     if (c->state == conn_clsg || c->state == conn_drng)
         return;
 
-    const uint64_t inc = INIT_MAX_BIDI_STREAMS * INIT_STRM_DATA_BIDI;
-
-    // check if we need to do connection-level flow control
-    if (c->in_data + 2 * MAX_PKT_LEN + inc > c->tp_in.max_data) {
+    // extend the window once the app read half of it
+    if (c->in_data_read + c->in_data_wnd / 2 >
+        MAX(c->tp_in.max_data, c->tp_in.new_max_data)) {
+        uint64_t wnd = c->in_data_wnd;
+        autotune_fc_wnd(c, &wnd, &c->fc_t, UINT64_MAX);
+        grow_conn_wnd(c, wnd);
         c->tx_max_data = c->needs_tx = true;
-        c->tp_in.new_max_data = c->tp_in.max_data + 2 * inc;
+        c->tp_in.new_max_data = c->in_data_read + c->in_data_wnd;
+    }
+}
+
+
+/// Grow the receive window of connection @p c to @p wnd bytes, as far as the
+/// engine's fc_budget allows. The budget caps the sum of the windows of all
+/// connections, and so the data that the peers may send but the apps haven't
+/// read yet.
+///
+/// @param      c     Connection.
+/// @param      wnd   Desired window size.
+///
+void grow_conn_wnd(struct q_conn * const c, const uint64_t wnd)
+{
+    struct q_engine * const e = ped(c->w);
+    const uint64_t room =
+        e->fc_budget > e->fc_granted ? e->fc_budget - e->fc_granted : 0;
+    const uint64_t new_wnd = MIN(wnd, c->in_data_wnd + room);
+    if (new_wnd <= c->in_data_wnd)
+        return;
+    e->fc_granted += new_wnd - c->in_data_wnd;
+    c->in_data_wnd = new_wnd;
+}
+
+
+void autotune_fc_wnd(const struct q_conn * const c,
+                     uint64_t * const wnd,
+                     ev_tstamp * const t,
+                     const uint64_t max)
+{
+    // if the window was used up within two RTTs of the last update, it and
+    // not cwnd limits throughput, so double it (up to max)
+    const ev_tstamp now = ev_now(ped(c->w)->loop);
+    const ev_tstamp srtt =
+        is_zero(c->rec.srtt) ? kDefaultInitialRtt : c->rec.srtt;
+    if (!is_zero(*t) && now - *t < 2 * srtt && *wnd < max) {
+        *wnd = MIN(2 * *wnd, max);
+        warn(DBG, "%s conn %s fc window now %" PRIu64, conn_type(c),
+             cid2str(c->scid), *wnd);
     }
+    *t = now;
 }
 
 
@@ -391,7 +627,7 @@ static void __attribute__((nonnull)) do_conn_mgmt(struct q_conn * const c)
                 use_next_dcid(c);
                 // don't migrate again for a while
                 c->do_migration = false;
-                ev_timer_again(loop, &c->migration_alarm);
+                tmr_again(&ped(c->w)->whl, &c->migration_alarm);
             }
         } else
             // send new CID if the client doesn't have one remaining
@@ -400,33 +636,162 @@ static void __attribute__((nonnull)) do_conn_mgmt(struct q_conn * const c)
 }
 
 
-static void __attribute__((nonnull))
-tx_stream(struct q_stream * const s, const uint32_t limit)
+static void __attribute__((nonnull)) tx_pmtu_probe(struct q_conn * const c)
+{
+    // DPLPMTUD: binary search between the confirmed datagram size and the
+    // smaller of the interface MTU and the peer's max_packet_size
+    const uint16_t hi = c->tp_out.max_pkt ? MIN(c->pmtu_hi, c->tp_out.max_pkt)
+                                          : c->pmtu_hi;
+    if (likely(c->pmtu_probe || c->state != conn_estb ||
+               hi < c->pmtu + PMTU_MIN_STEP) ||
+        !has_wnd(c))
+        return;
+
+    c->pmtu_probe = (uint16_t)(c->pmtu + (hi - c->pmtu + 1) / 2);
+    warn(INF, "PMTU probe of %u on %s conn %s", c->pmtu_probe, conn_type(c),
+         cid2str(c->scid));
+    c->tx_pmtu_probe = true;
+    struct w_iov * const v = alloc_iov(c->w, 0, 0);
+    enc_pkt(c->cstreams[ep_data], false, false, v);
+    do_tx(c);
+}
+
+
+void on_pmtu_probe_acked(struct q_conn * const c, const uint16_t len)
+{
+    if (len > c->pmtu) {
+        c->pmtu = len;
+        warn(NTE, "PMTU of %s conn %s now %u", conn_type(c), cid2str(c->scid),
+             c->pmtu);
+    }
+    if (len == c->pmtu_probe) {
+        // continue the search with the next larger size
+        c->pmtu_probe = c->pmtu_fails = 0;
+        c->needs_tx = true;
+    }
+}
+
+
+void on_pmtu_probe_lost(struct q_conn * const c, const uint16_t len)
+{
+    if (len != c->pmtu_probe)
+        return;
+
+    // a lost probe is not a congestion signal; give up on the size only after
+    // several were lost, and then search below it
+    if (++c->pmtu_fails >= PMTU_MAX_PROBES) {
+        c->pmtu_hi = (uint16_t)(len - 1);
+        c->pmtu_fails = 0;
+    }
+    c->pmtu_probe = 0;
+    c->needs_tx = true;
+}
+
+
+static bool __attribute__((nonnull))
+stream_can_tx(const struct q_stream * const s)
+{
+    // unless for 0-RTT, regular streams can't TX during conn open
+    return s->c->try_0rtt || s->id < 0 || s->c->state == conn_estb;
+}
+
+
+static bool __attribute__((nonnull))
+stream_can_tx_data(const struct q_stream * const s)
 {
     const bool stream_has_data_to_tx =
         sq_len(&s->out) > 0 && out_fully_acked(s) == false &&
-        ((s->out_una && meta(s->out_una).is_lost) || s->out_nxt);
+        ((s->out_una && meta(s->out_una).is_lost) ||
+         (s->out_nxt && !held_by_cork(s)));
+    return stream_has_data_to_tx && !s->blocked && has_wnd(s->c);
+}
+
+
+uint16_t carry_stream_frames(struct q_stream * const s,
+                             struct w_iov * const v,
+                             const uint16_t pos)
+{
+    // fill the rest of the pkt with the unsent buffers of other streams that
+    // the scheduler would let send, so small writes on many streams share pkts
+    struct q_conn * const c = s->c;
+    uint16_t i = pos;
+    if (meta(v).stream_data_len == 0)
+        // a stream frame w/o data has no length, so it must come last
+        return i;
+
+    struct q_stream * os;
+    sq_foreach (os, &c->strms_tx, next_tx) {
+        if (os == s || os->blocked || stream_can_tx(os) == false ||
+            (c->sched == q_sched_prio && os->urgency > s->urgency))
+            continue;
+
+        while (os->out_nxt && !held_by_cork(os)) {
+            struct w_iov * const ov = os->out_nxt;
+            if (ov->len == 0 || meta(ov).tx_len || meta(ov).is_lost ||
+                i + strm_frame_len(os, ov) > v->len)
+                break;
+
+            // keep the same flow control margin as tx_stream_data()
+            if (os->out_data + ov->len + w_mtu(c->w) > os->out_data_max ||
+                c->out_data + ov->len + w_mtu(c->w) > c->tp_out.max_data)
+                break;
+
+            i = enc_carried_stream_frame(os, v, ov, i);
+            os->out_nxt = sq_next(ov, next);
+        }
+    }
+    return i;
+}
+
+
+static void __attribute__((nonnull))
+tx_stream(struct q_stream * const s, const uint32_t limit)
+{
+    const bool can_tx_data = stream_can_tx_data(s);
 
     // warn(ERR, "%s strm id=" FMT_SID ", cnt=%u, has_data=%u, needs_ctrl=%u",
-    //      conn_type(s->c), s->id, sq_len(&s->out), stream_has_data_to_tx,
+    //      conn_type(s->c), s->id, sq_len(&s->out), can_tx_data,
     //      stream_needs_ctrl(s), out_fully_acked(s));
     // check if we should skip TX on this stream
     if ( // nothing to send and doesn't need control frames?
-        (stream_has_data_to_tx == false && stream_needs_ctrl(s) == false) ||
-        // unless for 0-RTT, is this a regular stream during conn open?
-        (s->c->try_0rtt == false && s->id >= 0 && s->c->state != conn_estb)) {
+        (can_tx_data == false && stream_needs_ctrl(s) == false) ||
+        stream_can_tx(s) == false) {
         // warn(ERR, "skip " FMT_SID, s->id);
         return;
     }
 
     warn(DBG, "%s TX on %s conn %s strm " FMT_SID " w/%u pkt%s in queue",
-         stream_has_data_to_tx ? "data" : "ctrl", conn_type(s->c),
-         cid2str(s->c->scid), s->id, sq_len(&s->out), plural(sq_len(&s->out)));
+         can_tx_data ? "data" : "ctrl", conn_type(s->c), cid2str(s->c->scid),
+         s->id, sq_len(&s->out), plural(sq_len(&s->out)));
 
-    if (stream_has_data_to_tx && !s->blocked && has_wnd(s->c))
+    if (can_tx_data)
         tx_stream_data(s, limit);
-    else if (stream_needs_ctrl(s))
-        tx_stream_ctrl(s);
+    else
+        tx_stream_ctrl(s, s->tx_fin);
+}
+
+
+static uint32_t __attribute__((nonnull))
+sched_quantum(const struct q_stream * const s)
+{
+    // number of packets a stream may send per scheduling round
+    return s->c->sched == q_sched_wfq ? s->weight : 1;
+}
+
+
+static uint8_t __attribute__((nonnull))
+sched_top_urgency(const struct q_conn * const c)
+{
+    // for strict priority, find the most urgent stream that can send; tx()
+    // calls this once, and then tracks the minimum during each round
+    uint8_t top = UINT8_MAX;
+    if (c->sched == q_sched_prio) {
+        const struct q_stream * s;
+        sq_foreach (s, &c->strms_tx, next_tx)
+            if (s->urgency < top && stream_can_tx(s) && stream_can_tx_data(s))
+                top = s->urgency;
+    }
+    return top;
 }
 
 
@@ -443,21 +808,93 @@ void tx(struct q_conn * const c, const uint32_t limit)
 
     do_conn_mgmt(c);
 
+    if (limit == 0)
+        tx_pmtu_probe(c);
+
     if (likely(c->state != conn_clsg))
         for (epoch_t e = ep_init; e <= ep_data; e++) {
             tx_stream(c->cstreams[e], limit);
+            c->cstreams[e]->tx_pos = 0;
             if (unlikely(!has_wnd(c)))
                 goto out_of_wnd;
         }
 
-    struct q_stream * s;
-    kh_foreach (s, c->streams_by_id) {
-        tx_stream(s, limit);
+    // streams that can't send data right now only need control frames; the
+    // others get theirs sent along with their data below, or on their own if
+    // the scheduler passes them over
+    for (uint64_t n = sq_len(&c->strms_ctrl); n; n--) {
+        struct q_stream * const s = sq_first(&c->strms_ctrl);
+        sq_remove_head(&c->strms_ctrl, next_ctrl);
+        s->in_ctrlq = false;
+        if (stream_needs_ctrl(s) == false)
+            continue;
+        if (stream_can_tx(s) && stream_can_tx_data(s) == false)
+            tx_stream_ctrl(s, s->tx_fin);
+        sched_stream_ctrl(s);
         if (unlikely(!has_wnd(c)))
             goto out_of_wnd;
     }
 
-out_of_wnd:
+    // interleave the streams with data in flight or waiting for TX, in rounds
+    // in which each stream picked by the scheduler sends up to its quantum
+    uint32_t sent = 0;
+    uint8_t top = sched_top_urgency(c);
+    for (bool first_round = true;; first_round = false) {
+        const uint32_t sent_before_round = sent;
+        uint8_t next_top = UINT8_MAX;
+        for (uint64_t n = sq_len(&c->strms_tx); n; n--) {
+            struct q_stream * const s = sq_first(&c->strms_tx);
+            sq_remove_head(&c->strms_tx, next_tx);
+            s->in_txq = false;
+
+            bool paced = false;
+            const bool can_tx = stream_can_tx(s) && stream_can_tx_data(s);
+            if ((c->sched != q_sched_prio || s->urgency <= top) && can_tx) {
+                // probes (with a limit) are not paced
+                const uint32_t q = MIN(sched_quantum(s),
+                                       limit ? limit - sent : pace_pkts(c));
+                if (q)
+                    sent += tx_stream_data(s, q);
+                else
+                    paced = true;
+            } else if (can_tx && first_round && s->tx_max_stream_data)
+                // strict priority passed this stream over, but its window
+                // update must not wait until its data gets a turn
+                tx_stream_ctrl(s, false);
+
+            if (out_fully_acked(s) == false) {
+                sched_stream_tx(s);
+                if (s->urgency < next_top && stream_can_tx(s) &&
+                    stream_can_tx_data(s))
+                    // the most urgent stream that can still send
+                    next_top = s->urgency;
+            }
+            if (unlikely(!has_wnd(c) || c->blocked || paced))
+                goto out_of_wnd;
+            if (unlikely(limit && sent == limit)) {
+                warn(NTE, "tx limit %u reached", limit);
+                goto out_of_wnd;
+            }
+        }
+        if (sent == sent_before_round)
+            break;
+        top = next_top;
+    }
+
+    if (limit == 0)
+        // there is window left, but nothing to fill it with
+        on_app_limited(c);
+
+out_of_wnd:;
+    // tx_pos is only meaningful during a single tx()
+    struct q_stream * s;
+    sq_foreach (s, &c->strms_tx, next_tx)
+        s->tx_pos = 0;
+
+#ifndef NDEBUG
+    log_sent_pkts(c);
+#endif
+
     if (sq_empty(&c->txq) || conn_needs_ctrl(c)) {
         // need to send other frame, do it in an ACK
         tx_ack(c, epoch_in(c));
@@ -480,8 +917,9 @@ void tx_tlp(struct q_conn * const c)
     struct pn_space * const pn = pn_for_epoch(c, ep_data);
     struct pkt_meta * p;
     struct w_iov * v = 0;
-    splay_foreach_rev (p, pm_by_nr, &pn->sent_pkts) {
-        v = w_iov(c->w, p->is_rtx ? pm_idx(sl_first(&p->rtx)) : pm_idx(p));
+    pmr_foreach_rev (p, &pn->sent_pkts) {
+        v = w_iov(c->w, p->is_rtx ? pm_idx(c->w, sl_first(&p->rtx))
+                                   : pm_idx(c->w, p));
         if (has_frame(v, FRAM_TYPE_CRPT) || has_frame(v, FRAM_TYPE_STRM))
             break;
     }
@@ -496,11 +934,20 @@ void tx_tlp(struct q_conn * const c)
 }
 
 
+static bool __attribute__((nonnull))
+ack_due(const struct q_conn * const c, struct pn_space * const pn)
+{
+    // an ACK-only pkt waits for enough ACK-eliciting pkts or the ACK timer
+    return needs_ack(pn) &&
+           (pn->ack_elicit_cnt >= c->ack_thresh || pn->imm_ack);
+}
+
+
 void tx_ack(struct q_conn * const c, const epoch_t e)
 {
     struct pn_space * const pn = pn_for_epoch(c, e);
 
-    if (!needs_ack(pn) && !c->tx_rtry && c->state != conn_clsg &&
+    if (!ack_due(c, pn) && !c->tx_rtry && c->state != conn_clsg &&
         !conn_needs_ctrl(c))
         return;
 
@@ -521,19 +968,21 @@ void tx_w(struct ev_loop * const l __attribute__((unused)),
 static inline void __attribute__((nonnull))
 conns_by_id_ins(struct q_conn * const c, struct cid * const id)
 {
+    struct q_engine * const e = ped(c->w);
     int ret;
-    const khiter_t k = kh_put(conns_by_id, conns_by_id, id, &ret);
+    const khiter_t k = kh_put(conns_by_id, e->conns_by_id, id, &ret);
     ensure(ret >= 0, "inserted");
-    kh_val(conns_by_id, k) = c;
+    kh_val(e->conns_by_id, k) = c;
 }
 
 
 static inline void __attribute__((nonnull))
-conns_by_id_del(struct cid * const id)
+conns_by_id_del(struct q_conn * const c, struct cid * const id)
 {
-    const khiter_t k = kh_get(conns_by_id, conns_by_id, id);
-    ensure(k != kh_end(conns_by_id), "found");
-    kh_del(conns_by_id, conns_by_id, k);
+    struct q_engine * const e = ped(c->w);
+    const khiter_t k = kh_get(conns_by_id, e->conns_by_id, id);
+    ensure(k != kh_end(e->conns_by_id), "found");
+    kh_del(conns_by_id, e->conns_by_id, k);
 }
 
 
@@ -541,7 +990,7 @@ void update_act_scid(struct q_conn * const c, struct cid * const id)
 {
     warn(NTE, "hshk switch to scid %s for %s conn (was %s)", cid2str(id),
          conn_type(c), cid2str(c->scid));
-    conns_by_id_del(c->scid);
+    conns_by_id_del(c, c->scid);
     cid_cpy(c->scid, id);
     conns_by_id_ins(c, c->scid);
 }
@@ -591,26 +1040,28 @@ void add_dcid(struct q_conn * const c, const struct cid * const id)
 static inline void __attribute__((nonnull))
 conns_by_ipnp_ins(struct q_conn * const c)
 {
+    struct q_engine * const e = ped(c->w);
     int ret;
     const khiter_t k =
-        kh_put(conns_by_ipnp, conns_by_ipnp,
+        kh_put(conns_by_ipnp, e->conns_by_ipnp,
                (khint64_t)conns_by_ipnp_key(c->sport, c->peer.sin_port,
                                             c->peer.sin_addr.s_addr),
                &ret);
     ensure(ret >= 0, "inserted");
-    kh_val(conns_by_ipnp, k) = c;
+    kh_val(e->conns_by_ipnp, k) = c;
 }
 
 
 static inline void __attribute__((nonnull))
 conns_by_ipnp_del(struct q_conn * const c)
 {
+    struct q_engine * const e = ped(c->w);
     const khiter_t k =
-        kh_get(conns_by_ipnp, conns_by_ipnp,
+        kh_get(conns_by_ipnp, e->conns_by_ipnp,
                (khint64_t)conns_by_ipnp_key(c->sport, c->peer.sin_port,
                                             c->peer.sin_addr.s_addr));
-    ensure(k != kh_end(conns_by_ipnp), "found");
-    kh_del(conns_by_ipnp, conns_by_ipnp, k);
+    ensure(k != kh_end(e->conns_by_ipnp), "found");
+    kh_del(conns_by_ipnp, e->conns_by_ipnp, k);
 }
 
 
@@ -637,14 +1088,22 @@ static void __attribute__((nonnull)) rx_crypto(struct q_conn * const c)
             continue;
 
         if (c->state == conn_idle || c->state == conn_opng) {
+            struct q_engine * const e = ped(c->w);
             conn_to_state(c, conn_estb);
-            if (c->is_clnt)
-                maybe_api_return(q_connect, c, 0);
-            else {
+            if (c->is_clnt) {
+                maybe_api_return(e, q_connect, c, 0);
+                do_cb(e, on_conn_ready, c);
+            } else {
                 // TODO: find a better way to send NEW_TOKEN
                 make_rtry_tok(c);
-                sl_insert_head(&accept_queue, c, node_aq);
-                maybe_api_return(q_accept, 0, 0);
+                if (e->cb.on_conn_ready) {
+                    // hand the conn to the app instead of queuing it
+                    touch_idle(c);
+                    do_cb(e, on_conn_ready, c);
+                } else {
+                    sl_insert_head(&e->accept_queue, c, node_aq);
+                    maybe_api_return(e, q_accept, 0, 0);
+                }
             }
         }
     }
@@ -658,7 +1117,7 @@ vneg_or_rtry_resp(struct q_conn * const c, const bool is_vneg)
     init_rec(c);
 
     // reset FC state
-    c->in_data = c->out_data = 0;
+    c->in_data = c->in_data_read = c->out_data = 0;
 
     for (epoch_t e = ep_init; e <= ep_data; e++)
         reset_stream(c->cstreams[e],
@@ -750,13 +1209,14 @@ static bool __attribute__((nonnull)) rx_pkt(struct q_conn * const c,
         init_tp(c);
 
         // check if any reordered 0-RTT packets are cached for this CID
+        struct q_engine * const e = ped(c->w);
         const struct ooo_0rtt which = {.cid = meta(v).hdr.dcid};
         struct ooo_0rtt * const zo =
-            splay_find(ooo_0rtt_by_cid, &ooo_0rtt_by_cid, &which);
+            splay_find(ooo_0rtt_by_cid, &e->ooo_0rtt_by_cid, &which);
         if (zo) {
             warn(INF, "have reordered 0-RTT pkt (t=%f sec) for %s conn %s",
-                 ev_now(loop) - zo->t, conn_type(c), cid2str(c->scid));
-            ensure(splay_remove(ooo_0rtt_by_cid, &ooo_0rtt_by_cid, zo),
+                 ev_now(e->loop) - zo->t, conn_type(c), cid2str(c->scid));
+            ensure(splay_remove(ooo_0rtt_by_cid, &e->ooo_0rtt_by_cid, zo),
                    "removed");
             sq_insert_head(x, zo->v, next);
             free(zo);
@@ -767,6 +1227,7 @@ static bool __attribute__((nonnull)) rx_pkt(struct q_conn * const c,
         struct cid nscid = {.len = SERV_SCID_LEN};
         ptls_openssl_random_bytes(nscid.id,
                                   sizeof(nscid.id) + sizeof(nscid.srt));
+        set_cid_widx(c, &nscid);
         update_act_scid(c, &nscid);
 
         ok = true;
@@ -854,12 +1315,16 @@ static bool __attribute__((nonnull)) rx_pkt(struct q_conn * const c,
         break;
     }
 
-    // if packet has anything other than ACK frames, maybe arm the ACK timer
+    // if packet has anything other than ACK frames, maybe arm the ACK timer,
+    // or ACK right away if enough such pkts arrived since the last ACK
     if (c->state != conn_drng && c->state != conn_clsd && !c->tx_rtry &&
-        !is_ack_only(&meta(v).frames) && !ev_is_active(&pn->ack_alarm)) {
-        // warn(DBG, "non-ACK frame received, starting epoch %u ACK timer",
-        //      epoch_for_pkt_type(meta(v).hdr.type));
-        ev_timer_again(loop, &pn->ack_alarm);
+        !is_ack_only(&meta(v).frames)) {
+        if (!tmr_active(&pn->ack_alarm))
+            // warn(DBG, "non-ACK frame received, starting epoch %u ACK timer",
+            //      epoch_for_pkt_type(meta(v).hdr.type));
+            tmr_again(&ped(c->w)->whl, &pn->ack_alarm);
+        if (++pn->ack_elicit_cnt >= c->ack_thresh || pn->imm_ack)
+            c->needs_tx = true;
     }
 
 done:
@@ -887,7 +1352,8 @@ static void __attribute__((nonnull))
 #endif
 rx_pkts(struct w_iov_sq * const x,
         struct q_conn_sl * const crx,
-        const struct w_sock * const ws)
+        const struct w_sock * const ws,
+        const uint16_t sport)
 {
     while (!sq_empty(x)) {
         struct w_iov * const xv = sq_first(x);
@@ -900,7 +1366,7 @@ rx_pkts(struct w_iov_sq * const x,
     !defined(NO_FUZZER_CORPUS_COLLECTION)
         // when called from the fuzzer, v->ip is zero
         if (xv->ip)
-            write_to_corpus(corpus_pkt_dir, xv->buf, xv->len);
+            write_to_corpus(ped(xv->w)->corpus_pkt_dir, xv->buf, xv->len);
 #endif
 
         // allocate new w_iov for the (eventual) unencrypted data and meta-data
@@ -916,8 +1382,9 @@ rx_pkts(struct w_iov_sq * const x,
         uint16_t tok_len = 0;
         if (unlikely(!dec_pkt_hdr_beginning(xv, v, is_clnt, &odcid, tok,
                                             &tok_len))) {
-            // we might still need to send a vneg packet
-            if (w_connected(ws) == false) {
+            // we might still need to send a vneg packet (but not from a
+            // stand-in socket, whose port is not the server port)
+            if (w_connected(ws) == false && ws != ped(ws->w)->relay_ws) {
                 warn(ERR,
                      "received invalid %u-byte pkt (type 0x%02x), sending vneg",
                      v->len, v->buf[0]);
@@ -934,9 +1401,9 @@ rx_pkts(struct w_iov_sq * const x,
                                          .sin_port = v->port,
                                          .sin_addr = {.s_addr = v->ip}};
 
-        c = get_conn_by_cid(&meta(v).hdr.dcid);
+        c = get_conn_by_cid(ped(ws->w), &meta(v).hdr.dcid);
         if (c == 0) {
-            c = get_conn_by_ipnp(w_get_sport(ws), &peer);
+            c = get_conn_by_ipnp(ped(ws->w), sport, &peer);
             if (is_set(F_LONG_HDR, meta(v).hdr.flags)) {
                 if (!is_clnt) {
                     if (c && meta(v).hdr.type == F_LH_0RTT) {
@@ -972,11 +1439,11 @@ rx_pkts(struct w_iov_sq * const x,
 
                         warn(NTE,
                              "new serv conn on port %u from %s:%u w/cid=%s",
-                             ntohs(w_get_sport(ws)), inet_ntoa(peer.sin_addr),
+                             ntohs(sport), inet_ntoa(peer.sin_addr),
                              ntohs(peer.sin_port), cid2str(&meta(v).hdr.dcid));
                         c = new_conn(w_engine(ws), meta(v).hdr.vers,
                                      &meta(v).hdr.scid, &meta(v).hdr.dcid,
-                                     &peer, 0, ntohs(w_get_sport(ws)), 0);
+                                     &peer, 0, ntohs(sport), 0);
                         init_tls(c);
                     }
                 }
@@ -1026,8 +1493,9 @@ rx_pkts(struct w_iov_sq * const x,
                 ensure(zo, "could not calloc");
                 cid_cpy(&zo->cid, &meta(v).hdr.dcid);
                 zo->v = v;
-                zo->t = ev_now(loop);
-                ensure(splay_insert(ooo_0rtt_by_cid, &ooo_0rtt_by_cid, zo) == 0,
+                zo->t = ev_now(ped(ws->w)->loop);
+                ensure(splay_insert(ooo_0rtt_by_cid,
+                                    &ped(ws->w)->ooo_0rtt_by_cid, zo) == 0,
                        "inserted");
                 log_pkt("RX", v, v->ip, v->port, &odcid, tok, tok_len);
                 warn(INF, "caching 0-RTT pkt for unknown conn %s",
@@ -1085,26 +1553,17 @@ rx_pkts(struct w_iov_sq * const x,
 }
 
 
-void rx(struct ev_loop * const l,
-        ev_io * const rx_w,
-        int e __attribute__((unused)))
+static void __attribute__((nonnull))
+rx_done(struct ev_loop * const l, struct q_conn_sl * const crx)
 {
-    // read from NIC
-    struct w_sock * const ws = rx_w->data;
-    w_nic_rx(w_engine(ws), -1);
-    struct w_iov_sq x = w_iov_sq_initializer(x);
-    struct q_conn_sl crx = sl_head_initializer(crx);
-    w_rx(ws, &x);
-    rx_pkts(&x, &crx, ws);
-
     // for all connections that had RX events
-    while (!sl_empty(&crx)) {
-        struct q_conn * const c = sl_first(&crx);
-        sl_remove_head(&crx, node_rx_int);
+    while (!sl_empty(crx)) {
+        struct q_conn * const c = sl_first(crx);
+        sl_remove_head(crx, node_rx_int);
 
         if (unlikely(c->state != conn_drng))
             // reset idle timeout
-            ev_timer_again(l, &c->idle_alarm);
+            touch_idle(c);
 
         // is a TX needed for this connection?
         if (c->needs_tx && likely(c->state != conn_drng))
@@ -1118,15 +1577,218 @@ void rx(struct ev_loop * const l,
             free_conn(c);
         else if (c->have_new_data) {
             if (!c->in_c_ready) {
-                sl_insert_head(&c_ready, c, node_rx_ext);
+                sl_insert_head(&ped(c->w)->c_ready, c, node_rx_ext);
                 c->in_c_ready = true;
-                maybe_api_return(q_rx_ready, 0, 0);
+                maybe_api_return(ped(c->w), q_rx_ready, 0, 0);
             }
         }
     }
 }
 
 
+/// Return the index of the worker owning the connection a received packet is
+/// for. Server CIDs carry the worker index in their first byte. Initial and
+/// 0-RTT packets carry a client-chosen CID, and are handled by the worker the
+/// kernel delivered them to, which thereby becomes the owner of the new
+/// connection. When the workers share one server socket, they are instead
+/// spread by that CID, whose first byte the server CID of the new connection
+/// then agrees with. Packets of unsupported versions stay with worker 0, which
+/// answers them with a version negotiation from the server socket.
+///
+/// @param      e     The engine that received the packet.
+/// @param      xv    The received (encrypted) packet.
+///
+/// @return     Index of the owning worker.
+///
+static uint8_t __attribute__((nonnull))
+pkt_widx(const struct q_engine * const e, const struct w_iov * const xv)
+{
+    uint16_t pos = 1;
+    if (is_set(F_LONG_HDR, xv->buf[0])) {
+        // flags, version, DCIL/SCIL, DCID
+        if (xv->len < 7 || (xv->buf[5] >> 4) == 0)
+            return e->widx;
+        if (pkt_type(xv->buf[0]) != F_LH_HSHK) {
+            const uint32_t vers = (uint32_t)xv->buf[1] << 24 |
+                                  (uint32_t)xv->buf[2] << 16 |
+                                  (uint32_t)xv->buf[3] << 8 | xv->buf[4];
+            if (one_serv_sock(e) == false || vers_supported(vers) == false)
+                return e->widx;
+            return xv->buf[6] % e->wrk->n;
+        }
+        pos = 6;
+    }
+    return xv->len > pos && xv->buf[pos] < e->wrk->n ? xv->buf[pos] : e->widx;
+}
+
+
+static void __attribute__((nonnull))
+steer_pkt(struct q_engine * const to,
+          const struct w_sock * const ws,
+          const struct w_iov * const xv)
+{
+    struct q_steered * const p = new_steered(xv, w_get_sport(ws));
+    pthread_mutex_lock(&to->steer_lock);
+    sq_insert_tail(&to->steer_q, p, next);
+    pthread_mutex_unlock(&to->steer_lock);
+    ev_async_send(to->loop, &to->steer_w);
+}
+
+
+/// Hand any packets in @p x that belong to connections of other workers over
+/// to those workers.
+///
+/// @param      e     The engine that received the packets.
+/// @param      ws    The socket the packets were received on.
+/// @param      x     The received packets.
+///
+static void __attribute__((nonnull))
+steer_pkts(struct q_engine * const e,
+           const struct w_sock * const ws,
+           struct w_iov_sq * const x)
+{
+    struct w_iov_sq own = w_iov_sq_initializer(own);
+    while (!sq_empty(x)) {
+        struct w_iov * const xv = sq_first(x);
+        sq_remove_head(x, next);
+        const uint8_t widx = pkt_widx(e, xv);
+        if (likely(widx == e->widx)) {
+            sq_insert_tail(&own, xv, next);
+            continue;
+        }
+        warn(DBG, "steering %u-byte pkt from worker %u to %u", xv->len,
+             e->widx, widx);
+        steer_pkt(e->wrk->e[widx], ws, xv);
+        w_free_iov(xv);
+    }
+    sq_concat(x, &own);
+}
+
+
+void rx(struct ev_loop * const l,
+        ev_io * const rx_w,
+        int e __attribute__((unused)))
+{
+    struct w_sock * const ws = rx_w->data;
+    struct q_engine * const qe = ped(w_engine(ws));
+    struct q_conn_sl crx = sl_head_initializer(crx);
+    uint32_t n = 0;
+
+    // read batches from the NIC until the socket is drained or the RX budget
+    // is used up; a level-triggered rx_w brings us back for the rest after
+    // timers and TX had a chance to run
+    w_nic_rx(w_engine(ws), -1);
+    do {
+        struct w_iov_sq x = w_iov_sq_initializer(x);
+        w_rx(ws, &x);
+        if (sq_empty(&x))
+            break;
+        n += (uint32_t)sq_len(&x);
+        qe->rx_dgrams += sq_len(&x);
+        qe->rx_w_calls++;
+
+        if (qe->wrk && qe->wrk->n > 1)
+            steer_pkts(qe, ws, &x);
+
+        rx_pkts(&x, &crx, ws, w_get_sport(ws));
+    } while ((qe->rx_budget == 0 || n < qe->rx_budget) &&
+             w_nic_rx(w_engine(ws), 0));
+
+    // process all batches together, e.g., to send fewer ACKs
+    rx_done(l, &crx);
+}
+
+
+/// Send the datagrams other workers relayed to us from our server socket(s).
+///
+/// @param      e     Engine (of worker 0).
+/// @param      r     Relayed datagrams; freed.
+///
+static void __attribute__((nonnull))
+tx_relayed(struct q_engine * const e, struct q_steered_sq * const r)
+{
+    struct w_iov_sq q = w_iov_sq_initializer(q);
+    const struct w_sock * ws = 0;
+    while (!sq_empty(r)) {
+        struct q_steered * const p = sq_first(r);
+        sq_remove_head(r, next);
+
+        const struct w_sock * const pws = w_get_sock(e->w, p->sport, 0);
+        struct w_iov * const v = pws ? w_alloc_iov(e->w, p->len, 0) : 0;
+        if (unlikely(v == 0)) {
+            warn(ERR, "dropping %u-byte pkt relayed from port %u", p->len,
+                 ntohs(p->sport));
+            free(p);
+            continue;
+        }
+
+        memcpy(v->buf, p->buf, p->len);
+        v->len = p->len;
+        v->ip = p->ip;
+        v->port = p->port;
+        v->flags = p->flags;
+        free(p);
+
+        if (ws && ws != pws)
+            tx_batch_or_delay(e, ws, &q);
+        ws = pws;
+        sq_insert_tail(&q, v, next);
+    }
+
+    if (!sq_empty(&q))
+        tx_batch_or_delay(e, ws, &q);
+}
+
+
+void rx_steered(struct ev_loop * const l,
+                ev_async * const w,
+                int e __attribute__((unused)))
+{
+    struct q_engine * const qe = w->data;
+    struct q_steered_sq q;
+    sq_init(&q);
+    struct q_steered_sq r;
+    sq_init(&r);
+    pthread_mutex_lock(&qe->steer_lock);
+    sq_concat(&q, &qe->steer_q);
+    sq_concat(&r, &qe->relay_q);
+    pthread_mutex_unlock(&qe->steer_lock);
+
+    tx_relayed(qe, &r);
+
+    struct q_conn_sl crx = sl_head_initializer(crx);
+    while (!sq_empty(&q)) {
+        struct q_steered * const p = sq_first(&q);
+        sq_remove_head(&q, next);
+
+        // workers sharing worker 0's server socket receive on a stand-in
+        const uint16_t sport = p->sport;
+        struct w_sock * const ws =
+            qe->relay_ws ? qe->relay_ws : w_get_sock(qe->w, sport, 0);
+        struct w_iov * const xv = ws ? w_alloc_iov(qe->w, p->len, 0) : 0;
+        if (unlikely(xv == 0)) {
+            warn(ERR, "dropping %u-byte pkt steered to port %u", p->len,
+                 ntohs(p->sport));
+            free(p);
+            continue;
+        }
+
+        memcpy(xv->buf, p->buf, p->len);
+        xv->len = p->len;
+        xv->ip = p->ip;
+        xv->port = p->port;
+        xv->flags = p->flags;
+        xv->user_data = 0;
+        free(p);
+
+        struct w_iov_sq x = w_iov_sq_initializer(x);
+        sq_insert_tail(&x, xv, next);
+        rx_pkts(&x, &crx, ws, sport);
+    }
+    rx_done(l, &crx);
+}
+
+
 void err_close(struct q_conn * const c,
                const uint16_t code,
                const uint8_t frm,
@@ -1159,30 +1821,25 @@ void err_close(struct q_conn * const c,
 }
 
 
-static void __attribute__((nonnull))
-enable_migration(struct ev_loop * const l __attribute__((unused)),
-                 ev_timer * const w,
-                 int e __attribute__((unused)))
+static void __attribute__((nonnull)) enable_migration(struct tmr * const t)
 {
-    struct q_conn * const c = w->data;
+    struct q_conn * const c = t->data;
     c->do_migration = true;
     c->do_key_flip = true; // XXX we borrow the migration timer for this
-    ev_timer_stop(loop, &c->migration_alarm);
 }
 
 
-static void __attribute__((nonnull))
-enter_closed(struct ev_loop * const l __attribute__((unused)),
-             ev_timer * const w,
-             int e __attribute__((unused)))
+static void __attribute__((nonnull)) enter_closed(struct tmr * const t)
 {
-    struct q_conn * const c = w->data;
+    struct q_conn * const c = t->data;
     conn_to_state(c, conn_clsd);
 
     // terminate whatever API call is currently active
-    maybe_api_return(c, 0);
-    maybe_api_return(q_accept, 0, 0);
-    maybe_api_return(q_rx_ready, 0, 0);
+    struct q_engine * const qe = ped(c->w);
+    maybe_api_return_any(qe, c, 0);
+    maybe_api_return(qe, q_accept, 0, 0);
+    maybe_api_return(qe, q_rx_ready, 0, 0);
+    do_cb(qe, on_conn_closed, c);
 }
 
 
@@ -1191,9 +1848,12 @@ void enter_closing(struct q_conn * const c)
     if (c->state == conn_clsg)
         return;
 
-    // stop LD and ACK alarms
-    ev_timer_stop(loop, &c->rec.ld_alarm);
-    ev_timer_stop(loop, &c->idle_alarm);
+    struct q_engine * const qe = ped(c->w);
+
+    // stop LD, pacing and ACK alarms
+    tmr_stop(&qe->whl, &c->rec.ld_alarm);
+    ev_timer_stop(qe->loop, &c->rec.pace_alarm);
+    tmr_stop(&qe->whl, &c->idle_alarm);
 
     // stop ACK alarm and (maybe) send any ACKs we still owe the peer
     for (epoch_t e = ep_init; e <= ep_data; e++) {
@@ -1205,30 +1865,29 @@ void enter_closing(struct q_conn * const c)
             // don't ACK here, because there will be in ACK in the CLOSE pkt
             e != c->tls.epoch_out &&
             // don't ACK if the timer is not running
-            ev_is_active(&pn->ack_alarm))
-            ev_invoke(loop, &pn->ack_alarm, 0);
-        ev_timer_stop(loop, &pn->ack_alarm);
+            tmr_active(&pn->ack_alarm))
+            ack_alarm(&pn->ack_alarm);
+        tmr_stop(&qe->whl, &pn->ack_alarm);
     }
 
 #ifndef FUZZING
     if ((c->state == conn_idle || c->state == conn_opng) && c->err_code == 0) {
 #endif
         // no need to go closing->draining in these cases
-        ev_invoke(loop, &c->closing_alarm, 0);
+        enter_closed(&c->closing_alarm);
         return;
 #ifndef FUZZING
     }
 #endif
 
     // if we're going closing->draining, don't start the timer again
-    if (!ev_is_active(&c->closing_alarm)) {
+    if (!tmr_active(&c->closing_alarm)) {
         // start closing/draining alarm (3 * RTO)
         const ev_tstamp dur =
             (3 * (is_zero(c->rec.srtt) ? kDefaultInitialRtt : c->rec.srtt) +
              4 * c->rec.rttvar);
-        ev_timer_init(&c->closing_alarm, enter_closed, dur, 0);
 #ifndef FUZZING
-        ev_timer_start(loop, &c->closing_alarm);
+        tmr_start(&qe->whl, &c->closing_alarm, dur);
         warn(DBG, "closing/draining alarm in %f sec on %s conn %s", dur,
              conn_type(c), cid2str(c->scid));
 #endif
@@ -1241,12 +1900,27 @@ void enter_closing(struct q_conn * const c)
 }
 
 
-static void __attribute__((nonnull))
-idle_alarm(struct ev_loop * const l __attribute__((unused)),
-           ev_timer * const w,
-           int e __attribute__((unused)))
+void touch_idle(struct q_conn * const c)
+{
+    // idle_alarm() checks this when it fires, so we only need to arm it once
+    c->idle_t = ev_now(ped(c->w)->loop);
+    if (tmr_active(&c->idle_alarm) == false)
+        tmr_again(&ped(c->w)->whl, &c->idle_alarm);
+}
+
+
+static void __attribute__((nonnull)) idle_alarm(struct tmr * const t)
 {
-    struct q_conn * const c = w->data;
+    struct q_conn * const c = t->data;
+
+    // RX doesn't restart the alarm, so check if there was activity since
+    const ev_tstamp left =
+        c->idle_t + c->idle_alarm.repeat - ev_now(ped(c->w)->loop);
+    if (left > 0) {
+        tmr_start(&ped(c->w)->whl, &c->idle_alarm, left);
+        return;
+    }
+
     warn(DBG, "idle timeout on %s conn %s", conn_type(c), cid2str(c->scid));
 
     conn_to_state(c, conn_drng);
@@ -1254,6 +1928,29 @@ idle_alarm(struct ev_loop * const l __attribute__((unused)),
 }
 
 
+/// Set the DF bit on the datagrams sent from socket @p ws, so that PMTU probes
+/// too large for the path are dropped instead of fragmented, and hence don't
+/// raise the PMTU above what the path can carry unfragmented.
+///
+/// @param      ws    Socket.
+///
+static void __attribute__((nonnull)) set_df(const struct w_sock * const ws)
+{
+#if defined(IP_MTU_DISCOVER)
+    const int name = IP_MTU_DISCOVER;
+    const int opt = IP_PMTUDISC_DO;
+#elif defined(IP_DONTFRAG)
+    const int name = IP_DONTFRAG;
+    const int opt = 1;
+#endif
+#if defined(IP_MTU_DISCOVER) || defined(IP_DONTFRAG)
+    if (setsockopt(w_fd(ws), IPPROTO_IP, name, &opt, sizeof(opt)) == 0)
+        return;
+#endif
+    warn(WRN, "cannot set DF on socket, PMTU probes may get fragmented");
+}
+
+
 struct q_conn * new_conn(struct w_engine * const w,
                          const uint32_t vers,
                          const struct cid * const dcid,
@@ -1265,6 +1962,7 @@ struct q_conn * new_conn(struct w_engine * const w,
 {
     struct q_conn * const c = calloc(1, sizeof(*c));
     ensure(c, "could not calloc");
+    c->w = w;
 
     if (peer)
         c->peer = *peer;
@@ -1295,6 +1993,10 @@ struct q_conn * new_conn(struct w_engine * const w,
 
     diet_init(&c->closed_streams);
     sq_init(&c->txq);
+    sq_init(&c->txq_pend);
+    sq_init(&c->strms_tx);
+    sq_init(&c->strms_ctrl);
+    sq_init(&c->strms_rx);
 
     // initialize packet number spaces
     init_pn(&c->pn_init.pn, c);
@@ -1302,31 +2004,39 @@ struct q_conn * new_conn(struct w_engine * const w,
     init_pn(&c->pn_data.pn, c);
 
     // initialize idle timeout
-    c->idle_alarm.data = c;
+    tmr_init(&c->idle_alarm, idle_alarm, c);
     c->idle_alarm.repeat = idle_to ? idle_to : kIdleTimeout;
-    ev_init(&c->idle_alarm, idle_alarm);
 
     // initialize closing alarm
-    c->closing_alarm.data = c;
-    ev_init(&c->closing_alarm, enter_closed);
+    tmr_init(&c->closing_alarm, enter_closed, c);
 
     // initialize migration alarm
-    c->migration_alarm.data = c;
+    tmr_init(&c->migration_alarm, enable_migration, c);
     c->migration_alarm.repeat = 3; // seconds (after initial migration)
-    ev_init(&c->migration_alarm, enable_migration);
     c->do_migration = true;
     c->do_key_flip = true;
 
     c->tp_in.ack_del_exp = c->tp_out.ack_del_exp = DEF_ACK_DEL_EXP;
-    c->tp_in.max_ack_del = c->tp_out.max_ack_del =
-        (uint8_t)(1000 * kDelayedAckTimeout);
+    c->ack_thresh = ped(w)->ack_thresh;
+    c->pmtu = MAX_PKT_LEN;
+    c->pmtu_hi = w_mtu(w);
+    c->pn_data.pn.ack_alarm.repeat = ped(w)->ack_del;
+    c->tp_in.max_ack_del = (uint8_t)(1000 * ped(w)->ack_del);
+    c->tp_out.max_ack_del = (uint8_t)(1000 * kDelayedAckTimeout);
+    c->tp_in.min_ack_del = (uint32_t)(kMinAckDelay * 1000000);
     c->tp_in.idle_to = kIdleTimeout;
     c->tp_in.max_data = INIT_MAX_BIDI_STREAMS * INIT_STRM_DATA_BIDI;
+    c->in_data_wnd = c->tp_in.max_data;
+    ped(w)->fc_granted += c->in_data_wnd;
     c->tp_in.max_strm_data_uni = INIT_STRM_DATA_UNI;
     c->tp_in.max_strm_data_bidi_local = c->tp_in.max_strm_data_bidi_remote =
         INIT_STRM_DATA_BIDI;
-    c->tp_in.max_bidi_streams = INIT_MAX_BIDI_STREAMS;
-    c->tp_in.max_uni_streams = INIT_MAX_UNI_STREAMS;
+    c->tp_in.max_bidi_streams = c->tp_in.new_max_bidi_streams =
+        ped(w)->max_bidi_streams;
+    c->tp_in.max_uni_streams = c->tp_in.new_max_uni_streams =
+        ped(w)->max_uni_streams;
+    c->sid_wnd_bidi = MAX(ped(w)->max_bidi_streams, 1);
+    c->sid_wnd_uni = MAX(ped(w)->max_uni_streams, 1);
 
     // initialize recovery state
     init_rec(c);
@@ -1335,18 +2045,30 @@ struct q_conn * new_conn(struct w_engine * const w,
     ev_async_init(&c->tx_w, tx_w);
     c->tx_w.data = c;
     ev_set_priority(&c->tx_w, EV_MAXPRI - 1);
-    ev_async_start(loop, &c->tx_w);
+    ev_async_start(ped(w)->loop, &c->tx_w);
 
-    c->w = w;
-    c->sock = w_get_sock(w, htons(port), 0);
+    // when the workers share one server socket, only worker 0 binds it; the
+    // others bind a stand-in on an ephemeral port, and relay through worker 0
+    struct q_engine * const qe = ped(w);
+    const bool relay = !c->is_clnt && qe->widx && one_serv_sock(qe);
+    c->sock = relay ? qe->relay_ws : w_get_sock(w, htons(port), 0);
     if (c->sock == 0) {
-        c->rx_w.data = c->sock = w_bind(w, htons(port), 0);
+        uint8_t flags = 0;
+#ifdef W_REUSEPORT
+        // all workers of a group bind the same server port
+        if (qe->wrk)
+            flags |= W_REUSEPORT;
+#endif
+        c->rx_w.data = c->sock = w_bind(w, htons(relay ? 0 : port), flags);
+        set_df(c->sock);
         ev_io_init(&c->rx_w, rx, w_fd(c->sock), EV_READ);
         ev_set_priority(&c->rx_w, EV_MAXPRI);
-        ev_io_start(loop, &c->rx_w);
+        ev_io_start(qe->loop, &c->rx_w);
         c->holds_sock = true;
+        if (relay)
+            qe->relay_ws = c->sock;
     }
-    c->sport = w_get_sport(c->sock);
+    c->sport = relay ? htons(port) : w_get_sport(c->sock);
 
     // init scid and add connection to global data structures
     conns_by_ipnp_ins(c);
@@ -1381,7 +2103,7 @@ void free_scid(struct q_conn * const c, struct cid * const id)
 {
     ensure(splay_remove(cids_by_seq, &c->scids_by_seq, id), "removed");
     ensure(splay_remove(cids_by_id, &c->scids_by_id, id), "removed");
-    conns_by_id_del(id);
+    conns_by_id_del(c, id);
     free(id);
 }
 
@@ -1395,19 +2117,47 @@ void free_dcid(struct q_conn * const c, struct cid * const id)
 
 void free_conn(struct q_conn * const c)
 {
+    struct q_engine * const e = ped(c->w);
+    struct ev_loop * const loop = e->loop;
+
     // exit any active API call on the connection
-    maybe_api_return(c, 0);
+    maybe_api_return_any(e, c, 0);
+
+    // return the receive window to the engine's budget
+    e->fc_granted -= c->in_data_wnd;
+
+    warn(INF,
+         "%s conn %s lost %" PRIu64 " pkt%s, %" PRIu64
+         " spuriously (%" PRIu64 " cwnd reduction%s undone)",
+         conn_type(c), cid2str(c->scid), c->rec.lost_cnt,
+         plural(c->rec.lost_cnt), c->rec.spurious_cnt, c->rec.undo_cnt,
+         plural(c->rec.undo_cnt));
+
+    if (c->in_tx_pend) {
+        // send what is left before the socket may go away
+        sl_remove(&e->tx_pend, c, q_conn, node_tx);
+        c->in_tx_pend = false;
+        if (unlikely(c->sock == e->relay_ws))
+            relay_dgrams(e, c->sport, &c->txq_pend);
+        else
+            tx_batch(e, c->sock, &c->txq_pend);
+    }
 
     if (c->holds_sock) {
         // only close the socket for the final server connection
+        tx_flush_delayed(e, c->sock);
         ev_io_stop(loop, &c->rx_w);
+        if (c->sock == e->relay_ws)
+            e->relay_ws = 0;
         w_close(c->sock);
     }
-    ev_timer_stop(loop, &c->rec.ld_alarm);
-    ev_timer_stop(loop, &c->closing_alarm);
-    ev_timer_stop(loop, &c->migration_alarm);
-    ev_timer_stop(loop, &c->idle_alarm);
+    tmr_stop(&e->whl, &c->rec.ld_alarm);
+    ev_timer_stop(loop, &c->rec.pace_alarm);
+    tmr_stop(&e->whl, &c->closing_alarm);
+    tmr_stop(&e->whl, &c->migration_alarm);
+    tmr_stop(&e->whl, &c->idle_alarm);
 
+    unsched_streams(c);
     struct q_stream * s;
     kh_foreach (s, c->streams_by_id)
         free_stream(s);
@@ -1442,7 +2192,7 @@ void free_conn(struct q_conn * const c)
     }
 
     if (c->in_c_ready)
-        sl_remove(&c_ready, c, q_conn, node_rx_ext);
+        sl_remove(&e->c_ready, c, q_conn, node_rx_ext);
 
     free(c);
 }
@@ -47,11 +47,13 @@
 #include "quic.h"
 #include "recovery.h"
 #include "tls.h"
+#include "wheel.h"
 
 
 #define cid2str(i)                                                             \
     __extension__({                                                            \
-        static char _str[2 * (MAX_CID_LEN + sizeof((i)->seq)) + 1] = "0";      \
+        static __thread char                                                   \
+            _str[2 * (MAX_CID_LEN + sizeof((i)->seq)) + 1] = "0";              \
         if (i)                                                                 \
             snprintf(_str, sizeof(_str), "%" PRIu64 ":%s", (i)->seq,           \
                      hex2str((i)->id, (i)->len));                              \
@@ -62,6 +64,8 @@
 KHASH_MAP_INIT_INT64(streams_by_id, struct q_stream *) // NOLINT
 KHASH_MAP_INIT_INT64(conns_by_ipnp, struct q_conn *)   // NOLINT
 
+sq_head(q_stream_sq, q_stream);
+
 
 static inline khint_t __attribute__((always_inline, nonnull))
 hash_cid(const struct cid * const id)
@@ -96,10 +100,6 @@ KHASH_INIT(conns_by_id, // NOLINT
         if (kh_exist((h), _k) ? ((v) = kh_val((h), _k), 1) : ((v) = 0, 0))
 
 
-extern khash_t(conns_by_ipnp) * conns_by_ipnp;
-extern khash_t(conns_by_id) * conns_by_id;
-
-
 struct transport_params {
     uint64_t max_strm_data_uni;
     uint64_t max_strm_data_bidi_local;
@@ -117,12 +117,11 @@ struct transport_params {
     bool disable_migration;
     uint8_t _unused;
     struct cid orig_cid;
+    uint32_t min_ack_del; ///< min_ack_delay (in usec), zero if not sent.
+    uint8_t _unused2[4];
 };
 
 
-sl_head(q_conn_sl, q_conn);
-
-
 #define CONN_STATE(k, v) k = v
 #define CONN_STATES                                                            \
     CONN_STATE(conn_clsd, 0), CONN_STATE(conn_idle, 1),                        \
@@ -151,6 +150,7 @@ struct q_conn {
     sl_entry(q_conn) node_rx_int; ///< For maintaining the internal RX queue.
     sl_entry(q_conn) node_rx_ext; ///< For maintaining the external RX queue.
     sl_entry(q_conn) node_aq;     ///< For maintaining the accept queue.
+    sl_entry(q_conn) node_tx;     ///< For maintaining the TX batch.
 
     struct cids_by_seq dcids_by_seq; ///< Destination CID hash by sequence.
     struct cids_by_seq scids_by_seq; ///< Source CID hash by sequence.
@@ -180,11 +180,14 @@ struct q_conn {
     uint32_t do_migration : 1;     ///< Perform a CID migration when possible.
     uint32_t do_key_flip : 1;      ///< Perform a TLS key update.
     uint32_t skip_cwnd_ping : 1;   ///< Skip sending PING to force ACK.
+    uint32_t in_tx_pend : 1;       ///< Connection is listed in tx_pend.
+    uint32_t tx_ack_freq : 1;      ///< Send ACK_FREQUENCY.
+    uint32_t tx_pmtu_probe : 1;    ///< Next packet is a PMTUD probe.
 #ifndef SPINBIT
-    uint32_t : 10;
+    uint32_t : 7;
 #else
     uint32_t next_spin : 1; ///< Spin value to set on next packet sent.
-    uint32_t : 9;
+    uint32_t : 6;
 #endif
 
     uint16_t sport; ///< Local port (in network byte-order).
@@ -202,6 +205,16 @@ struct q_conn {
     uint32_t vers;         ///< QUIC version in use for this connection.
     uint32_t vers_initial; ///< QUIC version first negotiated.
 
+    q_sched_t sched;        ///< Stream scheduler, see q_set_scheduler().
+    uint16_t ack_thresh;    ///< ACK after this many ACK-eliciting pkts.
+    uint16_t ack_freq_pkts; ///< ACK ratio we asked the peer for, or zero.
+
+    uint16_t pmtu;       ///< Largest datagram size confirmed by PMTUD.
+    uint16_t pmtu_probe; ///< Size of the PMTUD probe in flight, or zero.
+    uint16_t pmtu_hi;    ///< Largest datagram size PMTUD may still confirm.
+    uint8_t pmtu_fails;  ///< Lost probes of the current probe size.
+    uint8_t _unused;
+
     struct pn_hshk_space pn_init, pn_hshk;
     struct pn_data_space pn_data;
 
@@ -215,17 +228,33 @@ struct q_conn {
     struct transport_params tp_out; ///< Transport parameters for TX.
 
     uint64_t in_data;
+    uint64_t in_data_read; ///< Inbound data returned to the app (total).
     uint64_t out_data;
+    uint64_t in_data_wnd; ///< Inbound window size, see autotune_fc_wnd().
+    ev_tstamp fc_t;       ///< When @p in_data_wnd was last used.
+
+    uint64_t sid_wnd_bidi; ///< Bidi streams granted ahead of the peer.
+    uint64_t sid_wnd_uni;  ///< Unidir streams granted ahead of the peer.
+    ev_tstamp sid_t_bidi;  ///< When @p sid_wnd_bidi was last used.
+    ev_tstamp sid_t_uni;   ///< When @p sid_wnd_uni was last used.
 
-    ev_timer idle_alarm;
-    ev_timer closing_alarm;
-    ev_timer migration_alarm;
+    uint64_t ack_freq_seq;    ///< Sequence number of our ACK_FREQUENCY.
+    uint64_t ack_freq_seq_in; ///< Next ACK_FREQUENCY sequence number to RX.
+    ev_tstamp ack_freq_del;   ///< Max. ACK delay we asked the peer for.
+
+    struct tmr idle_alarm;
+    struct tmr closing_alarm;
+    struct tmr migration_alarm;
+    ev_tstamp idle_t; ///< Last activity, checked lazily by idle_alarm.
 
     struct sockaddr_in peer; ///< Address of our peer.
     char * peer_name;
 
     struct q_stream * cstreams[ep_data + 1]; ///< Crypto "streams".
     khash_t(streams_by_id) * streams_by_id;  ///< Regular streams.
+    struct q_stream_sq strms_tx;   ///< Streams with unACK'ed data.
+    struct q_stream_sq strms_ctrl; ///< Streams that need control frames.
+    struct q_stream_sq strms_rx;   ///< Streams with readable data.
     struct diet closed_streams;
 
     struct w_sock * sock; ///< File descriptor (socket) for the connection.
@@ -247,14 +276,12 @@ struct q_conn {
     struct cid odcid; ///< Original destination CID of first Initial.
 
     struct w_iov_sq txq;
+    struct w_iov_sq txq_pend; ///< Datagrams waiting for tx_flush().
 
     uint8_t tok[MAX_TOK_LEN]; // some stacks send ungodly large tokens
 };
 
 
-extern struct q_conn_sl c_ready;
-
-
 #if !defined(NDEBUG) && !defined(FUZZING)
 #define conn_to_state(c, s)                                                    \
     do {                                                                       \
@@ -278,14 +305,33 @@ tx_w(struct ev_loop * const l, ev_async * const w, int e);
 extern void __attribute__((nonnull))
 tx(struct q_conn * const c, const uint32_t limit);
 
+extern void __attribute__((nonnull)) tx_flush(struct q_engine * const e);
+
+extern void __attribute__((nonnull(1)))
+tx_flush_delayed(struct q_engine * const e, const struct w_sock * const ws);
+
+extern void __attribute__((nonnull))
+tx_delay_alarm(struct ev_loop * const l, ev_timer * const w, int e);
+
+extern void __attribute__((nonnull))
+tx_prepare(struct ev_loop * const l, ev_prepare * const w, int e);
+
 extern void __attribute__((nonnull))
 tx_ack(struct q_conn * const c, const epoch_t e);
 
 extern void __attribute__((nonnull)) tx_tlp(struct q_conn * const c);
 
+extern uint16_t __attribute__((nonnull))
+carry_stream_frames(struct q_stream * const s,
+                    struct w_iov * const v,
+                    const uint16_t pos);
+
 extern void __attribute__((nonnull))
 rx(struct ev_loop * const l, ev_io * const rx_w, int e);
 
+extern void __attribute__((nonnull))
+rx_steered(struct ev_loop * const l, ev_async * const w, int e);
+
 extern void * __attribute__((nonnull)) loop_run(void * const arg);
 
 extern void __attribute__((nonnull))
@@ -321,6 +367,23 @@ add_dcid(struct q_conn * const c, const struct cid * const id);
 
 extern void __attribute__((nonnull)) do_conn_fc(struct q_conn * const c);
 
+extern void __attribute__((nonnull))
+grow_conn_wnd(struct q_conn * const c, const uint64_t wnd);
+
+extern void __attribute__((nonnull))
+autotune_fc_wnd(const struct q_conn * const c,
+                uint64_t * const wnd,
+                ev_tstamp * const t,
+                const uint64_t max);
+
+extern void __attribute__((nonnull))
+on_pmtu_probe_acked(struct q_conn * const c, const uint16_t len);
+
+extern void __attribute__((nonnull))
+on_pmtu_probe_lost(struct q_conn * const c, const uint16_t len);
+
+extern void __attribute__((nonnull)) touch_idle(struct q_conn * const c);
+
 extern void __attribute__((nonnull))
 free_scid(struct q_conn * const c, struct cid * const id);
 
@@ -330,7 +393,8 @@ free_dcid(struct q_conn * const c, struct cid * const id);
 #ifdef FUZZING
 extern void __attribute__((nonnull)) rx_pkts(struct w_iov_sq * const x,
                                              struct q_conn_sl * const crx,
-                                             const struct w_sock * const ws);
+                                             const struct w_sock * const ws,
+                                             const uint16_t sport);
 #endif
 
 static inline struct pn_space * __attribute__((always_inline, nonnull))
@@ -371,7 +435,14 @@ epoch_in(const struct q_conn * const c)
 static inline bool __attribute__((nonnull, always_inline))
 has_wnd(const struct q_conn * const c)
 {
-    return !c->blocked && (c->rec.in_flight + w_mtu(c->w) < c->rec.cwnd);
+    return !c->blocked && c->rec.cc->can_send(c);
+}
+
+
+static inline bool __attribute__((nonnull, always_inline))
+in_recovery(const struct q_conn * const c, const uint64_t nr)
+{
+    return nr <= c->rec.eor;
 }
 
 
@@ -380,7 +451,8 @@ conn_needs_ctrl(const struct q_conn * const c)
 {
     return epoch_in(c) == ep_data &&
            (c->tx_max_data || c->tx_max_sid_bidi || c->tx_path_resp ||
-            c->tx_path_chlg || c->tx_ncid || c->tx_retire_cid || c->blocked);
+            c->tx_path_chlg || c->tx_ncid || c->tx_retire_cid || c->blocked ||
+            c->tx_ack_freq);
 }
 
 
@@ -400,9 +472,6 @@ struct ooo_0rtt {
 };
 
 
-extern splay_head(ooo_0rtt_by_cid, ooo_0rtt) ooo_0rtt_by_cid;
-
-
 static inline int __attribute__((always_inline, nonnull))
 ooo_0rtt_by_cid_cmp(const struct ooo_0rtt * const a,
                     const struct ooo_0rtt * const b)
@@ -414,6 +483,30 @@ ooo_0rtt_by_cid_cmp(const struct ooo_0rtt * const a,
 SPLAY_PROTOTYPE(ooo_0rtt_by_cid, ooo_0rtt, node, ooo_0rtt_by_cid_cmp)
 
 
+/// A packet received by one worker for a connection owned by another, or a
+/// datagram relayed to worker 0 for transmission, see one_serv_sock(). The
+/// data is copied, since w_iov buffers cannot be passed between engines.
+struct q_steered {
+    sq_entry(q_steered) next;
+    uint32_t ip;    ///< Peer IP of the packet.
+    uint16_t port;  ///< Peer port of the packet.
+    uint16_t sport; ///< Local port the packet was received on or is sent from.
+    uint16_t len;   ///< Length of @p buf.
+    uint8_t flags;  ///< w_iov flags of the packet.
+    uint8_t _unused[5];
+    uint8_t buf[];  ///< Packet data.
+};
+
+
+/// Datagrams held back to emulate path delay, see q_set_tx_delay().
+struct q_delayed {
+    sq_entry(q_delayed) next;
+    ev_tstamp t;              ///< When to send @p q.
+    const struct w_sock * ws; ///< Socket to send @p q on.
+    struct w_iov_sq q;        ///< Datagrams to send.
+};
+
+
 static inline __attribute__((always_inline, nonnull)) const char *
 conn_type(const struct q_conn * const c)
 {
@@ -421,6 +514,40 @@ conn_type(const struct q_conn * const c)
 }
 
 
+/// Stamp the index of the worker owning server connection @p c into the first
+/// byte of the connection ID @p id, so packets for it can be steered to it.
+///
+/// @param      c     Connection.
+/// @param      id    New connection ID for @p c.
+///
+static inline void __attribute__((always_inline, nonnull))
+set_cid_widx(const struct q_conn * const c, struct cid * const id)
+{
+    const struct q_engine * const e = ped(c->w);
+    if (e->wrk && e->wrk->n > 1 && c->is_clnt == false)
+        id->id[0] = e->widx;
+}
+
+
+/// Whether the workers of the group of engine @p e share one server socket.
+/// Without W_REUSEPORT, only worker 0 can bind the server port. It then
+/// receives all packets and steers them to the other workers, which relay
+/// their datagrams back to it for transmission.
+///
+/// @param      e     Engine.
+///
+static inline bool __attribute__((always_inline, nonnull))
+one_serv_sock(const struct q_engine * const e)
+{
+#ifdef W_REUSEPORT
+    (void)e;
+    return false;
+#else
+    return e->wrk && e->wrk->n > 1;
+#endif
+}
+
+
 static inline __attribute__((always_inline, const)) bool
 is_force_neg_vers(const uint32_t vers)
 {
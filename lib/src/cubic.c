@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2018, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/param.h>
+
+#include <ev.h>
+#include <warpcore/warpcore.h>
+
+#include "cc.h"
+#include "conn.h"
+#include "pn.h"
+#include "quic.h"
+#include "recovery.h"
+
+
+static void __attribute__((nonnull)) cubic_init(struct q_conn * const c)
+{
+    c->rec.cubic = (struct cubic){0};
+}
+
+
+static void __attribute__((nonnull))
+cubic_on_sent(struct q_conn * const c, const struct w_iov * const v)
+{
+    // when sending after an idle period, move the epoch forward, so cwnd
+    // doesn't grow for the time nothing was sent
+    struct cubic * const cu = &c->rec.cubic;
+    if (c->rec.in_flight == 0 && !is_zero(cu->epoch_t) &&
+        meta(v).tx_t > c->rec.last_sent_rtxable_t)
+        cu->epoch_t += meta(v).tx_t - c->rec.last_sent_rtxable_t;
+}
+
+
+static void __attribute__((nonnull))
+cubic_on_acked(struct q_conn * const c, const struct w_iov * const v)
+{
+    if (in_recovery(c, meta(v).hdr.nr))
+        return;
+
+    if (c->rec.cwnd < c->rec.ssthresh) {
+        slow_start(c, v);
+        return;
+    }
+
+    struct cubic * const cu = &c->rec.cubic;
+    const ev_tstamp now = ev_now(ped(c->w)->loop);
+    const double cwnd = (double)c->rec.cwnd;
+    if (is_zero(cu->epoch_t)) {
+        // start of a congestion avoidance epoch
+        cu->epoch_t = now;
+        if (c->rec.cwnd < cu->w_max) {
+            cu->k = cbrt((double)(cu->w_max - c->rec.cwnd) / kMaxDatagramSize /
+                         kCubicC);
+            cu->origin = cu->w_max;
+        } else {
+            cu->k = 0;
+            cu->origin = c->rec.cwnd;
+        }
+        cu->w_est = cwnd;
+    }
+
+    // W_cubic(t + RTT), growing cwnd by at most half per RTT
+    const ev_tstamp t =
+        now - cu->epoch_t + (is_inf(c->rec.min_rtt) ? 0 : c->rec.min_rtt);
+    const double d = t - cu->k;
+    const double target = MIN(
+        (double)cu->origin + kCubicC * d * d * d * kMaxDatagramSize,
+        1.5 * cwnd);
+
+    const double acked = (double)meta(v).tx_len;
+    cu->w_est += kCubicAlpha * kMaxDatagramSize * acked / cwnd;
+
+    double inc = target > cwnd ? (target - cwnd) * acked / cwnd
+                               : 0.01 * kMaxDatagramSize * acked / cwnd;
+    if (cu->w_est > cwnd + inc)
+        // Reno-friendly region
+        inc = cu->w_est - cwnd;
+
+    cu->w_inc += inc;
+    const uint64_t whole = (uint64_t)cu->w_inc;
+    c->rec.cwnd += whole;
+    cu->w_inc -= (double)whole;
+}
+
+
+static void __attribute__((nonnull)) cubic_on_lost(struct q_conn * const c)
+{
+    slow_start_on_lost(c);
+
+    struct cubic * const cu = &c->rec.cubic;
+    cu->epoch_t = 0;
+    cu->w_inc = 0;
+    cu->undo_w_max = cu->w_max;
+    cu->undo_w_last_max = cu->w_last_max;
+
+    // fast convergence: if cwnd didn't get back to where it was before the
+    // previous reduction, release more bandwidth to new flows
+    cu->w_max = c->rec.cwnd;
+    if (cu->w_max < cu->w_last_max) {
+        cu->w_last_max = cu->w_max;
+        cu->w_max = (uint64_t)((double)cu->w_max * (1 + kCubicBeta) / 2);
+    } else
+        cu->w_last_max = cu->w_max;
+
+    c->rec.cwnd = MAX((uint64_t)((double)c->rec.cwnd * kCubicBeta),
+                      (uint64_t)kMinimumWindow);
+    c->rec.ssthresh = c->rec.cwnd;
+}
+
+
+static void __attribute__((nonnull))
+cubic_on_rto_verified(struct q_conn * const c)
+{
+    c->rec.cubic.epoch_t = 0;
+    c->rec.cubic.w_inc = 0;
+    c->rec.cwnd = kMinimumWindow;
+}
+
+
+static void __attribute__((nonnull))
+cubic_on_spurious_loss(struct q_conn * const c)
+{
+    // forget the reduction and start a new epoch from the restored cwnd
+    struct cubic * const cu = &c->rec.cubic;
+    cu->w_max = cu->undo_w_max;
+    cu->w_last_max = cu->undo_w_last_max;
+    cu->epoch_t = 0;
+    cu->w_inc = 0;
+}
+
+
+static bool __attribute__((nonnull))
+cubic_can_send(const struct q_conn * const c)
+{
+    return c->rec.in_flight + w_mtu(c->w) < c->rec.cwnd;
+}
+
+
+const struct cc_ops cc_cubic = {.name = "CUBIC",
+                                .init = cubic_init,
+                                .on_sent = cubic_on_sent,
+                                .on_acked = cubic_on_acked,
+                                .on_lost = cubic_on_lost,
+                                .on_rto_verified = cubic_on_rto_verified,
+                                .on_spurious_loss = cubic_on_spurious_loss,
+                                .can_send = cubic_can_send};
@@ -35,6 +35,8 @@
 #include "diet.h"
 
 
+#ifndef DIET_ARRAY
+
 SPLAY_GENERATE(diet, ival, node, ival_cmp)
 
 
@@ -303,13 +305,15 @@ void diet_free(struct diet * const d)
     }
 }
 
+#endif
+
 
 size_t diet_to_str(char * const str, const size_t len, struct diet * const d)
 {
     struct ival * i = 0;
     size_t pos = 0;
     str[0] = 0;
-    splay_foreach (i, diet, d) {
+    diet_foreach (i, d) {
         pos +=
 #ifdef DIET_CLASS
             (size_t)snprintf(&str[pos], len - pos, "%u.%" PRIu64, i->c, i->lo);
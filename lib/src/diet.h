@@ -48,12 +48,23 @@
 ///
 /// It also maintains a timestamp of the last insert operation into an @p ival,
 /// for the purposes of calculating the ACK delay.
+///
+/// When compiled with DIET_ARRAY defined, the same API is instead backed by a
+/// sorted array of intervals (see diet_array.c). Packet numbers mostly arrive
+/// in order, and so nearly all operations then hit the last interval in the
+/// array, without any tree rebalancing or per-interval allocations.
+
+#if defined(DIET_ARRAY) && defined(DIET_CLASS)
+#error "DIET_ARRAY does not support DIET_CLASS"
+#endif
 
 
 /// An interval [hi..lo] to be used with diet structures, of a given type.
 ///
 struct ival {
+#ifndef DIET_ARRAY
     splay_entry(ival) node; ///< Splay tree node data.
+#endif
     uint64_t lo;            ///< Lower bound of the interval.
     uint64_t hi;            ///< Upper bound of the interval.
     ev_tstamp t;            ///< Time stamp of last insert into this interval.
@@ -82,6 +93,39 @@ ival_cmp(const struct ival * const a, const struct ival * const b)
 }
 
 
+#ifdef DIET_ARRAY
+
+/// Disjoint and non-adjacent intervals, sorted in ascending order.
+///
+struct diet {
+    struct ival * iv; ///< Array of intervals.
+    uint32_t cnt;     ///< Number of intervals in @p iv.
+    uint32_t cap;     ///< Capacity of @p iv.
+};
+
+
+#define diet_initializer(d)                                                    \
+    {                                                                          \
+        0, 0, 0                                                                \
+    }
+#define diet_init(d) ((d)->iv = 0, (d)->cnt = (d)->cap = 0)
+#define diet_cnt(d) ((uint64_t)(d)->cnt)
+
+#define diet_foreach(i, d)                                                     \
+    for ((i) = (d)->cnt ? (d)->iv : 0; (i); (i) = diet_next((d), (i)))
+
+#define diet_foreach_rev(i, d)                                                 \
+    for ((i) = diet_max_ival(d); (i); (i) = (i) > (d)->iv ? (i)-1 : 0)
+
+
+static inline struct ival * __attribute__((nonnull, always_inline))
+diet_next(const struct diet * const d, struct ival * const i)
+{
+    return i + 1 < d->iv + d->cnt ? i + 1 : 0;
+}
+
+#else
+
 splay_head(diet, ival);
 
 
@@ -89,9 +133,14 @@ splay_head(diet, ival);
 #define diet_init(d) splay_init(d)
 #define diet_cnt(d) splay_count(d)
 
+#define diet_foreach(i, d) splay_foreach ((i), diet, (d))
+#define diet_foreach_rev(i, d) splay_foreach_rev ((i), diet, (d))
+
 
 SPLAY_PROTOTYPE(diet, ival, node, ival_cmp)
 
+#endif
+
 
 extern struct ival * diet_find(struct diet * const d, const uint64_t n);
 
@@ -111,38 +160,50 @@ extern size_t __attribute__((nonnull))
 diet_to_str(char * const str, const size_t len, struct diet * const d);
 
 
+inline bool __attribute__((nonnull, always_inline))
+diet_empty(const struct diet * const d)
+{
+#ifdef DIET_ARRAY
+    return d->cnt == 0;
+#else
+    return splay_empty(d);
+#endif
+}
+
+
 static inline struct ival * __attribute__((nonnull, always_inline))
 diet_max_ival(struct diet * const d)
 {
-    return splay_empty(d) ? 0 : splay_max(diet, d);
+#ifdef DIET_ARRAY
+    return diet_empty(d) ? 0 : &d->iv[d->cnt - 1];
+#else
+    return diet_empty(d) ? 0 : splay_max(diet, d);
+#endif
 }
 
 
 static inline struct ival * __attribute__((nonnull, always_inline))
 diet_min_ival(struct diet * const d)
 {
-    return splay_empty(d) ? 0 : splay_min(diet, d);
+#ifdef DIET_ARRAY
+    return diet_empty(d) ? 0 : d->iv;
+#else
+    return diet_empty(d) ? 0 : splay_min(diet, d);
+#endif
 }
 
 
 static inline uint64_t __attribute__((nonnull, always_inline))
 diet_max(struct diet * const d)
 {
-    return splay_empty(d) ? 0 : splay_max(diet, d)->hi;
+    return diet_empty(d) ? 0 : diet_max_ival(d)->hi;
 }
 
 
 static inline uint64_t __attribute__((nonnull, always_inline))
 diet_min(struct diet * const d)
 {
-    return splay_empty(d) ? 0 : splay_min(diet, d)->lo;
-}
-
-
-inline bool __attribute__((nonnull, always_inline))
-diet_empty(const struct diet * const d)
-{
-    return splay_empty(d);
+    return diet_empty(d) ? 0 : diet_min_ival(d)->lo;
 }
 
 
@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2018, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <warpcore/warpcore.h>
+
+#include "diet.h"
+
+
+#define DIET_MIN_CAP 8
+
+
+/// Index of the first interval in @p d whose upper bound is not below @p n.
+/// Checks the last interval first, since that is where in-order inserts go.
+///
+/// @param      d     Diet array.
+/// @param[in]  n     Integer.
+///
+/// @return     Index into d->iv; d->cnt if @p n is above all intervals.
+///
+static inline uint32_t __attribute__((nonnull))
+lower_bound(const struct diet * const d, const uint64_t n)
+{
+    if (d->cnt == 0 || n > d->iv[d->cnt - 1].hi)
+        return d->cnt;
+    if (n >= d->iv[d->cnt - 1].lo)
+        return d->cnt - 1;
+
+    uint32_t lo = 0;
+    uint32_t hi = d->cnt - 1;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (d->iv[mid].hi < n)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+/// Open up a slot at index @p x in @p d, growing the array if needed.
+///
+/// @param      d     Diet array.
+/// @param[in]  x     Index.
+///
+static void __attribute__((nonnull))
+open_slot(struct diet * const d, const uint32_t x)
+{
+    if (d->cnt == d->cap) {
+        d->cap = d->cap ? d->cap * 2 : DIET_MIN_CAP;
+        d->iv = realloc(d->iv, d->cap * sizeof(*d->iv));
+        ensure(d->iv, "could not realloc");
+    }
+    memmove(&d->iv[x + 1], &d->iv[x], (d->cnt - x) * sizeof(*d->iv));
+    d->cnt++;
+}
+
+
+/// Close the slot at index @p x in @p d.
+///
+/// @param      d     Diet array.
+/// @param[in]  x     Index.
+///
+static void __attribute__((nonnull))
+close_slot(struct diet * const d, const uint32_t x)
+{
+    d->cnt--;
+    memmove(&d->iv[x], &d->iv[x + 1], (d->cnt - x) * sizeof(*d->iv));
+}
+
+
+/// Pointer to the interval containing @p n in diet array @p d.
+///
+/// @param      d     Diet array.
+/// @param[in]  n     Integer.
+///
+/// @return     Pointer to the ival structure containing @p i; zero otherwise.
+///
+struct ival * diet_find(struct diet * const d, const uint64_t n)
+{
+    const uint32_t x = lower_bound(d, n);
+    return x < d->cnt && d->iv[x].lo <= n ? &d->iv[x] : 0;
+}
+
+
+/// Inserts integer @p n into the diet array @p d.
+///
+/// @param      d     Diet array.
+/// @param[in]  n     Integer.
+/// @param[in]  t     Timestamp.
+///
+/// @return     Pointer to ival containing @p n. Only valid until the next
+///             modification of @p d.
+///
+struct ival *
+diet_insert(struct diet * const d, const uint64_t n, const ev_tstamp t)
+{
+    const uint32_t x = lower_bound(d, n);
+    if (x < d->cnt && d->iv[x].lo <= n) {
+        d->iv[x].t = t;
+        return &d->iv[x];
+    }
+
+    // n lies between d->iv[x - 1] and d->iv[x], if those exist
+    const bool join_prev = x > 0 && d->iv[x - 1].hi + 1 == n;
+    const bool join_next = x < d->cnt && d->iv[x].lo - 1 == n;
+
+    if (join_prev && join_next) {
+        d->iv[x - 1].hi = d->iv[x].hi;
+        close_slot(d, x);
+    } else if (join_prev)
+        d->iv[x - 1].hi = n;
+    else if (join_next)
+        d->iv[x].lo = n;
+    else {
+        open_slot(d, x);
+        d->iv[x].lo = d->iv[x].hi = n;
+    }
+
+    struct ival * const i = join_prev ? &d->iv[x - 1] : &d->iv[x];
+    i->t = t;
+    return i;
+}
+
+
+/// Remove integer @p n from the intervals stored in diet array @p d.
+///
+/// @param      d     Diet array.
+/// @param[in]  n     Integer.
+///
+void diet_remove(struct diet * const d, const uint64_t n)
+{
+    const uint32_t x = lower_bound(d, n);
+    if (x == d->cnt || n < d->iv[x].lo)
+        return;
+
+    if (n == d->iv[x].lo) {
+        if (n == d->iv[x].hi)
+            close_slot(d, x);
+        else
+            // adjust lo bound
+            d->iv[x].lo++;
+    } else if (n == d->iv[x].hi) {
+        // adjust hi bound
+        d->iv[x].hi--;
+    } else {
+        // split interval
+        open_slot(d, x);
+        d->iv[x] = d->iv[x + 1];
+        d->iv[x].hi = n - 1;
+        d->iv[x + 1].lo = n + 1;
+    }
+}
+
+
+void diet_free(struct diet * const d)
+{
+    free(d->iv);
+    diet_init(d);
+}
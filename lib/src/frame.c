@@ -257,7 +257,8 @@ dec_stream_or_crypto_frame(struct q_conn * const c,
             // left edge of p <= left edge of stream: overlap, trim & enqueue
             if (unlikely(p->stream->in_data_off > p->stream_off))
                 trim_frame(p);
-            sq_insert_tail(&meta(v).stream->in, w_iov(c->w, pm_idx(p)), next);
+            sq_insert_tail(&meta(v).stream->in, w_iov(c->w, pm_idx(c->w, p)),
+                           next);
             meta(v).stream->in_data_off += p->stream_data_len;
             ensure(splay_remove(ooo_by_off, &meta(v).stream->in_ooo, p),
                    "removed");
@@ -273,24 +274,27 @@ dec_stream_or_crypto_frame(struct q_conn * const c,
                 strm_to_state(meta(v).stream, meta(v).stream->state <= strm_hcrm
                                                   ? strm_hcrm
                                                   : strm_clsd);
-                maybe_api_return(q_readall_str, c, meta(v).stream);
+                maybe_api_return(ped(c->w), q_readall_str, c, meta(v).stream);
                 if (meta(v).stream->state == strm_clsd)
-                    maybe_api_return(q_close_stream, c, meta(v).stream);
+                    maybe_api_return(ped(c->w), q_close_stream, c,
+                                     meta(v).stream);
 
                 // ACK the FIN immediately
                 struct pn_space * const pn =
                     pn_for_pkt_type(c, meta(v).hdr.type);
-                ev_invoke(loop, &pn->ack_alarm, 0);
+                ack_alarm(&pn->ack_alarm);
             }
             if (unlikely(v != last))
                 adj_iov_to_data(last);
         }
 
         if (t != FRAM_TYPE_CRPT) {
-            do_stream_fc(meta(v).stream);
-            do_conn_fc(c);
+            // the receive windows are extended when the app reads the data
             c->have_new_data = true;
-            maybe_api_return(q_read, c, 0);
+            sched_stream_rx(meta(v).stream);
+            maybe_api_return(ped(c->w), q_read, c, 0);
+            maybe_api_return(ped(c->w), q_readall_str, c, meta(v).stream);
+            do_cb(ped(c->w), on_stream_readable, meta(v).stream);
         }
         goto done;
     }
@@ -439,46 +443,39 @@ uint16_t dec_ack_frame(struct q_conn * const c,
                      shorten_ack_nr(lg_ack_in_block, ack_block_len));
         }
 
-        uint64_t ack = lg_ack_in_block;
-        while (ack_block_len >= lg_ack_in_block - ack) {
-            struct w_iov * const acked = find_sent_pkt(c, pn, ack);
-            if (unlikely(acked == 0)) {
 #ifndef FUZZING
-                // this is just way too noisy when fuzzing
-                if (unlikely(diet_find(&pn->acked, ack) == 0))
-                    warn(ERR, "got ACK for pkt " FMT_PNR_OUT " never sent",
-                         ack);
+        // this is just way too noisy when fuzzing
+        if (unlikely(pn->lg_sent == UINT64_MAX ||
+                     lg_ack_in_block > pn->lg_sent))
+            warn(ERR, "got ACK for pkt " FMT_PNR_OUT " never sent",
+                 lg_ack_in_block);
 #endif
-                goto skip;
-            }
 
-            if (unlikely(meta(acked).is_acked)) {
-                warn(WRN, "repeated ACK for " FMT_PNR_OUT ", ignoring", ack);
-                goto skip;
-            }
+        // only visit pkts in this ACK block that are still outstanding
+        const uint64_t sm_ack_in_block = lg_ack_in_block - ack_block_len;
+        struct pkt_meta * p = pmr_prev_from(&pn->sent_pkts, lg_ack_in_block);
+        while (p && p->hdr.nr >= sm_ack_in_block) {
+            const uint64_t ack = p->hdr.nr;
+            struct w_iov * const acked = w_iov(c->w, pm_idx(c->w, p));
 
             if (unlikely(ack == lg_ack))
                 // call this only for the largest ACK in the frame
                 on_ack_received_1(c, pn, acked, ack_delay);
 
             // this emulates FindSmallestNewlyAcked() from -recovery
-            if (sm_new_acked > ack)
-                sm_new_acked = meta(acked).hdr.nr;
+            sm_new_acked = ack;
 
+            // this can free p and its RTX copies, so re-lookup afterwards
             on_pkt_acked(c, pn, acked);
-
-        skip:
-            if (likely(ack > 0))
-                ack--;
-            else
-                break;
+            p = ack > sm_ack_in_block ? pmr_prev_from(&pn->sent_pkts, ack - 1)
+                                      : 0;
         }
 
         if (n > 1) {
             i = dec_chk(t, &gap, v->buf, v->len, i, 0, "%" PRIu64);
-            if (unlikely(ack <= gap))
+            if (unlikely(sm_ack_in_block < gap + 2))
                 err_close_return(c, ERR_FRAME_ENC, t, "ACK gap %" PRIu64, gap);
-            lg_ack_in_block = ack - gap - 1;
+            lg_ack_in_block = sm_ack_in_block - gap - 2;
         }
     }
 
@@ -546,7 +543,7 @@ dec_close_frame(struct q_conn * const c,
             c->needs_tx = false;
             enter_closing(c);
         } else
-            ev_invoke(loop, &c->closing_alarm, 0);
+            c->closing_alarm.cb(&c->closing_alarm);
     }
     return i;
 }
@@ -575,7 +572,10 @@ dec_max_stream_data_frame(struct q_conn * const c,
 
     if (max > s->out_data_max) {
         s->out_data_max = max;
-        s->blocked = false;
+        if (s->blocked) {
+            s->blocked = false;
+            do_cb(ped(c->w), on_stream_writable, s);
+        }
         c->needs_tx = true;
     } else
         warn(NTE, "MAX_STREAM_DATA %" PRIu64 " <= current value %" PRIu64, max,
@@ -611,7 +611,7 @@ dec_max_stream_id_frame(struct q_conn * const c,
         else
             c->sid_blocked_bidi = false;
         c->needs_tx = true;
-        maybe_api_return(q_rsv_stream, c, 0);
+        maybe_api_return(ped(c->w), q_rsv_stream, c, 0);
 
     } else
         warn(NTE, "RX'ed max_%s_streams %" PRIu64 " <= current value %" PRIu64,
@@ -634,7 +634,15 @@ dec_max_data_frame(struct q_conn * const c,
 
     if (max > c->tp_out.max_data) {
         c->tp_out.max_data = max;
-        c->blocked = false;
+        if (c->blocked) {
+            c->blocked = false;
+            // only streams with unsent data can have been held back by the
+            // connection window, and those are all in strms_tx
+            struct q_stream * s;
+            sq_foreach (s, &c->strms_tx, next_tx)
+                if (!s->blocked)
+                    do_cb(ped(c->w), on_stream_writable, s);
+        }
         c->needs_tx = true;
     } else
         warn(NTE, "MAX_DATA %" PRIu64 " <= current value %" PRIu64, max,
@@ -696,18 +704,10 @@ dec_stream_id_blocked_frame(struct q_conn * const c,
 
     warn(INF, FRAM_IN "STREAM_ID_BLOCKED" NRM " sid=" FMT_SID, sid);
 
-    int64_t * const max_streams = is_uni(sid) ? &c->tp_in.new_max_uni_streams
-                                              : &c->tp_in.new_max_bidi_streams;
-
-    if ((sid >> 2) + 1 == *max_streams) {
-        // let the peer open more streams
-        *max_streams += 2;
-        if (is_uni(sid))
-            c->tx_max_sid_uni = true;
-        else
-            c->tx_max_sid_bidi = true;
-        c->needs_tx = true;
-    }
+    // let the peer open more streams
+    if ((sid >> 2) + 1 == (is_uni(sid) ? c->tp_in.new_max_uni_streams
+                                       : c->tp_in.new_max_bidi_streams))
+        do_stream_id_fc(c, sid);
 
     return i;
 }
@@ -874,6 +874,44 @@ dec_retire_cid_frame(struct q_conn * const c,
 }
 
 
+static uint16_t __attribute__((nonnull))
+dec_ack_freq_frame(struct q_conn * const c,
+                   const struct w_iov * const v,
+                   const uint16_t pos)
+{
+    uint64_t seq = 0;
+    uint16_t i = dec_chk(FRAM_WIRE_ACK_FREQ, &seq, v->buf, v->len, pos + 1, 0,
+                         "%" PRIu64);
+
+    uint64_t pkts = 0;
+    i = dec_chk(FRAM_WIRE_ACK_FREQ, &pkts, v->buf, v->len, i, 0, "%" PRIu64);
+
+    uint64_t del = 0;
+    i = dec_chk(FRAM_WIRE_ACK_FREQ, &del, v->buf, v->len, i, 0, "%" PRIu64);
+
+    warn(INF,
+         FRAM_IN "ACK_FREQUENCY" NRM " seq=%" PRIu64 " pkts=%" PRIu64
+                 " del=%" PRIu64,
+         seq, pkts, del);
+
+    if (unlikely((double)del < kMinAckDelay * 1000000))
+        err_close_return(c, ERR_PROTOCOL_VIOLATION, FRAM_WIRE_ACK_FREQ,
+                         "ACK delay %" PRIu64 " below min_ack_delay", del);
+
+    if (seq < c->ack_freq_seq_in) {
+        warn(NTE, "ignoring old ACK_FREQUENCY seq %" PRIu64, seq);
+        return i;
+    }
+    c->ack_freq_seq_in = seq + 1;
+
+    // only the 1-RTT pn space uses the new values
+    c->ack_thresh = (uint16_t)MIN(MAX(pkts, 1), UINT16_MAX);
+    c->pn_data.pn.ack_alarm.repeat = (double)del / 1000000;
+
+    return i;
+}
+
+
 static uint16_t __attribute__((nonnull))
 dec_new_token_frame(struct q_conn * const c,
                     const struct w_iov * const v,
@@ -915,7 +953,7 @@ uint16_t dec_frames(struct q_conn * const c, struct w_iov ** vv)
     !defined(NO_FUZZER_CORPUS_COLLECTION)
     // when called from the fuzzer, v->ip is zero
     if (v->ip)
-        write_to_corpus(corpus_frm_dir, &v->buf[i], v->len - i);
+        write_to_corpus(ped(v->w)->corpus_frm_dir, &v->buf[i], v->len - i);
 #endif
 
     while (likely(i < v->len)) {
@@ -976,8 +1014,10 @@ uint16_t dec_frames(struct q_conn * const c, struct w_iov ** vv)
 
             case FRAM_TYPE_PING:
                 warn(INF, FRAM_IN "PING" NRM);
-                // PING frames need to be ACK'ed
+                // PING frames need to be ACK'ed, and right away, since the
+                // peer is likely out of window
                 c->needs_tx = true;
+                pn_for_pkt_type(c, meta(v).hdr.type)->imm_ack = true;
                 i++;
                 break;
 
@@ -1029,6 +1069,11 @@ uint16_t dec_frames(struct q_conn * const c, struct w_iov ** vv)
                 i = dec_retire_cid_frame(c, v, i);
                 break;
 
+            case FRAM_WIRE_ACK_FREQ:
+                type = FRAM_TYPE_ACK_FREQ; // only enc this in bitstr_t
+                i = dec_ack_freq_frame(c, v, i);
+                break;
+
             default:
                 err_close_return(c, ERR_FRAME_ENC, type,
                                  "unknown frame type 0x%02x at pos %u", type,
@@ -1100,6 +1145,10 @@ uint16_t max_frame_len(const uint8_t type)
         len += sizeof(uint64_t) + sizeof(uint16_t);
         break;
 
+    case FRAM_TYPE_ACK_FREQ:
+        len += sizeof(uint64_t) + sizeof(uint16_t) + sizeof(uint32_t);
+        break;
+
         // these two don't need to be length-checked
         // case FRAM_TYPE_STRM:
         // case FRAM_TYPE_CRPT:
@@ -1155,7 +1204,8 @@ uint16_t enc_ack_frame(struct q_conn * const c,
             ? DEF_ACK_DEL_EXP
             : c->tp_out.ack_del_exp;
     const uint64_t ack_delay =
-        (uint64_t)((ev_now(loop) - diet_timestamp(b)) * 1000000) / (1 << ade);
+        (uint64_t)((ev_now(ped(c->w)->loop) - diet_timestamp(b)) * 1000000) /
+        (1 << ade);
     i = enc(v->buf, v->len, i, &ack_delay, 0, 0, "%" PRIu64);
 
     meta(v).ack_block_cnt = diet_cnt(&pn->recv) - 1;
@@ -1163,7 +1213,7 @@ uint16_t enc_ack_frame(struct q_conn * const c,
         enc(v->buf, v->len, i, &meta(v).ack_block_cnt, 0, 0, "%" PRIu64);
 
     uint64_t prev_lo = 0;
-    splay_foreach_rev (b, diet, &pn->recv) {
+    diet_foreach_rev (b, &pn->recv) {
         uint64_t gap = 0;
         if (prev_lo) {
             gap = prev_lo - b->hi - 2;
@@ -1218,8 +1268,10 @@ uint16_t enc_ack_frame(struct q_conn * const c,
 
     // warn(DBG, "ACK encoded, stopping epoch %u ACK timer",
     //      epoch_for_pkt_type(meta(v).hdr.type));
-    ev_timer_stop(loop, &pn->ack_alarm);
+    tmr_stop(&ped(c->w)->whl, &pn->ack_alarm);
     bit_zero(NUM_FRAM_TYPES, &pn->rx_frames);
+    pn->ack_elicit_cnt = 0;
+    pn->imm_ack = false;
 
     return i;
 }
@@ -1281,6 +1333,39 @@ uint16_t enc_stream_or_crypto_frame(struct q_stream * const s,
 }
 
 
+uint16_t strm_frame_len(const struct q_stream * const s,
+                        const struct w_iov * const v)
+{
+    // the stream frame enc_stream_or_crypto_frame() would encode for v
+    return (uint16_t)(1 + varint_size_needed((uint64_t)s->id) +
+                      (v->len ? varint_size_needed(v->len) : 0) +
+                      (s->out_data ? varint_size_needed(s->out_data) : 0) +
+                      v->len);
+}
+
+
+uint16_t enc_carried_stream_frame(struct q_stream * const s,
+                                  struct w_iov * const v,
+                                  struct w_iov * const cv,
+                                  const uint16_t pos)
+{
+    // encode the frame in front of the data of cv, as if cv was sent in a pkt
+    // of its own, so its stream can RTX it as such, and then copy it into v
+    adj_iov_to_start(cv);
+    enc_stream_or_crypto_frame(s, cv, 0, true);
+    const uint16_t len = (uint16_t)(cv->len - meta(cv).stream_header_pos);
+    memcpy(&v->buf[pos], &cv->buf[meta(cv).stream_header_pos], len);
+    adj_iov_to_data(cv);
+
+    // an ACK or loss of v now also covers cv
+    meta(cv).tx_len = len;
+    meta(cv).carrier = &meta(v);
+    sl_insert_head(&meta(v).carried, &meta(cv), carried_next);
+    track_frame(v, FRAM_TYPE_STRM);
+    return (uint16_t)(pos + len);
+}
+
+
 uint16_t enc_close_frame(const struct q_conn * const c,
                          struct w_iov * const v,
                          const uint16_t pos)
@@ -1492,6 +1577,7 @@ uint16_t enc_new_cid_frame(struct q_conn * const c,
     struct cid ncid = {.seq = ++c->max_cid_seq_out,
                        .len = c->is_clnt ? CLNT_SCID_LEN : SERV_SCID_LEN};
     ptls_openssl_random_bytes(ncid.id, sizeof(ncid.id) + sizeof(ncid.srt));
+    set_cid_widx(c, &ncid);
     add_scid(c, &ncid);
 
     i = enc(v->buf, v->len, i, &ncid.len, sizeof(ncid.len), 0, "%u");
@@ -1549,6 +1635,32 @@ uint16_t enc_retire_cid_frame(struct q_conn * const c,
 }
 
 
+uint16_t enc_ack_freq_frame(struct q_conn * const c,
+                            struct w_iov * const v,
+                            const uint16_t pos)
+{
+    track_frame(v, FRAM_TYPE_ACK_FREQ);
+    const uint8_t type = FRAM_WIRE_ACK_FREQ;
+    uint16_t i = enc(v->buf, v->len, pos, &type, sizeof(type), 0, "0x%02x");
+
+    i = enc(v->buf, v->len, i, &c->ack_freq_seq, 0, 0, "%" PRIu64);
+    meta(v).ack_freq_seq = (uint16_t)c->ack_freq_seq;
+
+    const uint64_t pkts = c->ack_freq_pkts;
+    i = enc(v->buf, v->len, i, &pkts, 0, 0, "%" PRIu64);
+
+    const uint64_t del = (uint64_t)(c->ack_freq_del * 1000000);
+    i = enc(v->buf, v->len, i, &del, 0, 0, "%" PRIu64);
+
+    warn(INF,
+         FRAM_OUT "ACK_FREQUENCY" NRM " seq=%" PRIu64 " pkts=%" PRIu64
+                  " del=%" PRIu64,
+         c->ack_freq_seq, pkts, del);
+
+    return i;
+}
+
+
 uint16_t enc_ping_frame(const struct w_iov * const v, const uint16_t pos)
 {
     const uint8_t type = FRAM_TYPE_PING;
@@ -61,7 +61,12 @@ struct cid;
 #define FRAM_TYPE_NEW_TOKN 0x19
 #define FRAM_TYPE_ACK 0x1a // we only encode this type in the frames bitstr_t
 #define FRAM_TYPE_ACK_ECN 0x1b
-#define NUM_FRAM_TYPES (FRAM_TYPE_ACK_ECN + 1)
+#define FRAM_TYPE_ACK_FREQ 0x1c // only in the frames bitstr_t, see below
+#define NUM_FRAM_TYPES (FRAM_TYPE_ACK_FREQ + 1)
+
+/// Wire type of the ACK_FREQUENCY frame [draft-iyengar-quic-delayed-ack]. It
+/// is tracked as FRAM_TYPE_ACK_FREQ, to keep the frames bitstr_t small.
+#define FRAM_WIRE_ACK_FREQ 0xaf
 
 #define F_STREAM_FIN 0x01
 #define F_STREAM_LEN 0x02
@@ -113,6 +118,15 @@ enc_stream_or_crypto_frame(struct q_stream * const s,
                            const uint16_t pos,
                            const bool enc_strm);
 
+extern uint16_t __attribute__((nonnull))
+strm_frame_len(const struct q_stream * const s, const struct w_iov * const v);
+
+extern uint16_t __attribute__((nonnull))
+enc_carried_stream_frame(struct q_stream * const s,
+                         struct w_iov * const v,
+                         struct w_iov * const cv,
+                         const uint16_t pos);
+
 extern uint16_t __attribute__((nonnull))
 enc_close_frame(const struct q_conn * const c,
                 struct w_iov * const v,
@@ -181,5 +195,10 @@ enc_retire_cid_frame(struct q_conn * const c,
                      const uint16_t pos,
                      struct cid * const dcid);
 
+extern uint16_t __attribute__((nonnull))
+enc_ack_freq_frame(struct q_conn * const c,
+                   struct w_iov * const v,
+                   const uint16_t pos);
+
 extern uint16_t __attribute__((nonnull))
 enc_ping_frame(const struct w_iov * const v, const uint16_t pos);
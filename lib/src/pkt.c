@@ -332,6 +332,9 @@ enc_other_frames(struct q_stream * const s,
     if (c->tx_max_data && have_space_for(FRAM_TYPE_MAX_DATA, i, lim))
         i = enc_max_data_frame(c, v, i);
 
+    if (c->tx_ack_freq && have_space_for(FRAM_TYPE_ACK_FREQ, i, lim))
+        i = enc_ack_freq_frame(c, v, i);
+
     if (c->sid_blocked_bidi && have_space_for(FRAM_TYPE_SID_BLCK, i, lim))
         i = enc_stream_id_blocked_frame(c, v, i, true);
 
@@ -392,6 +395,7 @@ bool enc_pkt(struct q_stream * const s,
             struct cid nscid = {.len = SERV_SCID_LEN};
             ptls_openssl_random_bytes(nscid.id,
                                       sizeof(nscid.id) + sizeof(nscid.srt));
+            set_cid_widx(c, &nscid);
             cid_cpy(&c->odcid, c->scid);
             update_act_scid(c, &nscid);
         }
@@ -491,6 +495,16 @@ bool enc_pkt(struct q_stream * const s,
     if (meta(v).hdr.type == F_LH_RTRY)
         goto tx;
 
+    if (unlikely(c->tx_pmtu_probe)) {
+        // a PMTUD probe is a PING padded out to the probe size
+        c->tx_pmtu_probe = false;
+        meta(v).is_pmtu_probe = true;
+        i = enc_ping_frame(v, i);
+        v->len = (uint16_t)(c->pmtu_probe - AEAD_LEN);
+        i = enc_padding_frame(v, i, (uint16_t)(v->len - i));
+        goto tx;
+    }
+
     // XXX can't use has_wnd() here, since in_flight is out of data here
     if (unlikely(c->rec.in_flight + 2 * w_mtu(c->w) >= c->rec.cwnd &&
                  c->skip_cwnd_ping == false) &&
@@ -526,11 +540,14 @@ bool enc_pkt(struct q_stream * const s,
         i = enc_stream_or_crypto_frame(s, v, i, s->id >= 0);
     }
 
-    if (i < MAX_PKT_LEN - AEAD_LEN && (enc_data || rtx) &&
+    if (i < c->pmtu - AEAD_LEN && (enc_data || rtx) &&
         (epoch == ep_data || (!c->is_clnt && epoch == ep_0rtt))) {
         // we can try to stick some more frames in after the stream frame
-        v->len = MAX_PKT_LEN - AEAD_LEN;
+        v->len = (uint16_t)(c->pmtu - AEAD_LEN);
         i = enc_other_frames(s, v, i, v->len);
+        if (enc_data && !rtx && s->id >= 0 && c->state == conn_estb)
+            // and then stream frames of other streams
+            i = carry_stream_frames(s, v, i);
     }
 
     if (c->is_clnt && enc_data) {
@@ -915,13 +932,14 @@ try_again:
 
 #ifdef SPINBIT
         // short header, spin the bit
-        if (meta(v).hdr.nr > diet_max(&(c->pn_data.pn.recv_all))) {
+        const uint64_t lg_recv = c->pn_data.pn.lg_recv;
+        if (lg_recv == UINT64_MAX || meta(v).hdr.nr > lg_recv) {
             c->next_spin = ((meta(v).hdr.flags & F_SH_SPIN) == !c->is_clnt);
             warn(DBG, "%sing spin to 0x%02x", c->is_clnt ? "invert" : "reflect",
                  c->next_spin);
         } else
             warn(DBG, "not updating next_spin: %" PRIu64 " <= %" PRIu64,
-                 meta(v).hdr.nr, diet_max(&(c->pn_data.pn.recv_all)));
+                 meta(v).hdr.nr, lg_recv);
 #endif
     }
 
@@ -929,13 +947,13 @@ try_again:
 
     // packet protection verified OK
     struct pn_space * const pn = pn_for_pkt_type(c, meta(v).hdr.type);
-    if (diet_find(&pn->recv_all, meta(v).hdr.nr)) {
+    if (is_dup_nr(pn, meta(v).hdr.nr)) {
         warn(ERR, "duplicate pkt nr " FMT_PNR_IN ", ignoring", meta(v).hdr.nr);
         return false;
     }
 
-    diet_insert(&pn->recv, meta(v).hdr.nr, ev_now(loop));
-    diet_insert(&pn->recv_all, meta(v).hdr.nr, ev_now(loop));
+    diet_insert(&pn->recv, meta(v).hdr.nr, ev_now(ped(c->w)->loop));
+    track_recv_nr(pn, meta(v).hdr.nr);
 
     return true;
 }
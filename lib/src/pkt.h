@@ -38,6 +38,9 @@
 #define MAX_PKT_LEN 1252
 #define MIN_INI_LEN 1200
 
+#define PMTU_MIN_STEP 16  ///< Stop PMTUD once closer than this to the limit.
+#define PMTU_MAX_PROBES 3 ///< Lost probes before PMTUD gives up on a size.
+
 #define F_LONG_HDR 0x80
 
 #define F_LH_INIT 0x7F
@@ -25,14 +25,101 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 
-#include "pn.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/param.h>
+
 #include "conn.h"
+#include "pn.h"
 
 
 struct ev_loop;
 
 
-SPLAY_GENERATE(pm_by_nr, pkt_meta, nr_node, pm_by_nr_cmp)
+#define PMR_MIN_CAP 64 ///< Must be a multiple of the bitmap word size.
+
+
+static inline void __attribute__((nonnull, always_inline))
+pmr_occ_set(struct pm_ring * const r, const uint64_t nr)
+{
+    const uint64_t i = nr & (r->cap - 1);
+    r->occ[i / 64] |= UINT64_C(1) << (i % 64);
+}
+
+
+static inline void __attribute__((nonnull, always_inline))
+pmr_occ_clr(struct pm_ring * const r, const uint64_t nr)
+{
+    const uint64_t i = nr & (r->cap - 1);
+    r->occ[i / 64] &= ~(UINT64_C(1) << (i % 64));
+}
+
+
+static void __attribute__((nonnull))
+pmr_grow(struct pm_ring * const r, const uint64_t span)
+{
+    uint32_t cap = r->cap ? r->cap : PMR_MIN_CAP;
+    while (cap < span) {
+        ensure(cap < UINT32_MAX / 2, "too many sent pkts");
+        cap <<= 1;
+    }
+
+    struct pkt_meta ** const pm = calloc(cap, sizeof(*pm));
+    ensure(pm, "could not calloc");
+    uint64_t * const occ = calloc(cap / 64, sizeof(*occ));
+    ensure(occ, "could not calloc");
+    for (uint64_t nr = r->lo; r->cnt && nr < r->hi; nr++) {
+        const uint64_t i = nr & (cap - 1);
+        pm[i] = *pmr_slot(r, nr);
+        if (pm[i])
+            occ[i / 64] |= UINT64_C(1) << (i % 64);
+    }
+    free(r->pm);
+    free(r->occ);
+    r->pm = pm;
+    r->occ = occ;
+    r->cap = cap;
+}
+
+
+void pmr_insert(struct pm_ring * const r, struct pkt_meta * const p)
+{
+    const uint64_t nr = p->hdr.nr;
+    const uint64_t lo = r->cnt ? MIN(r->lo, nr) : nr;
+    const uint64_t hi = r->cnt ? MAX(r->hi, nr + 1) : nr + 1;
+    if (hi - lo > r->cap)
+        pmr_grow(r, hi - lo);
+
+    struct pkt_meta ** const slot = pmr_slot(r, nr);
+    ensure(*slot == 0, "pkt " FMT_PNR_OUT " already in ring", nr);
+    *slot = p;
+    pmr_occ_set(r, nr);
+    r->cnt++;
+    r->lo = lo;
+    r->hi = hi;
+}
+
+
+bool pmr_remove(struct pm_ring * const r, const struct pkt_meta * const p)
+{
+    const uint64_t nr = p->hdr.nr;
+    if (pmr_find(r, nr) != p)
+        return false;
+
+    *pmr_slot(r, nr) = 0;
+    pmr_occ_clr(r, nr);
+    if (--r->cnt == 0) {
+        r->lo = r->hi = 0;
+        return true;
+    }
+
+    // shrink [lo, hi) to the occupied slots
+    if (nr == r->lo)
+        r->lo = pmr_next_from(r, nr)->hdr.nr;
+    else if (nr == r->hi - 1)
+        r->hi = pmr_prev_from(r, nr)->hdr.nr + 1;
+    return true;
+}
 
 
 static inline __attribute__((always_inline, nonnull)) epoch_t
@@ -46,64 +133,116 @@ epoch_for_pn(const struct pn_space * pn)
 }
 
 
-void ack_alarm(struct ev_loop * const l __attribute__((unused)),
-               ev_timer * const w,
-               int e __attribute__((unused)))
+void ack_alarm(struct tmr * const t)
 {
-    struct pn_space * const pn = w->data;
-    if (needs_ack(pn)) {
+    struct pn_space * const pn = t->data;
+    // the wheel deactivates a timer before calling it, so needs_ack() would
+    // always be false here
+    if (has_unacked_rx(pn)) {
         warn(DBG, "ACK timer fired on %s conn %s epoch %u", conn_type(pn->c),
              cid2str(pn->c->scid), epoch_for_pn(pn));
+        // the ACK delay is up, so don't wait for more pkts
+        pn->imm_ack = true;
         tx_ack(pn->c, epoch_for_pn(pn));
     }
-    ev_timer_stop(loop, &pn->ack_alarm);
+    tmr_stop(&ped(pn->c->w)->whl, &pn->ack_alarm);
 }
 
 
 void init_pn(struct pn_space * const pn, struct q_conn * const c)
 {
     diet_init(&pn->recv);
-    diet_init(&pn->recv_all);
-    diet_init(&pn->acked);
-    splay_init(&pn->sent_pkts);
-    pn->lg_sent = pn->lg_acked = UINT64_MAX;
+    bit_zero(RX_WIN, &pn->recv_win);
+    pn->sent_pkts = (struct pm_ring){0};
+    pn->lg_sent = pn->lg_acked = pn->lg_recv = UINT64_MAX;
+    pn->ld_nr = 0;
+    pn->ack_elicit_cnt = 0;
+    pn->imm_ack = false;
     pn->c = c;
 
     // initialize ACK timeout
-    pn->ack_alarm.data = pn;
+    tmr_init(&pn->ack_alarm, ack_alarm, pn);
     pn->ack_alarm.repeat = kDelayedAckTimeout;
-    ev_init(&pn->ack_alarm, ack_alarm);
 }
 
 
 void reset_pn(struct pn_space * const pn)
 {
+    // reset_stream() already cleared the meta data of any stream pkts, so
+    // forget those, and free the others
+    struct pm_ring * const r = &pn->sent_pkts;
+    for (uint64_t nr = r->lo; r->cnt && nr < r->hi; nr++) {
+        struct pkt_meta ** const slot = pmr_slot(r, nr);
+        if (*slot == 0)
+            continue;
+        if ((*slot)->pn == pn)
+            free_iov(w_iov(pn->c->w, pm_idx(pn->c->w, *slot)));
+        else {
+            *slot = 0;
+            pmr_occ_clr(r, nr);
+            r->cnt--;
+        }
+    }
+    r->lo = r->hi = 0;
+
     diet_free(&pn->recv);
-    diet_free(&pn->recv_all);
-    diet_free(&pn->acked);
     diet_init(&pn->recv);
-    diet_init(&pn->recv_all);
-    diet_init(&pn->acked);
+    bit_zero(RX_WIN, &pn->recv_win);
 
-    pn->lg_sent = UINT64_MAX;
-    ev_timer_stop(loop, &pn->ack_alarm);
+    pn->lg_sent = pn->lg_recv = UINT64_MAX;
+    pn->ld_nr = 0;
+    pn->ack_elicit_cnt = 0;
+    pn->imm_ack = false;
+    tmr_stop(&ped(pn->c->w)->whl, &pn->ack_alarm);
     pn->ect0_cnt = pn->ect1_cnt = pn->ce_cnt = 0;
 }
 
 
 void free_pn(struct pn_space * const pn)
 {
-    ev_timer_stop(loop, &pn->ack_alarm);
+    tmr_stop(&ped(pn->c->w)->whl, &pn->ack_alarm);
 
     // free any remaining buffers
-    struct pkt_meta * p = splay_min(pm_by_nr, &pn->sent_pkts);
+    // freeing a pkt also frees its RTX copies, so re-lookup after each one
+    struct pkt_meta * p = pmr_min(&pn->sent_pkts);
     while (p) {
-        struct pkt_meta * const nxt = splay_next(pm_by_nr, &pn->sent_pkts, p);
-        free_iov(w_iov(pn->c->w, pm_idx(p)));
-        p = nxt;
+        const uint64_t nr = p->hdr.nr;
+        free_iov(w_iov(pn->c->w, pm_idx(pn->c->w, p)));
+        p = pmr_next_from(&pn->sent_pkts, nr + 1);
     }
+    free(pn->sent_pkts.pm);
+    free(pn->sent_pkts.occ);
+    pn->sent_pkts = (struct pm_ring){0};
 
     diet_free(&pn->recv);
-    diet_free(&pn->recv_all);
-    diet_free(&pn->acked);
+}
+
+
+bool is_dup_nr(const struct pn_space * const pn, const uint64_t nr)
+{
+    if (pn->lg_recv == UINT64_MAX || nr > pn->lg_recv)
+        return false;
+    if (pn->lg_recv - nr >= RX_WIN)
+        // too old to tell
+        return true;
+    return bit_isset(RX_WIN, nr % RX_WIN, &pn->recv_win);
+}
+
+
+void track_recv_nr(struct pn_space * const pn, const uint64_t nr)
+{
+    if (pn->lg_recv != UINT64_MAX && nr != pn->lg_recv + 1)
+        // reordering or loss, which the peer should learn about quickly
+        pn->imm_ack = true;
+
+    if (pn->lg_recv == UINT64_MAX || nr > pn->lg_recv) {
+        // slide the window forward, forgetting what falls out of it
+        if (pn->lg_recv == UINT64_MAX || nr - pn->lg_recv >= RX_WIN)
+            bit_zero(RX_WIN, &pn->recv_win);
+        else
+            for (uint64_t n = pn->lg_recv + 1; n < nr; n++)
+                bit_clr(RX_WIN, n % RX_WIN, &pn->recv_win);
+        pn->lg_recv = nr;
+    }
+    bit_set(RX_WIN, nr % RX_WIN, &pn->recv_win);
 }
@@ -29,39 +29,69 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/param.h>
 
 #include <ev.h>
 #include <warpcore/warpcore.h>
 
+#include "bitset.h"
 #include "diet.h"
 #include "quic.h"
 #include "tls.h"
+#include "wheel.h"
 
 
 struct q_conn;
 struct ev_loop;
 
 
-splay_head(pm_by_nr, pkt_meta);
+/// Ring buffer of sent packets, indexed by packet number modulo @p cap. All
+/// occupied slots hold packet numbers in [@p lo, @p hi). A bitmap of the
+/// occupied slots lets lookups skip over runs of empty ones, e.g., of ACKed
+/// packets, a word at a time.
+///
+struct pm_ring {
+    struct pkt_meta ** pm; ///< Slots.
+    uint64_t * occ;        ///< Occupancy bitmap, one bit per slot.
+    uint64_t lo;           ///< Lowest packet number in the ring.
+    uint64_t hi;           ///< One more than the highest packet number.
+    uint32_t cap;          ///< Number of slots; always a power of two.
+    uint32_t cnt;          ///< Number of occupied slots.
+};
+
+
+#define RX_WIN 1024 ///< Packet numbers covered by duplicate detection.
+
+bitset_define(rx_win, RX_WIN);
 
 
 struct pn_space {
     struct diet recv; ///< Received packet numbers still needing to be ACKed.
-    struct diet recv_all; ///< All received packet numbers.
-    struct diet acked;    ///< Sent packet numbers already ACKed.
+
+    /// Which of the last RX_WIN packet numbers up to @p lg_recv were received,
+    /// indexed by packet number modulo RX_WIN. Anything older than that is
+    /// treated as a duplicate.
+    ///
+    struct rx_win recv_win;
+    uint64_t lg_recv; ///< Largest received packet number.
 
     /// Sent-but-unACKed packets. The @p buf and @p len fields of the w_iov
     /// structs are relative to any stream or crypto data.
     ///
-    struct pm_by_nr sent_pkts; // sent_packets
+    struct pm_ring sent_pkts; // sent_packets
 
     uint64_t lg_sent;            // largest_sent_packet
     uint64_t lg_acked;           // largest_acked_packet
     uint64_t lg_sent_before_rto; // largest_sent_before_rto
+    uint64_t ld_nr; ///< All sent pkts below this are ACKed or lost.
 
-    ev_timer ack_alarm;
+    struct tmr ack_alarm;
     struct q_conn * c;
 
+    uint32_t ack_elicit_cnt; ///< ACK-eliciting pkts RXed since the last ACK.
+    bool imm_ack;            ///< ACK without delay (e.g., after reordering).
+    uint8_t _unused[3];
+
     struct frames rx_frames; ///< Frame types received since last ACK.
 
     uint64_t ect0_cnt;
@@ -90,14 +120,76 @@ struct pn_data_space {
 };
 
 
-static inline int __attribute__((nonnull, always_inline))
-pm_by_nr_cmp(const struct pkt_meta * const a, const struct pkt_meta * const b)
+static inline struct pkt_meta ** __attribute__((nonnull, always_inline))
+pmr_slot(const struct pm_ring * const r, const uint64_t nr)
+{
+    return &r->pm[nr & (r->cap - 1)];
+}
+
+
+static inline struct pkt_meta * __attribute__((nonnull, always_inline))
+pmr_find(const struct pm_ring * const r, const uint64_t nr)
+{
+    return nr >= r->lo && nr < r->hi ? *pmr_slot(r, nr) : 0;
+}
+
+
+static inline struct pkt_meta * __attribute__((nonnull, always_inline))
+pmr_next_from(const struct pm_ring * const r, uint64_t nr)
+{
+    for (nr = MAX(nr, r->lo); nr < r->hi;) {
+        // cap is a multiple of 64, so a bitmap word never wraps
+        const uint64_t i = nr & (r->cap - 1);
+        const uint64_t occ = r->occ[i / 64] >> (i % 64);
+        if (occ) {
+            // a set bit at or above hi belongs to a wrapped-around pkt
+            nr += (uint64_t)__builtin_ctzll(occ);
+            return nr < r->hi ? *pmr_slot(r, nr) : 0;
+        }
+        nr += 64 - i % 64;
+    }
+    return 0;
+}
+
+
+static inline struct pkt_meta * __attribute__((nonnull, always_inline))
+pmr_prev_from(const struct pm_ring * const r, uint64_t nr)
 {
-    return (a->hdr.nr > b->hdr.nr) - (a->hdr.nr < b->hdr.nr);
+    if (r->cnt == 0)
+        return 0;
+    for (nr = MIN(nr, r->hi - 1); nr >= r->lo;) {
+        const uint64_t i = nr & (r->cap - 1);
+        const uint64_t occ = r->occ[i / 64] << (63 - i % 64);
+        if (occ) {
+            const uint64_t d = (uint64_t)__builtin_clzll(occ);
+            return nr >= r->lo + d ? *pmr_slot(r, nr - d) : 0;
+        }
+        if (nr < r->lo + i % 64 + 1)
+            break;
+        nr -= i % 64 + 1;
+    }
+    return 0;
 }
 
 
-SPLAY_PROTOTYPE(pm_by_nr, pkt_meta, nr_node, pm_by_nr_cmp)
+#define pmr_min(r) pmr_next_from((r), (r)->lo)
+#define pmr_max(r) pmr_prev_from((r), (r)->hi - 1)
+#define pmr_next(r, p) pmr_next_from((r), (p)->hdr.nr + 1)
+#define pmr_prev(r, p) pmr_prev_from((r), (p)->hdr.nr - 1)
+#define pmr_empty(r) ((r)->cnt == 0)
+
+#define pmr_foreach(p, r)                                                      \
+    for ((p) = pmr_min(r); (p); (p) = pmr_next((r), (p)))
+
+#define pmr_foreach_rev(p, r)                                                  \
+    for ((p) = pmr_max(r); (p); (p) = pmr_prev((r), (p)))
+
+
+extern void __attribute__((nonnull))
+pmr_insert(struct pm_ring * const r, struct pkt_meta * const p);
+
+extern bool __attribute__((nonnull))
+pmr_remove(struct pm_ring * const r, const struct pkt_meta * const p);
 
 
 extern void __attribute__((nonnull))
@@ -107,13 +199,25 @@ extern void __attribute__((nonnull)) free_pn(struct pn_space * const pn);
 
 extern void __attribute__((nonnull)) reset_pn(struct pn_space * const pn);
 
+extern void __attribute__((nonnull)) ack_alarm(struct tmr * const t);
+
+extern bool __attribute__((nonnull))
+is_dup_nr(const struct pn_space * const pn, const uint64_t nr);
+
 extern void __attribute__((nonnull))
-ack_alarm(struct ev_loop * const l, ev_timer * const w, int e);
+track_recv_nr(struct pn_space * const pn, const uint64_t nr);
+
+
+/// Whether ACK-eliciting pkts were received in @p pn since the last ACK.
+static inline bool __attribute__((nonnull, always_inline))
+has_unacked_rx(const struct pn_space * const pn)
+{
+    return !diet_empty(&pn->recv) && !is_ack_or_padding_only(&pn->rx_frames);
+}
 
 
 static inline bool __attribute__((nonnull, always_inline))
 needs_ack(struct pn_space * const pn)
 {
-    return !diet_empty(&pn->recv) && !is_ack_or_padding_only(&pn->rx_frames) &&
-           ev_is_active(&pn->ack_alarm);
+    return has_unacked_rx(pn) && tmr_active(&pn->ack_alarm);
 }
@@ -27,6 +27,7 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -67,8 +68,6 @@ struct ev_loop;
 
 SPLAY_GENERATE(ooo_by_off, pkt_meta, off_node, ooo_by_off_cmp)
 
-// TODO: many of these globals should move to a per-engine struct
-
 
 /// QUIC version supported by this implementation in order of preference.
 const uint32_t ok_vers[] = {
@@ -84,52 +83,62 @@ const uint32_t ok_vers[] = {
 const uint8_t ok_vers_len = sizeof(ok_vers) / sizeof(ok_vers[0]);
 
 
-struct pkt_meta * pm = 0;
-struct ev_loop * loop = 0;
-
-func_ptr api_func = 0;
-void *api_conn = 0, *api_strm = 0;
-
-struct q_conn_sl accept_queue = sl_head_initializer(accept_queue);
-
 static const uint32_t nbufs = 100000; ///< Number of packet buffers to allocate.
 
-static ev_timer api_alarm;
+/// The engine that uses the default event loop (which handles signals), if
+/// any. Engines may be created and cleaned up on different threads.
+static struct q_engine * dflt_loop_qe;
+static pthread_mutex_t dflt_loop_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
-#if !defined(NDEBUG) && !defined(FUZZING) &&                                   \
-    !defined(NO_FUZZER_CORPUS_COLLECTION)
-int corpus_pkt_dir, corpus_frm_dir;
-#endif
-
-
-/// Run the event loop for the API function @p func with connection @p conn and
-/// (optionally, if non-zero) stream @p strm.
+/// Run the event loop of engine @p e for the API function @p func with
+/// connection @p conn and (optionally, if non-zero) stream @p strm.
 ///
+/// @param      e     The q_engine whose event loop should be run.
 /// @param      func  The API function to run the event loop for.
 /// @param      conn  The connection to run the event loop for.
 /// @param      strm  The stream to run the event loop for.
 ///
-#define loop_run(func, conn, strm)                                             \
+#define loop_run(e, func, conn, strm)                                          \
     do {                                                                       \
-        EV_VERIFY(loop);                                                       \
-        ensure(api_func == 0, "other API call active");                        \
-        api_func = (func_ptr)(&(func));                                        \
-        api_conn = (conn);                                                     \
-        api_strm = (strm);                                                     \
+        struct q_engine * const _e = (e);                                      \
+        EV_VERIFY(_e->loop);                                                   \
+        ensure(_e->api_func == 0, "other API call active");                    \
+        _e->api_func = (func_ptr)(&(func));                                    \
+        _e->api_conn = (conn);                                                 \
+        _e->api_strm = (strm);                                                 \
         /* warn(DBG, #func "(" #conn ", " #strm ") entering event loop"); */   \
-        ev_run(loop, 0);                                                       \
-        api_func = 0;                                                          \
-        api_conn = api_strm = 0;                                               \
+        ev_run(_e->loop, 0);                                                   \
+        tx_flush(_e);                                                          \
+        _e->api_func = 0;                                                      \
+        _e->api_conn = _e->api_strm = 0;                                       \
     } while (0)
 
 
-void pm_free(struct pkt_meta * const m)
+/// Detach the stream frames that pkt @p m carried for other streams, and mark
+/// them lost, so that their streams RTX them in pkts of their own.
+///
+/// @param      m     Packet meta-data of the carrier.
+///
+void lose_carried(struct pkt_meta * const m)
 {
-    if (m->pn && m->tx_len && m->is_acked == false) {
-        ensure(splay_remove(pm_by_nr, &m->pn->sent_pkts, m), "removed");
-        diet_insert(&m->pn->acked, m->hdr.nr, ev_now(loop));
+    while (!sl_empty(&m->carried)) {
+        struct pkt_meta * const cm = sl_first(&m->carried);
+        sl_remove_head(&m->carried, carried_next);
+        cm->carrier = 0;
+        cm->is_lost = true;
     }
+}
+
+
+void pm_free(struct pkt_meta * const m)
+{
+    if (m->pn && m->tx_len && m->is_acked == false)
+        ensure(pmr_remove(&m->pn->sent_pkts, m), "removed");
+
+    if (m->carrier)
+        sl_remove(&m->carrier->carried, m, pkt_meta, carried_next);
+    lose_carried(m);
 
     if (m->is_rtx)
         return;
@@ -140,11 +149,11 @@ void pm_free(struct pkt_meta * const m)
         ensure(rm->is_rtx, "is an RTX");
         sl_remove_head(&m->rtx, rtx_next);
         struct pkt_meta * const next_rm = sl_next(rm, rtx_next);
-        if (rm->is_acked == false) {
-            ensure(splay_remove(pm_by_nr, &rm->pn->sent_pkts, rm), "removed");
-            diet_insert(&rm->pn->acked, rm->hdr.nr, ev_now(loop));
-        }
-        w_free_iov(w_iov(rm->pn->c->w, pm_idx(rm)));
+        struct w_engine * const w = rm->pn->c->w;
+        if (rm->is_acked == false)
+            ensure(pmr_remove(&rm->pn->sent_pkts, rm), "removed");
+        lose_carried(rm);
+        w_free_iov(w_iov(w, pm_idx(w, rm)));
         memset(rm, 0, sizeof(*rm));
         ASAN_POISON_MEMORY_REGION(rm, sizeof(*rm));
         rm = next_rm;
@@ -155,9 +164,10 @@ void pm_free(struct pkt_meta * const m)
 void alloc_off(struct w_engine * const w,
                struct w_iov_sq * const q,
                const uint32_t len,
+               const uint16_t pkt_len,
                const uint16_t off)
 {
-    w_alloc_len(w, q, len, MAX_PKT_LEN - AEAD_LEN - off, off);
+    w_alloc_len(w, q, len, (uint16_t)(pkt_len - AEAD_LEN - off), off);
     struct w_iov * v = 0;
     sq_foreach (v, q, next) {
         ASAN_UNPOISON_MEMORY_REGION(&meta(v), sizeof(meta(v)));
@@ -168,12 +178,21 @@ void alloc_off(struct w_engine * const w,
 }
 
 
-void q_alloc(struct w_engine * const w,
+void q_alloc(struct q_engine * const qe,
              struct w_iov_sq * const q,
              const size_t len)
 {
     ensure(len <= UINT32_MAX, "len %u too long", len);
-    alloc_off(w, q, (uint32_t)len, OFFSET_ESTB);
+    alloc_off(qe->w, q, (uint32_t)len, MAX_PKT_LEN, OFFSET_ESTB);
+}
+
+
+void q_alloc_stream(const struct q_stream * const s,
+                    struct w_iov_sq * const q,
+                    const size_t len)
+{
+    ensure(len <= UINT32_MAX, "len %u too long", len);
+    alloc_off(s->c->w, q, (uint32_t)len, s->c->pmtu, OFFSET_ESTB);
 }
 
 
@@ -189,18 +208,19 @@ void q_free(struct w_iov_sq * const q)
 }
 
 
-struct q_conn * q_connect(struct w_engine * const w,
-                          const struct sockaddr_in * const peer,
-                          const char * const peer_name,
-                          struct w_iov_sq * const early_data,
-                          struct q_stream ** const early_data_stream,
-                          const bool fin,
-                          const uint64_t idle_timeout)
+static struct q_conn * __attribute__((nonnull(1, 2, 3)))
+start_connect(struct q_engine * const qe,
+              const struct sockaddr_in * const peer,
+              const char * const peer_name,
+              struct w_iov_sq * const early_data,
+              struct q_stream ** const early_data_stream,
+              const bool fin,
+              const uint64_t idle_timeout)
 {
     // make new connection
     const uint vers = ok_vers[0];
     struct q_conn * const c =
-        new_conn(w, vers, 0, 0, peer, peer_name, 0, idle_timeout);
+        new_conn(qe->w, vers, 0, 0, peer, peer_name, 0, idle_timeout);
 
     // init TLS
     init_tls(c);
@@ -212,7 +232,7 @@ struct q_conn * q_connect(struct w_engine * const w,
          early_data ? w_iov_sq_len(early_data) : 0,
          plural(early_data ? w_iov_sq_len(early_data) : 0));
 
-    ev_timer_again(loop, &c->idle_alarm);
+    touch_idle(c);
     w_connect(c->sock, peer->sin_addr.s_addr, peer->sin_port);
 
     // start TLS handshake
@@ -229,13 +249,28 @@ struct q_conn * q_connect(struct w_engine * const w,
                                                                    : strm_hclo);
     }
 
-    ev_async_send(loop, &c->tx_w);
+    ev_async_send(qe->loop, &c->tx_w);
+    conn_to_state(c, conn_opng);
+    return c;
+}
+
+
+struct q_conn * q_connect(struct q_engine * const qe,
+                          const struct sockaddr_in * const peer,
+                          const char * const peer_name,
+                          struct w_iov_sq * const early_data,
+                          struct q_stream ** const early_data_stream,
+                          const bool fin,
+                          const uint64_t idle_timeout)
+{
+    struct q_conn * const c = start_connect(qe, peer, peer_name, early_data,
+                                            early_data_stream, fin,
+                                            idle_timeout);
 
     warn(DBG, "waiting for connect to complete on %s conn %s to %s:%u",
          conn_type(c), cid2str(c->scid), inet_ntoa(peer->sin_addr),
          ntohs(peer->sin_port));
-    conn_to_state(c, conn_opng);
-    loop_run(q_connect, c, 0);
+    loop_run(qe, q_connect, c, 0);
 
     if (c->state != conn_estb) {
         warn(WRN, "%s conn %s not connected", conn_type(c), cid2str(c->scid));
@@ -249,16 +284,32 @@ struct q_conn * q_connect(struct w_engine * const w,
     // if (c->try_0rtt == true && c->did_0rtt == false) {
     //     // 0-RTT failed, RTX early data straight away
     //     reset_stream(*early_data_stream, false);
-    //     ev_async_send(loop, &c->tx_w);
+    //     ev_async_send(qe->loop, &c->tx_w);
     // }
 
     return c;
 }
 
 
-bool q_write(struct q_stream * const s,
-             struct w_iov_sq * const q,
-             const bool fin)
+struct q_conn * q_connect_async(struct q_engine * const qe,
+                                const struct sockaddr_in * const peer,
+                                const char * const peer_name,
+                                struct w_iov_sq * const early_data,
+                                struct q_stream ** const early_data_stream,
+                                const bool fin,
+                                const uint64_t idle_timeout)
+{
+    // the on_conn_ready or on_conn_closed callback reports how this went
+    return start_connect(qe, peer, peer_name, early_data, early_data_stream,
+                         fin, idle_timeout);
+}
+
+
+static bool __attribute__((nonnull))
+queue_write(struct q_stream * const s,
+            struct w_iov_sq * const q,
+            const bool fin,
+            const bool owned)
 {
     struct q_conn * const c = s->c;
     if (unlikely(c->state == conn_qlse || c->state == conn_drng ||
@@ -280,17 +331,91 @@ bool q_write(struct q_stream * const s,
         return false;
     }
 
+    if (owned) {
+        // the stream frees these once they are ACKed
+        struct w_iov * v;
+        sq_foreach (v, q, next)
+            meta(v).is_owned = true;
+        // the caller can't look at these anymore, so small ones can be merged
+        pack_out(s, q);
+    }
+
     // add to stream
     concat_out(s, q);
     if (fin)
         strm_to_state(s, s->state == strm_hcrm ? strm_clsd : strm_hclo);
 
     // kick TX watcher
-    ev_async_send(loop, &s->c->tx_w);
-    loop_run(q_write, s->c, s);
+    ev_async_send(ped(c->w)->loop, &c->tx_w);
+    return true;
+}
+
+
+bool q_write_async(struct q_stream * const s,
+                   struct w_iov_sq * const q,
+                   const bool fin)
+{
+    return queue_write(s, q, fin, true);
+}
+
+
+static void __attribute__((nonnull))
+copy_data(struct w_iov_sq * const dst, const struct w_iov_sq * const src)
+{
+    // the chunking of dst and src may differ
+    struct w_iov * d = sq_first(dst);
+    uint32_t d_off = 0;
+    const struct w_iov * v;
+    sq_foreach (v, src, next) {
+        uint32_t off = 0;
+        while (off < v->len) {
+            const uint32_t n = MIN(v->len - off, d->len - d_off);
+            memcpy(&d->buf[d_off], &v->buf[off], n);
+            off += n;
+            d_off += n;
+            if (d_off == d->len) {
+                d = sq_next(d, next);
+                d_off = 0;
+            }
+        }
+    }
+}
+
+
+bool q_write(struct q_stream * const s,
+             struct w_iov_sq * const q,
+             const bool fin)
+{
+    const uint32_t qlen = w_iov_sq_len(q);
+    const uint64_t qcnt = w_iov_sq_cnt(q);
+
+    if (s->corked) {
+        // copy into buffers the stream owns, and don't wait for the ACKs
+        struct w_iov_sq o = w_iov_sq_initializer(o);
+        q_alloc_stream(s, &o, qlen);
+        if (w_iov_sq_len(&o) == qlen) {
+            copy_data(&o, q);
+            if (queue_write(s, &o, fin, true))
+                return true;
+        }
+        q_free(&o);
+        return false;
+    }
+    if (queue_write(s, q, fin, false) == false)
+        return false;
 
-    // move data back
-    sq_concat(q, &s->out);
+    struct q_conn * const c = s->c;
+    loop_run(ped(c->w), q_write, c, s);
+
+    // move data back, except for buffers the stream owns
+    while (!sq_empty(&s->out)) {
+        struct w_iov * const v = sq_first(&s->out);
+        sq_remove_head(&s->out, next);
+        if (meta(v).is_owned)
+            free_iov(v);
+        else
+            sq_insert_tail(q, v, next);
+    }
 
     warn(WRN, "wrote %u byte%s on %s conn %s strm " FMT_SID " %s", qlen,
          plural(qlen), conn_type(c), cid2str(c->scid), s->id,
@@ -306,6 +431,26 @@ bool q_write(struct q_stream * const s,
 }
 
 
+/// Move the data queued on stream @p s to @p q, and extend the receive windows
+/// of the stream and its connection by what the app read.
+///
+/// @param      s     Stream.
+/// @param      q     Queue to append the data to.
+///
+static void __attribute__((nonnull))
+read_stream(struct q_stream * const s, struct w_iov_sq * const q)
+{
+    struct q_conn * const c = s->c;
+    track_bytes_read(s, w_iov_sq_len(&s->in));
+    sq_concat(q, &s->in);
+
+    do_stream_fc(s);
+    do_conn_fc(c);
+    if (c->needs_tx)
+        ev_async_send(ped(c->w)->loop, &c->tx_w);
+}
+
+
 struct q_stream *
 q_read(struct q_conn * const c, struct w_iov_sq * const q, const bool block)
 {
@@ -318,23 +463,29 @@ q_read(struct q_conn * const c, struct w_iov_sq * const q, const bool block)
 again:;
     struct q_stream * s = 0;
     if (c->state == conn_estb) {
-        kh_foreach (s, c->streams_by_id)
+        while (!sq_empty(&c->strms_rx)) {
+            s = sq_first(&c->strms_rx);
+            sq_remove_head(&c->strms_rx, next_rx);
+            s->in_rxq = false;
             if (!sq_empty(&s->in) && s->state != strm_clsd)
                 // we found a stream with queued data
                 break;
+            // data was already consumed by q_readall_str()
+            s = 0;
+        }
 
         if (s == 0 && block) {
             // no data queued on any stream, wait for new data
             warn(WRN, "waiting for data on any stream on %s conn %s",
                  conn_type(c), cid2str(c->scid));
-            loop_run(q_read, c, 0);
+            loop_run(ped(c->w), q_read, c, 0);
             goto again;
         }
     }
 
     // return data
     if (s) {
-        sq_concat(q, &s->in);
+        read_stream(s, q);
         warn(WRN, "read %u byte%s on %s conn %s strm " FMT_SID, w_iov_sq_len(q),
              plural(w_iov_sq_len(q)), conn_type(c), cid2str(c->scid), s->id);
     }
@@ -350,43 +501,66 @@ void q_readall_str(struct q_stream * const s, struct w_iov_sq * const q)
            s->state != strm_clsd) {
         warn(WRN, "reading all on %s conn %s strm " FMT_SID, conn_type(c),
              cid2str(c->scid), s->id);
-        loop_run(q_readall_str, c, s);
+        // take what arrived so far, so the receive windows keep sliding
+        read_stream(s, q);
+        loop_run(ped(c->w), q_readall_str, c, s);
     }
 
     // return data
-    sq_concat(q, &s->in);
+    read_stream(s, q);
     warn(WRN, "read %u byte%s on %s conn %s strm " FMT_SID, w_iov_sq_len(q),
          plural(w_iov_sq_len(q)), conn_type(c), cid2str(c->scid), s->id);
 }
 
 
-struct q_conn * q_bind(struct w_engine * const w, const uint16_t port)
+struct q_conn * q_bind(struct q_engine * const qe, const uint16_t port)
 {
     // bind socket and create new embryonic server connection
     warn(DBG, "binding serv socket on port %u", port);
-    struct q_conn * const c = new_conn(w, 0, 0, 0, 0, 0, port, 0);
+    struct q_conn * const c = new_conn(qe->w, 0, 0, 0, 0, 0, port, 0);
     warn(WRN, "bound %s socket on port %u", conn_type(c), port);
     return c;
 }
 
 
 static void __attribute__((nonnull))
-cancel_api_call(struct ev_loop * const l __attribute__((unused)),
-                ev_timer * const w __attribute__((unused)),
+cancel_api_call(struct ev_loop * const l,
+                ev_timer * const w,
                 int e __attribute__((unused)))
 {
+    struct q_engine * const qe = w->data;
     warn(DBG, "canceling API call");
-    ev_timer_stop(loop, &api_alarm);
-    maybe_api_return(q_accept, 0, 0);
-    maybe_api_return(q_rx_ready, 0, 0);
+    ev_timer_stop(l, &qe->api_alarm);
+    maybe_api_return(qe, q_accept, 0, 0);
+    maybe_api_return(qe, q_rx_ready, 0, 0);
+}
+
+
+static void __attribute__((nonnull))
+run_alarm(struct ev_loop * const l __attribute__((unused)),
+          ev_timer * const w __attribute__((unused)),
+          int e __attribute__((unused)))
+{
+    // nothing to do; the only purpose of this timer is to end q_run_once()
+}
+
+
+static void __attribute__((nonnull))
+arm_api_alarm(struct q_engine * const qe, const uint64_t timeout)
+{
+    if (ev_is_active(&qe->api_alarm))
+        ev_timer_stop(qe->loop, &qe->api_alarm);
+    ev_timer_init(&qe->api_alarm, cancel_api_call, timeout, 0);
+    qe->api_alarm.data = qe;
+    ev_timer_start(qe->loop, &qe->api_alarm);
 }
 
 
-struct q_conn * q_accept(const uint64_t timeout)
+struct q_conn * q_accept(struct q_engine * const qe, const uint64_t timeout)
 {
-    if (sl_first(&accept_queue)) {
-        struct q_conn * const c = sl_first(&accept_queue);
-        sl_remove_head(&accept_queue, node_aq);
+    if (sl_first(&qe->accept_queue)) {
+        struct q_conn * const c = sl_first(&qe->accept_queue);
+        sl_remove_head(&qe->accept_queue, node_aq);
         warn(WRN, "accepting queued %s conn %s", conn_type(c),
              cid2str(c->scid));
         return c;
@@ -395,23 +569,19 @@ struct q_conn * q_accept(const uint64_t timeout)
     warn(WRN, "waiting for conn on any serv sock (timeout %" PRIu64 " sec)",
          timeout);
 
-    if (timeout) {
-        if (ev_is_active(&api_alarm))
-            ev_timer_stop(loop, &api_alarm);
-        ev_timer_init(&api_alarm, cancel_api_call, timeout, 0);
-        ev_timer_start(loop, &api_alarm);
-    }
+    if (timeout)
+        arm_api_alarm(qe, timeout);
 
-    loop_run(q_accept, 0, 0);
+    loop_run(qe, q_accept, 0, 0);
 
-    if (sl_empty(&accept_queue)) {
+    if (sl_empty(&qe->accept_queue)) {
         warn(ERR, "conn not accepted");
         return 0;
     }
 
-    struct q_conn * const c = sl_first(&accept_queue);
-    sl_remove_head(&accept_queue, node_aq);
-    ev_timer_again(loop, &c->idle_alarm);
+    struct q_conn * const c = sl_first(&qe->accept_queue);
+    sl_remove_head(&qe->accept_queue, node_aq);
+    touch_idle(c);
 
     warn(WRN, "%s conn %s accepted from clnt %s:%u%s, cipher %s", conn_type(c),
          cid2str(c->scid), inet_ntoa(c->peer.sin_addr), ntohs(c->peer.sin_port),
@@ -440,7 +610,7 @@ struct q_stream * q_rsv_stream(struct q_conn * const c, const bool bidi)
         else
             c->sid_blocked_uni = true;
         // c->needs_tx = true;
-        loop_run(q_rsv_stream, c, 0);
+        loop_run(ped(c->w), q_rsv_stream, c, 0);
     }
 
     return new_stream(c, *next_sid);
@@ -453,8 +623,9 @@ signal_cb(struct ev_loop * l,
           ev_signal * w,
           int revents __attribute__((unused)))
 {
+    struct q_engine * const qe = w->data;
     ev_break(l, EVBREAK_ALL);
-    w_cleanup(w->data);
+    w_cleanup(qe->w);
     exit(0);
 }
 #endif
@@ -474,7 +645,7 @@ mk_or_open_dir(const char * const path, mode_t mode)
 #endif
 
 
-struct w_engine * q_init(const char * const ifname,
+struct q_engine * q_init(const char * const ifname,
                          const char * const cert,
                          const char * const key,
                          const char * const cache,
@@ -487,19 +658,57 @@ struct w_engine * q_init(const char * const ifname,
     //        "%s version %s not compatible with %s version %s", quant_name,
     //        quant_version, warpcore_name, warpcore_version);
 
+    struct q_engine * const qe = calloc(1, sizeof(*qe));
+    ensure(qe, "could not calloc");
+
     // init connection structures
-    conns_by_ipnp = kh_init(conns_by_ipnp);
-    conns_by_id = kh_init(conns_by_id);
+    qe->conns_by_ipnp = kh_init(conns_by_ipnp);
+    qe->conns_by_id = kh_init(conns_by_id);
+    sl_init(&qe->accept_queue);
+    sl_init(&qe->c_ready);
+    splay_init(&qe->ooo_0rtt_by_cid);
+    sq_init(&qe->steer_q);
+    sq_init(&qe->relay_q);
+    ensure(pthread_mutex_init(&qe->steer_lock, 0) == 0, "pthread_mutex_init");
+    ev_async_init(&qe->steer_w, rx_steered);
+    qe->steer_w.data = qe;
+    ev_init(&qe->run_alarm, run_alarm);
+    sl_init(&qe->tx_pend);
+    sq_init(&qe->delay_q);
+    ev_init(&qe->delay_alarm, tx_delay_alarm);
+    qe->delay_alarm.data = qe;
+    qe->rx_budget = DEF_RX_BUDGET;
+    qe->ack_thresh = kAckThresh;
+    qe->ack_del = kDelayedAckTimeout;
+    qe->fc_budget = DEF_FC_BUDGET;
+    qe->max_bidi_streams = INIT_MAX_BIDI_STREAMS;
+    qe->max_uni_streams = INIT_MAX_UNI_STREAMS;
+    ev_prepare_init(&qe->tx_prep_w, tx_prepare);
+    qe->tx_prep_w.data = qe;
 
     // initialize warpcore on the given interface
-    struct w_engine * const w = w_init(ifname, 0, nbufs);
-    pm = calloc(nbufs + 1, sizeof(*pm));
-    ensure(pm, "could not calloc");
-    ASAN_POISON_MEMORY_REGION(pm, (nbufs + 1) * sizeof(*pm));
-
-    // initialize the event loop (prefer kqueue and epoll)
-    loop = ev_default_loop(ev_recommended_backends() | EVBACKEND_KQUEUE |
-                           EVBACKEND_EPOLL);
+    struct w_engine * const w = qe->w = w_init(ifname, 0, nbufs);
+    w->data = qe;
+    qe->pm = calloc(nbufs + 1, sizeof(*qe->pm));
+    ensure(qe->pm, "could not calloc");
+    ASAN_POISON_MEMORY_REGION(qe->pm, (nbufs + 1) * sizeof(*qe->pm));
+
+    // initialize the event loop (prefer kqueue and epoll); the first engine
+    // gets the default loop (which handles signals), all others a new one
+    const unsigned int ev_flags =
+        ev_recommended_backends() | EVBACKEND_KQUEUE | EVBACKEND_EPOLL;
+    pthread_mutex_lock(&dflt_loop_lock);
+    const bool is_default_loop = dflt_loop_qe == 0;
+    qe->loop =
+        is_default_loop ? ev_default_loop(ev_flags) : ev_loop_new(ev_flags);
+    ensure(qe->loop, "could not create event loop");
+    if (is_default_loop)
+        dflt_loop_qe = qe;
+    pthread_mutex_unlock(&dflt_loop_lock);
+    whl_init(&qe->whl, qe->loop);
+    ev_prepare_start(qe->loop, &qe->tx_prep_w);
+    // don't let the TX flush watcher keep the loop alive
+    ev_unref(qe->loop);
 
 #ifndef NDEBUG
     static const char * ev_backend_str[] = {
@@ -510,20 +719,22 @@ struct w_engine * q_init(const char * const ifname,
 
     warn(INF, "%s/%s %s/%s with libev/%s %u.%u ready", quant_name,
          w->backend_name, quant_version, QUANT_COMMIT_HASH_ABBREV_STR,
-         ev_backend_str[ev_backend(loop)], ev_version_major(),
+         ev_backend_str[ev_backend(qe->loop)], ev_version_major(),
          ev_version_minor());
     warn(INF, "submit bug reports at https://github.com/NTAP/quant/issues");
 
     // initialize TLS context
-    init_tls_ctx(cert, key, cache, tls_log, verify_certs, flip_keys);
+    init_tls_ctx(&qe->tls_ctx, cert, key, cache, tls_log, verify_certs,
+                 flip_keys);
 
 #ifndef FUZZING
-    // libev seems to need this inside docker to handle Ctrl-C?
-    /// but the fuzzer doesn't like it
-    static ev_signal signal_w;
-    signal_w.data = w;
-    ev_signal_init(&signal_w, signal_cb, SIGINT);
-    ev_signal_start(loop, &signal_w);
+    if (is_default_loop) {
+        // libev seems to need this inside docker to handle Ctrl-C?
+        /// but the fuzzer doesn't like it
+        qe->signal_w.data = qe;
+        ev_signal_init(&qe->signal_w, signal_cb, SIGINT);
+        ev_signal_start(qe->loop, &qe->signal_w);
+    }
 #endif
 
 #if !defined(NDEBUG) && !defined(NO_FUZZER_CORPUS_COLLECTION)
@@ -532,12 +743,12 @@ struct w_engine * q_init(const char * const ifname,
 #else
     // create the directories for exporting fuzzer corpus data
     warn(NTE, "debug build, storing fuzzer corpus data");
-    corpus_pkt_dir = mk_or_open_dir("../corpus_pkt", 0755);
-    corpus_frm_dir = mk_or_open_dir("../corpus_frm", 0755);
+    qe->corpus_pkt_dir = mk_or_open_dir("../corpus_pkt", 0755);
+    qe->corpus_frm_dir = mk_or_open_dir("../corpus_frm", 0755);
 #endif
 #endif
 
-    return w;
+    return qe;
 }
 
 
@@ -552,9 +763,10 @@ void q_close_stream(struct q_stream * const s)
             if (is_fin(last) == false) {
                 strm_to_state(s, s->state == strm_hcrm ? strm_clsd : strm_hclo);
                 s->tx_fin = true;
+                sched_stream_ctrl(s);
             }
-            ev_async_send(loop, &c->tx_w);
-            loop_run(q_close_stream, c, s);
+            ev_async_send(ped(c->w)->loop, &c->tx_w);
+            loop_run(ped(c->w), q_close_stream, c, s);
         }
     }
 
@@ -575,56 +787,94 @@ void q_close(struct q_conn * const c)
 
     if (c->state != conn_drng) {
         conn_to_state(c, conn_qlse);
-        ev_async_send(loop, &c->tx_w);
+        ev_async_send(ped(c->w)->loop, &c->tx_w);
     }
 
-    loop_run(q_close, c, 0);
+    loop_run(ped(c->w), q_close, c, 0);
 
 done:
     free_conn(c);
 }
 
 
-void q_cleanup(struct w_engine * const w)
+void q_cleanup(struct q_engine * const qe)
 {
     // close all connections
     struct q_conn * c;
-    kh_foreach (c, conns_by_id)
+    kh_foreach (c, qe->conns_by_id)
         q_close(c);
-    kh_foreach (c, conns_by_ipnp)
+    kh_foreach (c, qe->conns_by_ipnp)
         q_close(c);
 
-    // stop the event loop
-    ev_loop_destroy(loop);
+    tx_flush(qe);
+    tx_flush_delayed(qe, 0);
+    ev_timer_stop(qe->loop, &qe->delay_alarm);
+    ev_ref(qe->loop);
+    ev_prepare_stop(qe->loop, &qe->tx_prep_w);
+    warn(INF,
+         "handed %" PRIu64 " datagram%s to %" PRIu64
+         " w_tx() call%s (%.1f/call)",
+         qe->tx_dgrams, plural(qe->tx_dgrams), qe->tx_w_calls,
+         plural(qe->tx_w_calls),
+         qe->tx_w_calls ? (double)qe->tx_dgrams / qe->tx_w_calls : 0);
+    warn(INF,
+         "got %" PRIu64 " datagram%s from %" PRIu64
+         " w_rx() call%s (%.1f/call)",
+         qe->rx_dgrams, plural(qe->rx_dgrams), qe->rx_w_calls,
+         plural(qe->rx_w_calls),
+         qe->rx_w_calls ? (double)qe->rx_dgrams / qe->rx_w_calls : 0);
+    warn(INF,
+         "%" PRIu64 " slow start%s ended by HyStart++, %" PRIu64 " by loss",
+         qe->ss_exits_delay, plural(qe->ss_exits_delay), qe->ss_exits_loss);
+
+    // drop any packets other workers steered or relayed to us
+    ev_async_stop(qe->loop, &qe->steer_w);
+    sq_concat(&qe->steer_q, &qe->relay_q);
+    while (!sq_empty(&qe->steer_q)) {
+        struct q_steered * const p = sq_first(&qe->steer_q);
+        sq_remove_head(&qe->steer_q, next);
+        free(p);
+    }
+    pthread_mutex_destroy(&qe->steer_lock);
+
+    // stop the event loop; the next engine may then use the default loop
+    whl_free(&qe->whl);
+    pthread_mutex_lock(&dflt_loop_lock);
+    ev_loop_destroy(qe->loop);
+    if (dflt_loop_qe == qe)
+        dflt_loop_qe = 0;
+    pthread_mutex_unlock(&dflt_loop_lock);
 
-    free_tls_ctx();
+    free_tls_ctx(&qe->tls_ctx);
 
     // free 0-RTT reordering cache
-    while (!splay_empty(&ooo_0rtt_by_cid)) {
+    while (!splay_empty(&qe->ooo_0rtt_by_cid)) {
         struct ooo_0rtt * const zo =
-            splay_min(ooo_0rtt_by_cid, &ooo_0rtt_by_cid);
-        ensure(splay_remove(ooo_0rtt_by_cid, &ooo_0rtt_by_cid, zo), "removed");
+            splay_min(ooo_0rtt_by_cid, &qe->ooo_0rtt_by_cid);
+        ensure(splay_remove(ooo_0rtt_by_cid, &qe->ooo_0rtt_by_cid, zo),
+               "removed");
         free(zo);
     }
 
     for (uint32_t i = 0; i <= nbufs; i++) {
-        ASAN_UNPOISON_MEMORY_REGION(&pm[i], sizeof(pm[i]));
-        if (pm[i].hdr.nr)
+        ASAN_UNPOISON_MEMORY_REGION(&qe->pm[i], sizeof(qe->pm[i]));
+        if (qe->pm[i].hdr.nr)
             warn(DBG, "buffer %u still in use for pkt %" PRIu64, i,
-                 pm[i].hdr.nr);
+                 qe->pm[i].hdr.nr);
     }
 
-    kh_destroy(conns_by_id, conns_by_id);
-    kh_destroy(conns_by_ipnp, conns_by_ipnp);
-
-    free(pm);
-    w_cleanup(w);
+    kh_destroy(conns_by_id, qe->conns_by_id);
+    kh_destroy(conns_by_ipnp, qe->conns_by_ipnp);
 
 #if !defined(NDEBUG) && !defined(FUZZING) &&                                   \
     !defined(NO_FUZZER_CORPUS_COLLECTION)
-    close(corpus_pkt_dir);
-    close(corpus_frm_dir);
+    close(qe->corpus_pkt_dir);
+    close(qe->corpus_frm_dir);
 #endif
+
+    free(qe->pm);
+    w_cleanup(qe->w);
+    free(qe);
 }
 
 
@@ -640,6 +890,121 @@ uint64_t q_sid(const struct q_stream * const s)
 }
 
 
+void q_set_scheduler(struct q_conn * const c, const q_sched_t sched)
+{
+    c->sched = sched;
+}
+
+
+void q_set_cc(struct q_conn * const c, const q_cc_t cc)
+{
+    set_cc(c, cc);
+}
+
+
+void q_set_default_cc(struct q_engine * const qe, const q_cc_t cc)
+{
+    qe->cc = (uint8_t)cc;
+}
+
+
+void q_engine_stats(const struct q_engine * const qe,
+                    struct q_engine_stats * const st)
+{
+    *st = (struct q_engine_stats){.tx_dgrams = qe->tx_dgrams,
+                                  .tx_w_calls = qe->tx_w_calls,
+                                  .rx_dgrams = qe->rx_dgrams,
+                                  .rx_w_calls = qe->rx_w_calls,
+                                  .ss_exits_delay = qe->ss_exits_delay,
+                                  .ss_exits_loss = qe->ss_exits_loss};
+}
+
+
+void q_conn_stats(const struct q_conn * const c, struct q_conn_stats * const st)
+{
+    *st = (struct q_conn_stats){.pkts_lost = c->rec.lost_cnt,
+                                .pkts_spurious = c->rec.spurious_cnt,
+                                .rec_undone = c->rec.undo_cnt};
+}
+
+
+void q_set_default_ack_freq(struct q_engine * const qe,
+                            const uint16_t pkts,
+                            const double delay)
+{
+    qe->ack_thresh = (uint16_t)MAX(pkts, 1);
+    qe->ack_del = MIN(MAX(delay, kMinAckDelay), UINT8_MAX / 1000.0);
+}
+
+
+void q_set_fc_budget(struct q_engine * const qe, const uint64_t budget)
+{
+    qe->fc_budget = budget;
+}
+
+
+void q_set_init_streams(struct q_engine * const qe,
+                        const uint16_t bidi,
+                        const uint16_t uni)
+{
+    qe->max_bidi_streams = bidi;
+    qe->max_uni_streams = uni;
+}
+
+
+void q_request_ack_freq(struct q_conn * const c,
+                        const uint16_t pkts,
+                        const double delay)
+{
+    if (c->tp_out.min_ack_del == 0) {
+        warn(WRN, "peer of %s conn %s does not support ACK_FREQUENCY",
+             conn_type(c), cid2str(c->scid));
+        return;
+    }
+
+    if (c->ack_freq_pkts)
+        // supersede the previous request
+        c->ack_freq_seq++;
+    c->ack_freq_pkts = (uint16_t)MAX(pkts, 1);
+    c->ack_freq_del = MIN(MAX(delay, c->tp_out.min_ack_del / 1000000.0),
+                          UINT8_MAX / 1000.0);
+
+    // account for the new delay when setting the LD alarm
+    c->tp_out.max_ack_del =
+        (uint8_t)MAX(c->tp_out.max_ack_del, 1000 * c->ack_freq_del);
+
+    c->tx_ack_freq = true;
+    ev_async_send(ped(c->w)->loop, &c->tx_w);
+}
+
+
+void q_stream_set_priority(struct q_stream * const s,
+                           const uint8_t urgency,
+                           const uint8_t weight)
+{
+    warn(INF, "strm " FMT_SID " on %s conn %s urgency %u weight %u", s->id,
+         conn_type(s->c), cid2str(s->c->scid), urgency, weight);
+    s->urgency = urgency;
+    s->weight = MAX(weight, 1);
+}
+
+
+void q_stream_cork(struct q_stream * const s)
+{
+    s->corked = true;
+}
+
+
+void q_stream_uncork(struct q_stream * const s)
+{
+    s->corked = false;
+    if (s->out_nxt) {
+        sched_stream_tx(s);
+        ev_async_send(ped(s->c->w)->loop, &s->c->tx_w);
+    }
+}
+
+
 bool q_peer_has_closed_stream(struct q_stream * const s)
 {
     return s->state == strm_clsd;
@@ -662,21 +1027,119 @@ void write_to_corpus(const int dir, const void * const data, const size_t len)
 #endif
 
 
-struct q_conn * q_rx_ready(const uint64_t timeout)
+static void * __attribute__((nonnull)) run_worker(void * const arg)
 {
-    if (sl_empty(&c_ready)) {
-        if (timeout) {
-            if (ev_is_active(&api_alarm))
-                ev_timer_stop(loop, &api_alarm);
-            ev_timer_init(&api_alarm, cancel_api_call, timeout, 0);
-            ev_timer_start(loop, &api_alarm);
-        }
-        loop_run(q_rx_ready, 0, 0);
+    struct q_engine * const qe = arg;
+    struct q_workers * const wrk = qe->wrk;
+    warn(INF, "worker %u running", qe->widx);
+    wrk->fn(qe, wrk->arg);
+    warn(INF, "worker %u done", qe->widx);
+    return 0;
+}
+
+
+struct q_workers * q_init_workers(const uint8_t n,
+                                  const q_worker_fn fn,
+                                  void * const arg,
+                                  const char * const ifname,
+                                  const char * const cert,
+                                  const char * const key,
+                                  const char * const cache,
+                                  const char * const tls_log,
+                                  const bool verify_certs,
+                                  const bool flip_keys)
+{
+    ensure(n, "need at least one worker");
+
+    struct q_workers * const wrk =
+        calloc(1, sizeof(*wrk) + n * sizeof(wrk->e[0]));
+    ensure(wrk, "could not calloc");
+    wrk->thr = calloc(n, sizeof(*wrk->thr));
+    ensure(wrk->thr, "could not calloc");
+    wrk->n = n;
+    wrk->fn = fn;
+    wrk->arg = arg;
+
+    // create all engines before starting any worker, so they can steer
+    // packets to each other from the beginning
+    for (uint8_t i = 0; i < n; i++) {
+        struct q_engine * const qe = wrk->e[i] = q_init(
+            ifname, cert, key, cache, tls_log, verify_certs, flip_keys);
+        qe->wrk = wrk;
+        qe->widx = i;
+        if (n > 1)
+            ev_async_start(qe->loop, &qe->steer_w);
+    }
+
+    for (uint8_t i = 0; i < n; i++)
+        ensure(pthread_create(&wrk->thr[i], 0, run_worker, wrk->e[i]) == 0,
+               "pthread_create");
+
+    warn(NTE, "started %u worker%s", n, plural(n));
+    return wrk;
+}
+
+
+void q_cleanup_workers(struct q_workers * const wrk)
+{
+    for (uint8_t i = 0; i < wrk->n; i++)
+        ensure(pthread_join(wrk->thr[i], 0) == 0, "pthread_join");
+
+    // no more steering while the engines are torn down one by one
+    for (uint8_t i = 0; i < wrk->n; i++)
+        wrk->e[i]->wrk = 0;
+    for (uint8_t i = 0; i < wrk->n; i++)
+        q_cleanup(wrk->e[i]);
+
+    free(wrk->thr);
+    free(wrk);
+}
+
+
+void q_set_callbacks(struct q_engine * const qe,
+                     const struct q_callbacks * const cb)
+{
+    qe->cb = *cb;
+}
+
+
+void q_set_rx_budget(struct q_engine * const qe, const uint32_t budget)
+{
+    qe->rx_budget = budget;
+}
+
+
+void q_set_tx_delay(struct q_engine * const qe, const double delay)
+{
+    qe->tx_delay = delay;
+}
+
+
+void q_run_once(struct q_engine * const qe, const double timeout)
+{
+    ensure(qe->api_func == 0, "other API call active");
+    if (timeout > 0) {
+        ev_timer_set(&qe->run_alarm, timeout, 0);
+        ev_timer_start(qe->loop, &qe->run_alarm);
+        ev_run(qe->loop, EVRUN_ONCE);
+        ev_timer_stop(qe->loop, &qe->run_alarm);
+    } else
+        ev_run(qe->loop, EVRUN_NOWAIT);
+    tx_flush(qe);
+}
+
+
+struct q_conn * q_rx_ready(struct q_engine * const qe, const uint64_t timeout)
+{
+    if (sl_empty(&qe->c_ready)) {
+        if (timeout)
+            arm_api_alarm(qe, timeout);
+        loop_run(qe, q_rx_ready, 0, 0);
     }
 
-    struct q_conn * const c = sl_first(&c_ready);
+    struct q_conn * const c = sl_first(&qe->c_ready);
     if (c) {
-        sl_remove_head(&c_ready, node_rx_ext);
+        sl_remove_head(&qe->c_ready, node_rx_ext);
         c->have_new_data = c->in_c_ready = false;
         warn(WRN, "%s conn %s ready to rx", conn_type(c), cid2str(c->scid));
     }
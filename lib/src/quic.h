@@ -28,6 +28,7 @@
 #pragma once
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -35,6 +36,8 @@
 #include <sys/param.h>
 
 #include <ev.h>
+#include <picotls.h>
+#include <quant/quant.h>
 #include <warpcore/warpcore.h>
 
 #ifdef HAVE_ASAN
@@ -46,6 +49,7 @@
 
 #include "bitset.h"
 #include "frame.h"
+#include "wheel.h"
 
 
 #define MAX_CID_LEN 18
@@ -109,11 +113,15 @@ bitset_define(frames, NUM_FRAM_TYPES);
 /// Packet meta-data information associated with w_iov buffers
 struct pkt_meta {
     // XXX need to potentially change pm_cpy() below if fields are reordered
-    splay_entry(pkt_meta) nr_node;
     splay_entry(pkt_meta) off_node;
     sl_entry(pkt_meta) rtx_next;
     struct pm_sl rtx; ///< List of pkt_meta structs of previous TXs.
 
+    // stream frames of other streams that a pkt carries after its own
+    sl_entry(pkt_meta) carried_next;
+    struct pm_sl carried;      ///< Stream frames carried in this pkt.
+    struct pkt_meta * carrier; ///< Pkt this stream frame was carried in.
+
     // pm_cpy(true) starts copying from here:
     struct q_stream * stream;   ///< Stream this data was written on.
     uint64_t stream_off;        ///< Stream data offset.
@@ -135,19 +143,28 @@ struct pkt_meta {
     struct frames frames;        ///< Frames present in pkt.
 
     // pm_cpy(false) starts copying from here:
-    uint16_t tx_len;      ///< Length of protected packet at TX.
-    uint8_t is_rtx : 1;   ///< Does the w_iov hold truncated data?
-    uint8_t is_acked : 1; ///< Is the w_iov ACKed?
-    uint8_t is_lost : 1;  ///< Have we marked this w_iov as lost?
-    uint8_t : 5;
+    uint16_t tx_len;            ///< Length of protected packet at TX.
+    uint8_t is_rtx : 1;         ///< Does the w_iov hold truncated data?
+    uint8_t is_acked : 1;       ///< Is the w_iov ACKed?
+    uint8_t is_lost : 1;        ///< Have we marked this w_iov as lost?
+    uint8_t is_owned : 1;       ///< Does the stream own the w_iov (async TX)?
+    uint8_t is_app_limited : 1; ///< Was the sender app-limited at TX?
+    uint8_t is_pmtu_probe : 1;  ///< Is this a PMTUD probe?
+    uint8_t : 2;
 
     uint8_t pkt_nr_len;  ///< Length of the packet number data.
     uint16_t pkt_nr_pos; ///< Offset of the packet number.
 
-    uint8_t _unused[2];
+    uint16_t ack_freq_seq; ///< ACK_FREQUENCY sequence nr (mod 2^16), if sent.
 
     ev_tstamp tx_t;       ///< Transmission timestamp.
     struct pn_space * pn; ///< Packet number space; only set on TX.
+
+    // delivery rate estimation state of the connection at TX
+    uint64_t delivered;     ///< Bytes delivered.
+    ev_tstamp delivered_t;  ///< When @p delivered was last updated.
+    ev_tstamp first_sent_t; ///< TX time of the pkt that was ACKed then.
+
     struct pkt_hdr hdr;
 };
 
@@ -174,7 +191,121 @@ splay_head(ooo_by_off, pkt_meta);
 SPLAY_PROTOTYPE(ooo_by_off, pkt_meta, off_node, ooo_by_off_cmp)
 
 
-extern struct pkt_meta * pm;
+typedef void (*func_ptr)(void);
+
+sl_head(q_conn_sl, q_conn);
+sq_head(q_steered_sq, q_steered);
+sq_head(q_delayed_sq, q_delayed);
+splay_head(ooo_0rtt_by_cid, ooo_0rtt);
+
+struct kh_conns_by_ipnp_s;
+struct kh_conns_by_id_s;
+
+
+/// Per-engine state. One of these is allocated by q_init() for each warpcore
+/// engine, and hangs off the engine's data pointer, so several engines can be
+/// run in one process, e.g., each on its own thread. Engines do share the TLS
+/// state in tls.c (session tickets, ticket protection keys, key log file and
+/// certificate signer/verifier): the first q_init() sets it up, the last
+/// q_cleanup() tears it down, and tls_ctx_lock and tickets_lock guard it.
+struct q_engine {
+    struct w_engine * w;   ///< Underlying warpcore engine.
+    struct ev_loop * loop; ///< Event loop of this engine.
+    struct pkt_meta * pm;  ///< Meta-data for the w_iov buffers of @p w.
+
+    func_ptr api_func; ///< Currently active API function.
+    void * api_conn;   ///< Connection of the currently active API function.
+    void * api_strm;   ///< Stream of the currently active API function.
+    ev_timer api_alarm; ///< Timeout for the currently active API function.
+
+    struct q_conn_sl accept_queue; ///< Connections waiting for q_accept().
+    struct q_conn_sl c_ready;      ///< Connections waiting for q_rx_ready().
+
+    struct kh_conns_by_ipnp_s * conns_by_ipnp; ///< Connections by IP and port.
+    struct kh_conns_by_id_s * conns_by_id;     ///< Connections by CID.
+    struct ooo_0rtt_by_cid ooo_0rtt_by_cid;    ///< Reordered 0-RTT packets.
+
+    ptls_context_t tls_ctx; ///< TLS context.
+
+    struct q_callbacks cb; ///< Application callbacks, see q_set_callbacks().
+    ev_timer run_alarm;    ///< Timeout for q_run_once().
+    struct wheel whl;      ///< Timer wheel for all connection timers.
+
+    ev_prepare tx_prep_w;        ///< Calls tx_flush() once per loop iteration.
+    struct q_conn_sl tx_pend;    ///< Connections with datagrams to transmit.
+    uint64_t tx_dgrams;          ///< Datagrams handed to w_tx().
+    uint64_t tx_w_calls;         ///< Calls to w_tx() for these datagrams.
+    uint64_t rx_dgrams;          ///< Datagrams returned by w_rx().
+    uint64_t rx_w_calls;         ///< Calls to w_rx() that returned them.
+    uint64_t ss_exits_delay;     ///< Slow starts ended by HyStart++.
+    uint64_t ss_exits_loss;      ///< Slow starts ended by loss.
+    ev_tstamp tx_delay;          ///< Emulated path delay, see q_set_tx_delay().
+    ev_tstamp ack_del;           ///< Max. ACK delay of new connections.
+    uint64_t fc_budget;          ///< Max. flow control window (in bytes).
+    uint64_t fc_granted;         ///< Sum of the conn receive windows.
+    ev_timer delay_alarm;        ///< Sends datagrams from @p delay_q when due.
+    struct q_delayed_sq delay_q; ///< Datagrams held back by @p tx_delay.
+
+    struct q_workers * wrk;      ///< Worker group (zero if not in one).
+    uint8_t widx;                ///< Index of this engine in @p wrk.
+    uint8_t cc;                  ///< q_cc_t of new connections.
+    uint16_t ack_thresh;         ///< ACK ratio of new connections.
+    uint32_t rx_budget;          ///< Max. datagrams per rx() call (0 = all).
+    uint32_t max_bidi_streams;   ///< Initial bidi stream limit.
+    uint32_t max_uni_streams;    ///< Initial unidir stream limit.
+    ev_async steer_w;            ///< Signals packets steered to this engine.
+    pthread_mutex_t steer_lock;  ///< Protects @p steer_q and @p relay_q.
+    struct q_steered_sq steer_q; ///< Packets other workers steered to us.
+    struct q_steered_sq relay_q; ///< Datagrams other workers relay through us.
+    struct w_sock * relay_ws;    ///< Stand-in for the server socket, if any.
+
+#if !defined(NDEBUG) && !defined(FUZZING) &&                                   \
+    !defined(NO_FUZZER_CORPUS_COLLECTION)
+    int corpus_pkt_dir; ///< Directory for fuzzer corpus packets.
+    int corpus_frm_dir; ///< Directory for fuzzer corpus frames.
+#endif
+
+#ifndef FUZZING
+    ev_signal signal_w; ///< SIGINT watcher (default loop only).
+#endif
+};
+
+
+/// A group of server engines, each of which is run by its own worker thread.
+/// Server connection IDs carry the index of the owning worker in their first
+/// byte, so a worker that receives a packet for a connection it doesn't own can
+/// steer the packet to the right one without any shared lookup.
+struct q_workers {
+    uint8_t n;           ///< Number of workers.
+    uint8_t _unused[7];  ///< Padding.
+    pthread_t * thr;     ///< Worker threads.
+    q_worker_fn fn;      ///< Function run by each worker thread.
+    void * arg;          ///< Argument passed to @p fn.
+    struct q_engine * e[]; ///< Per-worker engines.
+};
+
+
+/// Return the q_engine for a given warpcore engine.
+///
+/// @param      w     Pointer to a w_engine.
+///
+/// @return     Pointer to the q_engine the w_engine belongs to.
+///
+#define ped(w) ((struct q_engine *)(w)->data)
+
+
+/// Invoke application callback @p fn of engine @p e for @p obj, if it is set.
+///
+/// @param      e     The q_engine.
+/// @param      fn    Name of the callback in struct q_callbacks.
+/// @param      obj   Connection or stream to pass to the callback.
+///
+#define do_cb(e, fn, obj)                                                      \
+    do {                                                                       \
+        const struct q_engine * const _ce = (e);                               \
+        if (_ce->cb.fn)                                                        \
+            _ce->cb.fn((obj), _ce->cb.arg);                                    \
+    } while (0)
 
 
 /// Return the pkt_meta entry for a given w_iov.
@@ -183,17 +314,18 @@ extern struct pkt_meta * pm;
 ///
 /// @return     Pointer to the pkt_meta entry for the w_iov.
 ///
-#define meta(v) pm[w_iov_idx(v)]
+#define meta(v) ped((v)->w)->pm[w_iov_idx(v)]
 
 
 /// Return the w_iov index of a given pkt_meta.
 ///
+/// @param      w     Pointer to the w_engine the pkt_meta belongs to.
 /// @param      m     Pointer to a pkt_meta entry.
 ///
 /// @return     Index of the struct w_iov the struct pkt_meta holds meta data
 ///             for.
 ///
-#define pm_idx(m) (uint32_t)((m)-pm)
+#define pm_idx(w, m) (uint32_t)((m)-ped(w)->pm)
 
 
 static inline void __attribute__((nonnull))
@@ -216,6 +348,12 @@ pm_cpy(struct pkt_meta * const dst,
 #define CLNT_SCID_LEN 4
 #define SERV_SCID_LEN 8
 
+/// Default number of datagrams rx() processes per socket and loop iteration.
+#define DEF_RX_BUDGET 1024
+
+/// Default size (in bytes) flow control windows may grow to.
+#define DEF_FC_BUDGET (16 * 1024 * 1024)
+
 #define adj_iov_to_start(v)                                                    \
     do {                                                                       \
         (v)->buf -= meta(v).stream_data_start;                                 \
@@ -232,7 +370,7 @@ pm_cpy(struct pkt_meta * const dst,
 
 #define hex2str(buf, len)                                                      \
     __extension__({                                                            \
-        static char _str[2 * 64 + 1] = "0";                                    \
+        static __thread char _str[2 * 64 + 1] = "0";                           \
         static const char _hex_str[] = "0123456789abcdef";                     \
         int _j;                                                                \
         for (_j = 0; (unsigned long)_j < (unsigned long)(len) && _j < 64;      \
@@ -276,9 +414,6 @@ static inline bool __attribute__((nonnull)) is_fin(const struct w_iov * const v)
 }
 
 
-extern struct ev_loop * loop;
-extern struct q_conn_sl accept_queue;
-
 /// The versions of QUIC supported by this implementation
 extern const uint32_t ok_vers[];
 extern const uint8_t ok_vers_len;
@@ -287,9 +422,14 @@ extern const uint8_t ok_vers_len;
 #define kMaxTLPs 2
 
 /// Maximum reordering in packet number space before FACK style loss detection
-/// considers a packet lost.
+/// considers a packet lost. This is the initial value; it grows when reordering
+/// is observed.
 #define kReorderingThreshold 3
 
+/// Number of recoveries without spurious losses after which the RACK
+/// reordering window and threshold go back to their initial values.
+#define kReoWndPersist 16
+
 /// Minimum time in the future a tail loss probe alarm may be set for (in sec).
 #define kMinTLPTimeout 0.01
 
@@ -299,6 +439,14 @@ extern const uint8_t ok_vers_len;
 /// The length of the peer’s delayed ack timer (in sec).
 #define kDelayedAckTimeout 0.025
 
+/// Number of ACK-eliciting packets after which a receiver ACKs without waiting
+/// for its delayed ack timer.
+#define kAckThresh 2
+
+/// Smallest delayed ack timer we support (in sec); sent in the min_ack_delay
+/// transport parameter.
+#define kMinAckDelay 0.001
+
 /// The default RTT used before an RTT sample is taken (in sec).
 #define kDefaultInitialRtt 0.1
 
@@ -318,13 +466,66 @@ extern const uint8_t ok_vers_len;
 /// Reduction in congestion window when a new loss event is detected.
 #define kLossReductionDivisor 2
 
-/// Default conn_idle timeout.
-#define kIdleTimeout 10
+/// CUBIC scaling constant C [RFC8312] (in packets/sec^3).
+#define kCubicC 0.4
 
+/// CUBIC multiplicative window decrease factor beta [RFC8312].
+#define kCubicBeta 0.7
 
-typedef void (*func_ptr)(void);
-extern func_ptr api_func;
-extern void *api_conn, *api_strm;
+/// CUBIC additive increase factor of the Reno-friendly estimate [RFC8312].
+#define kCubicAlpha (3 * (1 - kCubicBeta) / (1 + kCubicBeta))
+
+/// Bounds of the RTT increase that makes HyStart++ leave slow start (in sec).
+#define kHyStartMinRttThresh 0.004
+#define kHyStartMaxRttThresh 0.016
+
+/// Fraction of the previous round's min RTT that HyStart++ treats as an RTT
+/// increase, within the bounds above.
+#define kHyStartMinRttDivisor 8
+
+/// RTT samples per round HyStart++ needs to compare rounds.
+#define kHyStartNRttSample 8
+
+/// Slow start growth divisor during HyStart++ conservative slow start (CSS).
+#define kHyStartCssGrowthDivisor 4
+
+/// Rounds of CSS after which HyStart++ ends slow start.
+#define kHyStartCssRounds 5
+
+/// BBR pacing and cwnd gain during STARTUP, i.e., 2/ln(2).
+#define kBbrHighGain 2.885
+
+/// BBR cwnd gain outside of STARTUP.
+#define kBbrCwndGain 2.0
+
+/// Number of rounds over which BBR takes the maximum delivery rate.
+#define kBbrBwWindow 10
+
+/// Time after which BBR considers its min_rtt estimate stale (in sec).
+#define kBbrMinRttWindow 10
+
+/// Minimum time BBR spends in PROBE_RTT (in sec).
+#define kBbrProbeRttTime 0.2
+
+/// Minimum cwnd of BBR, which keeps the ACK clock going.
+#define kBbrMinPipeCwnd (4 * kMaxDatagramSize)
+
+/// Pacing rate multiplier of cwnd/srtt during slow start.
+#define kPacingGainSS 2.0
+
+/// Pacing rate multiplier of cwnd/srtt during congestion avoidance.
+#define kPacingGainCA 1.25
+
+/// Number of full-sized packets the pacer lets go out back-to-back.
+#define kPacingBurst 10
+
+/// Pacing timer granularity (in sec). The pacer allows bursts of at least this
+/// much time's worth of data, so that coarse event loop timers don't cap the
+/// pacing rate.
+#define kPacingGranularity 0.002
+
+/// Default conn_idle timeout.
+#define kIdleTimeout 10
 
 
 #ifndef NDEBUG
@@ -350,50 +551,59 @@ extern void *api_conn, *api_strm;
 
 
 /// If current API function and argument match @p func and @p arg - and @p strm
-/// if it is non-zero - exit the event loop.
+/// if it is non-zero - exit the event loop of engine @p e.
 ///
+/// @param      e     The q_engine to check API activity on.
 /// @param      func  The API function to potentially return to.
 /// @param      conn  The connection to check API activity on.
 /// @param      strm  The stream to check API activity on.
 ///
 /// @return     True if the event loop was exited.
 ///
-#define maybe_api_return3(func, conn, strm)                                    \
+#define maybe_api_return4(e, func, conn, strm)                                 \
     __extension__({                                                            \
-        EV_VERIFY(loop);                                                       \
-        if (api_func == (func_ptr)(&(func)) && api_conn == (conn) &&           \
-            ((strm) == 0 || api_strm == (strm))) {                             \
-            ev_break(loop, EVBREAK_ALL);                                       \
+        struct q_engine * const _e = (e);                                      \
+        EV_VERIFY(_e->loop);                                                   \
+        if (_e->api_func == (func_ptr)(&(func)) && _e->api_conn == (conn) &&   \
+            ((strm) == 0 || _e->api_strm == (strm))) {                         \
+            ev_break(_e->loop, EVBREAK_ALL);                                   \
             warn(DBG,                                                          \
                  #func "(" #conn ", " #strm ") done, exiting event loop");     \
-            api_func = api_conn = api_strm = 0;                                \
+            _e->api_func = 0;                                                  \
+            _e->api_conn = _e->api_strm = 0;                                   \
         }                                                                      \
-        api_func == 0;                                                         \
+        _e->api_func == 0;                                                     \
     })
 
 
 /// If current API argument matches @p arg - and @p strm if it is non-zero -
-/// exit the event loop (for any active API function).
+/// exit the event loop of engine @p e (for any active API function).
 ///
+/// @param      e     The q_engine to check API activity on.
 /// @param      conn  The connection to check API activity on.
 /// @param      strm  The stream to check API activity on.
 ///
 /// @return     True if the event loop was exited.
 ///
-#define maybe_api_return2(conn, strm)                                          \
+#define maybe_api_return_any(e, conn, strm)                                    \
     __extension__({                                                            \
-        EV_VERIFY(loop);                                                       \
-        if (api_conn == (conn) && ((strm) == 0 || api_strm == (strm))) {       \
-            ev_break(loop, EVBREAK_ALL);                                       \
+        struct q_engine * const _e = (e);                                      \
+        EV_VERIFY(_e->loop);                                                   \
+        if (_e->api_conn == (conn) &&                                          \
+            ((strm) == 0 || _e->api_strm == (strm))) {                         \
+            ev_break(_e->loop, EVBREAK_ALL);                                   \
             warn(DBG, "<any>(" #conn ", " #strm ") done, exiting event loop"); \
-            api_func = api_conn = api_strm = 0;                                \
+            _e->api_func = 0;                                                  \
+            _e->api_conn = _e->api_strm = 0;                                   \
         }                                                                      \
-        api_func == 0;                                                         \
+        _e->api_func == 0;                                                     \
     })
 
 
 extern void __attribute__((nonnull)) pm_free(struct pkt_meta * const m);
 
+extern void __attribute__((nonnull)) lose_carried(struct pkt_meta * const m);
+
 
 #define free_iov(v)                                                            \
     do {                                                                       \
@@ -421,6 +631,7 @@ extern void __attribute__((nonnull)) pm_free(struct pkt_meta * const m);
 extern void __attribute__((nonnull)) alloc_off(struct w_engine * const w,
                                                struct w_iov_sq * const q,
                                                const uint32_t len,
+                                               const uint16_t pkt_len,
                                                const uint16_t off);
 
 
@@ -464,8 +675,6 @@ w_iov_dup(const struct w_iov * const v)
 
 #if !defined(NDEBUG) && !defined(FUZZING) &&                                   \
     !defined(NO_FUZZER_CORPUS_COLLECTION)
-extern int corpus_pkt_dir, corpus_frm_dir;
-
 extern void __attribute__((nonnull))
 write_to_corpus(const int dir, const void * const data, const size_t len);
 #endif
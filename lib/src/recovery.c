@@ -54,13 +54,6 @@ ev_tstamp prev_srtt = 0, prev_rttvar = 0;
 #endif
 
 
-static inline bool __attribute__((nonnull))
-in_recovery(const struct q_conn * const c, const uint64_t nr)
-{
-    return nr <= c->rec.eor;
-}
-
-
 static inline bool __attribute__((nonnull))
 crypto_pkts_outstanding(struct q_conn * const c)
 {
@@ -79,8 +72,9 @@ static void __attribute__((nonnull)) set_ld_timer(struct q_conn * const c)
 
     // don't arm the alarm if there are no packets with
     // retransmittable data in flight
+    struct q_engine * const qe = ped(c->w);
     if (c->rec.in_flight == 0) {
-        ev_timer_stop(loop, &c->rec.ld_alarm);
+        tmr_stop(&qe->whl, &c->rec.ld_alarm);
 #ifndef FUZZING
         // warn(DBG, "no RTX-able pkts outstanding, stopping ld_alarm");
 #endif
@@ -118,69 +112,128 @@ static void __attribute__((nonnull)) set_ld_timer(struct q_conn * const c)
 
     c->rec.ld_alarm.repeat = c->rec.last_sent_rtxable_t + to;
 set_to:
-    c->rec.ld_alarm.repeat -= ev_now(loop);
+    c->rec.ld_alarm.repeat -= ev_now(qe->loop);
 
     if (c->rec.ld_alarm.repeat <= 0) {
-        ev_timer_stop(loop, &c->rec.ld_alarm);
-        ev_invoke(loop, &c->rec.ld_alarm, 0);
+        tmr_stop(&qe->whl, &c->rec.ld_alarm);
+        c->rec.ld_alarm.cb(&c->rec.ld_alarm);
     } else {
         warn(DBG, "%s alarm in %f sec on %s conn %s", type,
              c->rec.ld_alarm.repeat, conn_type(c), cid2str(c->scid));
-        ev_timer_again(loop, &c->rec.ld_alarm);
+        tmr_again(&qe->whl, &c->rec.ld_alarm);
     }
 }
 
 
+static void __attribute__((nonnull))
+start_undo(struct q_conn * const c, const uint64_t first, const uint64_t cnt)
+{
+    // remember the window before it is reduced, in case all @p cnt pkts lost
+    // from @p first on are ACKed after all
+    c->rec.undo_cwnd = c->rec.cwnd;
+    c->rec.undo_ssthresh = c->rec.ssthresh;
+    c->rec.undo_nr = first;
+    c->rec.undo_pend = cnt;
+}
+
+
+/// Account for @p cnt more lost pkts of the current recovery period that an
+/// ACK could still show to be spurious. If @p blocked, the period also lost
+/// pkts that were freed, whose ACKs we will never see, so it cannot be undone.
+///
+/// @param      c        Connection.
+/// @param      cnt      Number of lost pkts that were kept.
+/// @param      blocked  Whether lost pkts were freed.
+///
+static void __attribute__((nonnull))
+add_undo_pend(struct q_conn * const c, const uint64_t cnt, const bool blocked)
+{
+    if (blocked || c->rec.undo_pend == UINT64_MAX)
+        c->rec.undo_pend = UINT64_MAX;
+    else
+        c->rec.undo_pend += cnt;
+}
+
+
 static void __attribute__((nonnull))
 detect_lost_pkts(struct q_conn * const c, struct pn_space * const pn)
 {
     c->rec.loss_t = 0;
-    ev_tstamp delay_until_lost = HUGE_VAL;
 
-    if (pn->lg_acked == pn->lg_sent)
-        // Early retransmit timer.
-        delay_until_lost = 1.125 * MAX(c->rec.latest_rtt, c->rec.srtt);
-
-    const ev_tstamp now = ev_now(loop);
+    // RACK: a pkt is lost if a pkt sent after it was delivered, and an RTT plus
+    // a reordering window have passed since it was sent; the window widens
+    // after spurious losses
+    const ev_tstamp reo_wnd =
+        is_inf(c->rec.min_rtt)
+            ? 0
+            : MIN(c->rec.reo_wnd_mult * c->rec.min_rtt / 4, c->rec.srtt);
+    const ev_tstamp now = ev_now(ped(c->w)->loop);
     uint64_t largest_lost_packet = 0;
+    uint64_t first_kept = UINT64_MAX;
+    uint64_t kept_cnt = 0;
+    bool freed_lost = false;
 
+    // all pkts below ld_nr are ACKed or lost, so only look at the newer ones;
+    // since pkts are sent in order, stop at the first that isn't lost yet
     struct pkt_meta *p, *nxt;
-    for (p = splay_min(pm_by_nr, &pn->sent_pkts); p && p->hdr.nr < pn->lg_acked;
-         p = nxt) {
-        nxt = splay_next(pm_by_nr, &pn->sent_pkts, p);
-        if (p->is_acked || p->is_lost)
+    for (p = pmr_next_from(&pn->sent_pkts, MAX(pn->ld_nr, pn->sent_pkts.lo));
+         p && p->hdr.nr < pn->lg_acked; p = nxt) {
+        nxt = pmr_next(&pn->sent_pkts, p);
+        if (p->is_acked || p->is_lost) {
+            pn->ld_nr = p->hdr.nr + 1;
             continue;
+        }
 
-        const ev_tstamp time_since_sent = now - p->tx_t;
         const uint64_t delta = pn->lg_acked - p->hdr.nr;
+        const ev_tstamp lost_t = p->tx_t + c->rec.rack_rtt + reo_wnd;
+        const bool by_time = p->tx_t <= c->rec.rack_tx_t && lost_t <= now;
 
-        // warn(ERR, "delay_until_lost %f (time_since_sent %f)",
-        // delay_until_lost, time_since_sent);
-
-        if (time_since_sent > delay_until_lost ||
-            delta > kReorderingThreshold) {
+        if (by_time || delta > c->rec.reo_thresh) {
             warn(WRN, "0x%02x-type pkt " FMT_PNR_OUT " considered lost",
                  p->hdr.flags, p->hdr.nr);
             p->is_lost = true;
+            pn->ld_nr = p->hdr.nr + 1;
+            lose_carried(p);
             // c->needs_tx = true;
 
+            if (unlikely(p->is_pmtu_probe)) {
+                // not a congestion signal, so keep it out of the rest
+                c->rec.in_flight -= p->tx_len;
+                on_pmtu_probe_lost(c, p->tx_len);
+                free_iov(w_iov(c->w, pm_idx(c->w, p)));
+                continue;
+            }
+
             // OnPacketsLost:
-            if (is_ack_only(&p->frames) == false) {
+            const bool in_flight = is_ack_only(&p->frames) == false;
+            if (in_flight) {
                 c->rec.in_flight -= p->tx_len;
+                c->rec.rs.lost += p->tx_len;
+                // only pkts in flight signal congestion
+                largest_lost_packet = MAX(largest_lost_packet, p->hdr.nr);
                 // log_cc(c);
             }
-            largest_lost_packet = MAX(largest_lost_packet, p->hdr.nr);
+            c->rec.lost_cnt++;
 
             if (p->is_rtx || !is_rtxable(p)) {
                 if (p->is_rtx)
                     // remove from the original w_iov rtx list
                     sl_remove(&sl_first(&p->rtx)->rtx, p, pkt_meta, rtx_next);
-                free_iov(w_iov(c->w, pm_idx(p)));
+                free_iov(w_iov(c->w, pm_idx(c->w, p)));
+                // no ACK can show this loss to be spurious anymore
+                freed_lost |= in_flight;
+            } else {
+                // an ACK for this pkt would show the loss was spurious
+                first_kept = MIN(first_kept, p->hdr.nr);
+                kept_cnt++;
             }
 
-        } else if (is_zero(c->rec.loss_t) && !is_inf(delay_until_lost)) {
-            c->rec.loss_t = now + delay_until_lost - time_since_sent;
+        } else {
+            if (p->tx_t <= c->rec.rack_tx_t)
+                // check again when it will be lost by time
+                c->rec.loss_t = lost_t;
             // warn(ERR, "loss_t %f (now %f)", c->rec.loss_t, now);
+            break;
         }
     }
 
@@ -193,24 +246,26 @@ detect_lost_pkts(struct q_conn * const c, struct pn_space * const pn)
         //      ", lg_lost=%" PRIu64,
         //      c->rec.eor, pn->lg_sent, largest_lost_packet);
         c->rec.eor = pn->lg_sent;
-        c->rec.cwnd /= kLossReductionDivisor;
-        c->rec.cwnd = MAX(c->rec.cwnd, kMinimumWindow);
-        c->rec.ssthresh = c->rec.cwnd;
+        start_undo(c, first_kept, freed_lost ? UINT64_MAX : kept_cnt);
+        if (++c->rec.reo_wnd_persist >= kReoWndPersist) {
+            // no spurious losses for a while, shrink the reordering window
+            c->rec.reo_wnd_mult = 1;
+            c->rec.reo_thresh = kReorderingThreshold;
+            c->rec.reo_wnd_persist = 0;
+        }
+        c->rec.cc->on_lost(c);
         // log_cc(c);
-    }
+    } else
+        add_undo_pend(c, kept_cnt, freed_lost);
 
     log_cc(c);
 }
 
 
-static void __attribute__((nonnull))
-on_ld_alarm(struct ev_loop * const l __attribute__((unused)),
-            ev_timer * const w,
-            int e __attribute__((unused)))
+static void __attribute__((nonnull)) on_ld_alarm(struct tmr * const t)
 {
-    struct q_conn * const c = w->data;
+    struct q_conn * const c = t->data;
     struct pn_space * const pn = pn_for_epoch(c, c->tls.epoch_out);
-    ev_timer_stop(loop, &c->rec.ld_alarm);
 
     // see OnLossDetectionAlarm pseudo code
     if (crypto_pkts_outstanding(c)) {
@@ -287,12 +342,21 @@ void on_pkt_sent(struct q_stream * const s, struct w_iov * const v)
     // these we maintain via the frames bitstr_t in pkt_meta:
     // * sent_packets[packet_number].ack_only
 
-    meta(v).tx_t = ev_now(loop);
     struct q_conn * const c = s->c;
+    meta(v).tx_t = ev_now(ped(c->w)->loop);
     struct pn_space * const pn = pn_for_epoch(c, strm_epoch(s));
-    ensure(splay_insert(pm_by_nr, &pn->sent_pkts, &meta(v)) == 0, "inserted");
+    pmr_insert(&pn->sent_pkts, &meta(v));
 
     if (likely(is_ack_only(&meta(v).frames) == false)) {
+        // remember the delivery state, to take a rate sample when ACKed
+        if (c->rec.in_flight == 0)
+            c->rec.first_sent_t = c->rec.delivered_t = meta(v).tx_t;
+        meta(v).delivered = c->rec.delivered;
+        meta(v).delivered_t = c->rec.delivered_t;
+        meta(v).first_sent_t = c->rec.first_sent_t;
+        meta(v).is_app_limited = c->rec.app_limited != 0;
+
+        c->rec.cc->on_sent(c, v);
         if (unlikely(has_frame(v, FRAM_TYPE_CRPT)))
             // is_crypto_packet
             c->rec.last_sent_crypto_t = meta(v).tx_t;
@@ -300,6 +364,7 @@ void on_pkt_sent(struct q_stream * const s, struct w_iov * const v)
         // warn(ERR, "last_sent_rtxable_t %f", c->rec.last_sent_rtxable_t);
 
         c->rec.in_flight += meta(v).tx_len; // OnPacketSentCC
+        c->rec.pace_tokens -= MIN(c->rec.pace_tokens, meta(v).tx_len);
         log_cc(c);
         set_ld_timer(c);
     }
@@ -332,6 +397,11 @@ update_rtt(struct q_conn * const c, const ev_tstamp ack_del)
         c->rec.srtt = .875 * c->rec.srtt + .125 * c->rec.latest_rtt;
     }
 
+    // HyStart++ looks at the RTT samples of each round
+    c->rec.hs.cur_rnd_min_rtt =
+        MIN(c->rec.hs.cur_rnd_min_rtt, c->rec.latest_rtt);
+    c->rec.hs.rtt_cnt++;
+
     // log_cc(c);
 }
 
@@ -347,13 +417,36 @@ void on_ack_received_1(struct q_conn * const c,
     pn->lg_acked = meta(lg_ack).hdr.nr;
 
     // latest_rtt = now - sent_packets[ack.largest_acked].time
-    c->rec.latest_rtt = ev_now(loop) - meta(lg_ack).tx_t;
+    c->rec.latest_rtt = ev_now(ped(c->w)->loop) - meta(lg_ack).tx_t;
 
     // UpdateRtt(latest_rtt, ack.ack_delay)
     update_rtt(c, ack_del / 1000000.0); // ack_del is passed in usec
 }
 
 
+static void __attribute__((nonnull)) take_rate_sample(struct q_conn * const c)
+{
+    struct rate_sample * const rs = &c->rec.rs;
+    if (c->rec.app_limited && c->rec.delivered > c->rec.app_limited)
+        // everything sent while app-limited has been ACKed
+        c->rec.app_limited = 0;
+
+    if (rs->acked) {
+        rs->delivered = c->rec.delivered - rs->prior_delivered;
+        // intervals shorter than min_rtt are likely due to ACK compression, and
+        // would overestimate the rate
+        const ev_tstamp interval = MAX(rs->send_elapsed, rs->ack_elapsed);
+        rs->rate = interval > 0 && interval >= c->rec.min_rtt
+                       ? (double)rs->delivered / interval
+                       : 0;
+        if (c->rec.cc->on_rate_sample)
+            c->rec.cc->on_rate_sample(c, rs);
+    }
+
+    *rs = (struct rate_sample){0};
+}
+
+
 void on_ack_received_2(struct q_conn * const c,
                        struct pn_space * const pn,
                        const uint64_t sm_new_acked)
@@ -364,25 +457,46 @@ void on_ack_received_2(struct q_conn * const c,
     if (c->rec.rto_cnt > 0 && sm_new_acked &&
         sm_new_acked > pn->lg_sent_before_rto) {
         // OnRetransmissionTimeoutVerified(smallest_newly_acked)
-
-        // congestion_window = kMinimumWindow
-        c->rec.cwnd = kMinimumWindow;
+        start_undo(c, UINT64_MAX, 0);
+        c->rec.cc->on_rto_verified(c);
 
         // for (sent_packet: sent_packets):
         //   if (sent_packet.packet_number < packet_number):
-        for (struct pkt_meta * p = splay_min(pm_by_nr, &pn->sent_pkts);
-             p && p->hdr.nr < sm_new_acked;
-             p = splay_next(pm_by_nr, &pn->sent_pkts, p)) {
+        struct pkt_meta *p, *nxt;
+        for (p = pmr_min(&pn->sent_pkts); p && p->hdr.nr < sm_new_acked;
+             p = nxt) {
+            nxt = pmr_next(&pn->sent_pkts, p);
+            if (p->is_lost || p->is_acked)
+                continue;
             warn(DBG, "0x%02x-type pkt " FMT_PNR_OUT " considered lost",
                  p->hdr.flags, p->hdr.nr);
             p->is_lost = true;
+            lose_carried(p);
+            if (unlikely(p->is_pmtu_probe))
+                on_pmtu_probe_lost(c, p->tx_len);
+            c->rec.lost_cnt++;
             if (is_ack_only(&p->frames) == false) {
                 // bytes_in_flight -= lost_packet.bytes
                 ensure(c->rec.in_flight, "in_flight is zero");
                 c->rec.in_flight -= p->tx_len;
-                // XXX: sent_packets.remove(sent_packet.packet_number)
                 // log_cc(c);
             }
+
+            // only ACK-eliciting pkts can show the RTO to be spurious
+            const bool elicits =
+                !is_ack_or_padding_only(&p->frames) && !p->is_pmtu_probe;
+            if (p->is_rtx || !is_rtxable(p)) {
+                // sent_packets.remove(sent_packet.packet_number), since
+                // detect_lost_pkts() skips lost pkts and would leave this one
+                // in sent_pkts, where it would keep the ring from shrinking
+                if (p->is_rtx)
+                    sl_remove(&sl_first(&p->rtx)->rtx, p, pkt_meta, rtx_next);
+                add_undo_pend(c, 0, elicits);
+                free_iov(w_iov(c->w, pm_idx(c->w, p)));
+            } else if (elicits) {
+                c->rec.undo_nr = MIN(c->rec.undo_nr, p->hdr.nr);
+                add_undo_pend(c, 1, false);
+            }
         }
     }
 
@@ -393,6 +507,7 @@ void on_ack_received_2(struct q_conn * const c,
 
     detect_lost_pkts(c, pn);
     set_ld_timer(c);
+    take_rate_sample(c);
 
     // XXX since we likely reduced in_flight during the ACK parsing, we can TX
     if (likely(has_wnd(c)))
@@ -407,30 +522,108 @@ on_pkt_acked_cc(struct q_conn * const c, struct w_iov * const acked_pkt)
 {
     // implement OnPacketAckedCC pseudocode
 
+    struct rate_sample * const rs = &c->rec.rs;
+    if (rs->acked == 0)
+        rs->prior_in_flight = c->rec.in_flight;
+
     // bytes_in_flight -= acked_packet.bytes
     if (meta(acked_pkt).is_lost == false)
         c->rec.in_flight -= meta(acked_pkt).tx_len;
 
-    // if (!InRecovery(acked_packet.packet_number)):
-    if (in_recovery(c, meta(acked_pkt).hdr.nr) == false) {
-        // if (congestion_window < ssthresh):
-        if (c->rec.cwnd < c->rec.ssthresh)
-            // congestion_window += acked_packet.bytes
-            c->rec.cwnd += meta(acked_pkt).tx_len;
-        else
-            // congestion_window += kMaxDatagramSize * acked_packet.bytes /
-            // congestion_window
-            c->rec.cwnd +=
-                kMaxDatagramSize * meta(acked_pkt).tx_len / c->rec.cwnd;
-
-        // XXX clamp cwnd
-        // c->rec.cwnd = MAX(c->rec.cwnd, 128 * 1024);
+    // the newest pkt ACKed by an ACK frame determines its rate sample
+    c->rec.delivered += meta(acked_pkt).tx_len;
+    c->rec.delivered_t = ev_now(ped(c->w)->loop);
+    rs->acked += meta(acked_pkt).tx_len;
+    if (meta(acked_pkt).delivered >= rs->prior_delivered) {
+        rs->prior_delivered = meta(acked_pkt).delivered;
+        rs->is_app_limited = meta(acked_pkt).is_app_limited;
+        rs->send_elapsed = meta(acked_pkt).tx_t - meta(acked_pkt).first_sent_t;
+        rs->ack_elapsed = c->rec.delivered_t - meta(acked_pkt).delivered_t;
+        rs->rtt = c->rec.delivered_t - meta(acked_pkt).tx_t;
+        c->rec.first_sent_t = meta(acked_pkt).tx_t;
     }
 
+    c->rec.cc->on_acked(c, acked_pkt);
     // log_cc(c);
 }
 
 
+static void __attribute__((nonnull))
+on_spurious_loss(struct q_conn * const c,
+                 const struct pn_space * const pn,
+                 const struct w_iov * const acked_pkt)
+{
+    // a pkt we declared lost (and likely RTX'ed) was only reordered
+    const uint64_t nr = meta(acked_pkt).hdr.nr;
+    warn(DBG, "0x%02x-type pkt " FMT_PNR_OUT " was spuriously lost%s",
+         meta(acked_pkt).hdr.flags, nr,
+         meta(acked_pkt).is_rtx ? " and RTX'ed" : "");
+    c->rec.spurious_cnt++;
+
+    // widen the reordering windows
+    if (c->rec.reo_wnd_mult < UINT8_MAX)
+        c->rec.reo_wnd_mult++;
+    c->rec.reo_thresh = MAX(c->rec.reo_thresh, pn->lg_acked - nr);
+    c->rec.reo_wnd_persist = 0;
+
+    if (c->rec.undo_pend == 0 || c->rec.undo_pend == UINT64_MAX ||
+        nr < c->rec.undo_nr || --c->rec.undo_pend)
+        return;
+
+    // all losses of the last recovery period were spurious, undo its cwnd
+    // reduction and end it
+    warn(INF, "undoing spurious cwnd reduction on %s conn %s", conn_type(c),
+         cid2str(c->scid));
+    c->rec.undo_cnt++;
+    c->rec.cwnd = MAX(c->rec.cwnd, c->rec.undo_cwnd);
+    c->rec.ssthresh = MAX(c->rec.ssthresh, c->rec.undo_ssthresh);
+    c->rec.eor = MIN(c->rec.eor, nr);
+    if (c->rec.cc->on_spurious_loss)
+        c->rec.cc->on_spurious_loss(c);
+    log_cc(c);
+}
+
+
+/// Update the state of stream @p s for its ACKed data in @p v.
+///
+/// @param      c     Connection.
+/// @param      s     Stream of @p v.
+/// @param      v     ACKed w_iov.
+/// @param      orig  The original w_iov, if @p v is an RTX of it.
+///
+static void __attribute__((nonnull(1, 2, 3)))
+on_strm_data_acked(struct q_conn * const c,
+                   struct q_stream * const s,
+                   struct w_iov * const v,
+                   const struct w_iov * const orig)
+{
+    if ((orig == 0 || meta(orig).is_acked == false) &&
+        s->out_una == (orig ? orig : v)) {
+        // if this ACKs its stream's out_una, move that forward
+        sq_foreach_from (s->out_una, &s->out, next)
+            if (orig == 0 && meta(s->out_una).is_acked == false)
+                break;
+
+        if (s->out_una == 0) {
+            warn(DBG, "stream " FMT_SID " fully acked", s->id);
+
+            // a q_write may be done
+            maybe_api_return(ped(c->w), q_write, c, s);
+            if (s->id >= 0)
+                do_cb(ped(c->w), on_write_acked, s);
+            if (s->id >= 0 && c->did_0rtt)
+                maybe_api_return(ped(c->w), q_connect, c, 0);
+        }
+    }
+
+    adj_iov_to_start(v);
+    if (is_fin(v))
+        // this ACKs a FIN
+        maybe_api_return(ped(c->w), q_close_stream, c, s);
+    adj_iov_to_data(v);
+}
+
+
 void on_pkt_acked(struct q_conn * const c,
                   struct pn_space * const pn,
                   struct w_iov * const acked_pkt)
@@ -438,13 +631,21 @@ void on_pkt_acked(struct q_conn * const c,
     // implements OnPacketAcked pseudo code
     // warn(ERR, "ACK " FMT_PNR_OUT, meta(acked_pkt).hdr.nr);
 
+    // RACK: remember the most recently sent pkt that was delivered
+    if (meta(acked_pkt).tx_t >= c->rec.rack_tx_t) {
+        c->rec.rack_tx_t = meta(acked_pkt).tx_t;
+        c->rec.rack_rtt = ev_now(ped(c->w)->loop) - c->rec.rack_tx_t;
+    }
+
+    if (unlikely(meta(acked_pkt).is_lost))
+        on_spurious_loss(c, pn, acked_pkt);
+
     // if (!acked_packet.is_ack_only):
     if (is_ack_only(&meta(acked_pkt).frames) == false)
         on_pkt_acked_cc(c, acked_pkt);
 
     // sent_packets.remove(acked_packet.packet_number)
-    diet_insert(&pn->acked, meta(acked_pkt).hdr.nr, ev_now(loop));
-    ensure(splay_remove(pm_by_nr, &pn->sent_pkts, &meta(acked_pkt)), "removed");
+    ensure(pmr_remove(&pn->sent_pkts, &meta(acked_pkt)), "removed");
     meta(acked_pkt).is_acked = true;
 
     // rest of function is not from pseudo code
@@ -467,6 +668,15 @@ void on_pkt_acked(struct q_conn * const c,
         c->tp_in.new_max_data == meta(acked_pkt).max_data)
         c->tx_max_data = false;
 
+    // if this ACKs a PMTUD probe, its size works on this path
+    if (unlikely(meta(acked_pkt).is_pmtu_probe))
+        on_pmtu_probe_acked(c, meta(acked_pkt).tx_len);
+
+    // if this ACKs the current ACK_FREQUENCY frame, we can stop sending it
+    if (has_frame(acked_pkt, FRAM_TYPE_ACK_FREQ) &&
+        (uint16_t)c->ack_freq_seq == meta(acked_pkt).ack_freq_seq)
+        c->tx_ack_freq = false;
+
     // if this ACKs the current MAX_STREAM_ID frame, we can stop sending it
     if (has_frame(acked_pkt, FRAM_TYPE_MAX_SID)) {
         if (c->tp_in.new_max_bidi_streams == meta(acked_pkt).max_bidi_streams)
@@ -482,33 +692,23 @@ void on_pkt_acked(struct q_conn * const c,
         ensure(sl_next(r, rtx_next) == 0, "rtx chain corrupt");
         warn(DBG, FMT_PNR_OUT " was RTX'ed as " FMT_PNR_OUT,
              meta(acked_pkt).hdr.nr, r->hdr.nr);
-        orig = w_iov(c->w, pm_idx(r));
+        orig = w_iov(c->w, pm_idx(c->w, r));
     }
 
     struct q_stream * const s = meta(acked_pkt).stream;
-    if (s && (orig == 0 || meta(orig).is_acked == false) &&
-        s->out_una == (orig ? orig : acked_pkt)) {
-        // if this ACKs its stream's out_una, move that forward
-        sq_foreach_from (s->out_una, &s->out, next)
-            if (orig == 0 && meta(s->out_una).is_acked == false)
-                break;
-
-        if (s->out_una == 0) {
-            warn(DBG, "stream " FMT_SID " fully acked", s->id);
-
-            // a q_write may be done
-            maybe_api_return(q_write, c, s);
-            if (s->id >= 0 && c->did_0rtt)
-                maybe_api_return(q_connect, c, 0);
-        }
-    }
-
-    if (s) {
-        adj_iov_to_start(acked_pkt);
-        if (is_fin(acked_pkt))
-            // this ACKs a FIN
-            maybe_api_return(q_close_stream, c, s);
-        adj_iov_to_data(acked_pkt);
+    if (s)
+        on_strm_data_acked(c, s, acked_pkt, orig);
+
+    // the stream frames this pkt carried for other streams are ACKed, too
+    while (!sl_empty(&meta(acked_pkt).carried)) {
+        struct pkt_meta * const cm = sl_first(&meta(acked_pkt).carried);
+        sl_remove_head(&meta(acked_pkt).carried, carried_next);
+        cm->carrier = 0;
+        cm->is_acked = true;
+        struct q_stream * const cs = cm->stream;
+        on_strm_data_acked(c, cs, w_iov(c->w, pm_idx(c->w, cm)), 0);
+        // this may free the carried w_iov
+        free_acked_out(cs);
     }
 
     // stop ACKing packets that were contained in the ACK frame of this packet
@@ -517,34 +717,254 @@ void on_pkt_acked(struct q_conn * const c,
 
     if (!is_rtxable(&meta(acked_pkt)))
         free_iov(acked_pkt);
+
+    if (s)
+        // this may free acked_pkt, so do it last
+        free_acked_out(s);
+}
+
+
+static void __attribute__((nonnull))
+on_pace_alarm(struct ev_loop * const l,
+              ev_timer * const w,
+              int e __attribute__((unused)))
+{
+    struct q_conn * const c = w->data;
+    ev_timer_stop(l, &c->rec.pace_alarm);
+    tx(c, 0);
+}
+
+
+static double __attribute__((nonnull))
+pacing_rate(const struct q_conn * const c)
+{
+    // in bytes/sec
+    if (c->rec.cc->pacing_rate)
+        return c->rec.cc->pacing_rate(c);
+
+    const ev_tstamp srtt =
+        is_zero(c->rec.srtt) ? kDefaultInitialRtt : c->rec.srtt;
+    const double gain =
+        c->rec.cwnd < c->rec.ssthresh ? kPacingGainSS : kPacingGainCA;
+    return gain * (double)c->rec.cwnd / srtt;
+}
+
+
+uint32_t pace_pkts(struct q_conn * const c)
+{
+    struct ev_loop * const loop = ped(c->w)->loop;
+    const ev_tstamp now = ev_now(loop);
+    // pace in packets of the size we actually send, not the interface MTU
+    const uint16_t mtu = c->pmtu;
+    const double rate = pacing_rate(c);
+
+    // refill the token bucket for the time that passed, up to one burst
+    const uint64_t burst = MAX((uint64_t)kPacingBurst * mtu,
+                               (uint64_t)(rate * kPacingGranularity));
+    c->rec.pace_tokens =
+        MIN(burst,
+            c->rec.pace_tokens + (uint64_t)(rate * (now - c->rec.pace_t)));
+    c->rec.pace_t = now;
+
+    if (c->rec.pace_tokens >= mtu)
+        return (uint32_t)(c->rec.pace_tokens / mtu);
+
+    // come back when there are enough tokens for a full-sized packet
+    if (ev_is_active(&c->rec.pace_alarm) == false) {
+        ev_timer_set(&c->rec.pace_alarm,
+                     (double)(mtu - c->rec.pace_tokens) / rate, 0);
+        ev_timer_start(loop, &c->rec.pace_alarm);
+    }
+    return 0;
+}
+
+
+/// Grow cwnd for ACKed packet @p v during slow start, using HyStart++ to end
+/// slow start when the RTT starts to increase, i.e., when a queue builds up,
+/// rather than at the first loss. Since we pace, the growth per ACK is not
+/// limited.
+///
+/// @param      c     Connection.
+/// @param      v     ACKed packet.
+///
+void slow_start(struct q_conn * const c, const struct w_iov * const v)
+{
+    struct hystart * const hs = &c->rec.hs;
+    if (meta(v).delivered >= hs->rnd_end) {
+        // a pkt sent during the current round was ACKed, start a new round
+        hs->rnd_end = c->rec.delivered;
+        hs->last_rnd_min_rtt = hs->cur_rnd_min_rtt;
+        hs->cur_rnd_min_rtt = HUGE_VAL;
+        hs->rtt_cnt = 0;
+
+        if (hs->in_css && ++hs->css_rnds >= kHyStartCssRounds) {
+            warn(DBG,
+                 "HyStart++ ends slow start on %s conn %s at cwnd %" PRIu64,
+                 conn_type(c), cid2str(c->scid), c->rec.cwnd);
+            ped(c->w)->ss_exits_delay++;
+            hs->in_css = false;
+            c->rec.ssthresh = c->rec.cwnd;
+            return;
+        }
+    }
+
+    const bool have_rtts = hs->rtt_cnt >= kHyStartNRttSample &&
+                           !is_inf(hs->cur_rnd_min_rtt) &&
+                           !is_inf(hs->last_rnd_min_rtt);
+    if (hs->in_css == false && have_rtts) {
+        const ev_tstamp thresh =
+            MIN(MAX(hs->last_rnd_min_rtt / kHyStartMinRttDivisor,
+                    kHyStartMinRttThresh),
+                kHyStartMaxRttThresh);
+        if (hs->cur_rnd_min_rtt >= hs->last_rnd_min_rtt + thresh) {
+            // the RTT went up, grow more carefully
+            hs->in_css = true;
+            hs->css_rnds = 0;
+            hs->css_base_min_rtt = hs->cur_rnd_min_rtt;
+        }
+    } else if (hs->in_css && have_rtts &&
+               hs->cur_rnd_min_rtt < hs->css_base_min_rtt) {
+        // the RTT increase was spurious, resume slow start
+        hs->in_css = false;
+        hs->css_base_min_rtt = HUGE_VAL;
+    }
+
+    c->rec.cwnd +=
+        (uint64_t)(hs->in_css ? meta(v).tx_len / kHyStartCssGrowthDivisor
+                              : meta(v).tx_len);
+}
+
+
+/// Account for a loss that starts a new recovery period ending slow start,
+/// i.e., before HyStart++ could. Called by the on_lost handlers of the
+/// controllers that use slow_start(), before they reduce cwnd.
+///
+/// @param      c     Connection.
+///
+void slow_start_on_lost(struct q_conn * const c)
+{
+    if (c->rec.cwnd >= c->rec.ssthresh)
+        return;
+    warn(DBG, "slow start on %s conn %s ended by loss", conn_type(c),
+         cid2str(c->scid));
+    ped(c->w)->ss_exits_loss++;
+    c->rec.hs.in_css = false;
+}
+
+
+static void __attribute__((nonnull))
+newreno_init(struct q_conn * const c __attribute__((unused)))
+{
+}
+
+
+static void __attribute__((nonnull))
+newreno_on_sent(struct q_conn * const c __attribute__((unused)),
+                const struct w_iov * const v __attribute__((unused)))
+{
+}
+
+
+static void __attribute__((nonnull))
+newreno_on_acked(struct q_conn * const c, const struct w_iov * const v)
+{
+    // if (!InRecovery(acked_packet.packet_number)):
+    if (in_recovery(c, meta(v).hdr.nr))
+        return;
+
+    // if (congestion_window < ssthresh):
+    if (c->rec.cwnd < c->rec.ssthresh)
+        // congestion_window += acked_packet.bytes
+        slow_start(c, v);
+    else
+        // congestion_window += kMaxDatagramSize * acked_packet.bytes /
+        // congestion_window
+        c->rec.cwnd += kMaxDatagramSize * meta(v).tx_len / c->rec.cwnd;
+}
+
+
+static void __attribute__((nonnull)) newreno_on_lost(struct q_conn * const c)
+{
+    slow_start_on_lost(c);
+    c->rec.cwnd /= kLossReductionDivisor;
+    c->rec.cwnd = MAX(c->rec.cwnd, kMinimumWindow);
+    c->rec.ssthresh = c->rec.cwnd;
+}
+
+
+static void __attribute__((nonnull))
+newreno_on_rto_verified(struct q_conn * const c)
+{
+    // congestion_window = kMinimumWindow
+    c->rec.cwnd = kMinimumWindow;
+}
+
+
+static bool __attribute__((nonnull))
+newreno_can_send(const struct q_conn * const c)
+{
+    return c->rec.in_flight + w_mtu(c->w) < c->rec.cwnd;
+}
+
+
+const struct cc_ops cc_newreno = {.name = "NewReno",
+                                  .init = newreno_init,
+                                  .on_sent = newreno_on_sent,
+                                  .on_acked = newreno_on_acked,
+                                  .on_lost = newreno_on_lost,
+                                  .on_rto_verified = newreno_on_rto_verified,
+                                  .can_send = newreno_can_send};
+
+
+static const struct cc_ops * const cc_algos[] = {[q_cc_newreno] = &cc_newreno,
+                                                 [q_cc_cubic] = &cc_cubic,
+                                                 [q_cc_bbr] = &cc_bbr};
+
+
+void set_cc(struct q_conn * const c, const q_cc_t cc)
+{
+    c->rec.cc = cc_algos[cc];
+    c->rec.cc->init(c);
+    warn(INF, "%s conn %s uses %s congestion control", conn_type(c),
+         cid2str(c->scid), c->rec.cc->name);
 }
 
 
-struct w_iov * find_sent_pkt(struct q_conn * const c,
-                             struct pn_space * const pn,
-                             const uint64_t nr)
+void on_app_limited(struct q_conn * const c)
 {
-    const struct pkt_meta which = {.hdr.nr = nr};
-    const struct pkt_meta * const p =
-        splay_find(pm_by_nr, &pn->sent_pkts, &which);
-    return p ? w_iov(c->w, pm_idx(p)) : 0;
+    // rate samples are app-limited until what is in flight now is ACKed
+    c->rec.app_limited = MAX(c->rec.delivered + c->rec.in_flight, 1);
 }
 
 
 void init_rec(struct q_conn * const c)
 {
-    if (ev_is_active(&c->rec.ld_alarm))
-        ev_timer_stop(loop, &c->rec.ld_alarm);
+    if (tmr_active(&c->rec.ld_alarm))
+        tmr_stop(&ped(c->w)->whl, &c->rec.ld_alarm);
+    if (ev_is_active(&c->rec.pace_alarm))
+        ev_timer_stop(ped(c->w)->loop, &c->rec.pace_alarm);
 
+    // keep the congestion controller across a reset
+    const struct cc_ops * const cc = c->rec.cc;
     memset(&c->rec, 0, sizeof(c->rec));
 
     c->rec.min_rtt = HUGE_VAL;
+    c->rec.reo_wnd_mult = 1;
+    c->rec.reo_thresh = kReorderingThreshold;
+    c->rec.hs.last_rnd_min_rtt = c->rec.hs.cur_rnd_min_rtt =
+        c->rec.hs.css_base_min_rtt = HUGE_VAL;
 
-    c->rec.ld_alarm.data = c;
-    ev_init(&c->rec.ld_alarm, on_ld_alarm);
+    tmr_init(&c->rec.ld_alarm, on_ld_alarm, c);
+    c->rec.pace_alarm.data = c;
+    ev_init(&c->rec.pace_alarm, on_pace_alarm);
 
     c->rec.cwnd = kInitialWindow;
     c->rec.ssthresh = UINT64_MAX;
+    if (cc) {
+        c->rec.cc = cc;
+        cc->init(c);
+    } else
+        set_cc(c, (q_cc_t)ped(c->w)->cc);
 
     log_cc(c);
 }
@@ -33,7 +33,9 @@
 #include <ev.h>
 #include <warpcore/warpcore.h>
 
+#include "cc.h"
 #include "quic.h"
+#include "wheel.h"
 
 struct q_conn;
 struct q_stream;
@@ -42,12 +44,13 @@ struct pn_space;
 
 struct recovery {
     // LD state
-    ev_timer ld_alarm;   // loss_detection_alarm
+    struct tmr ld_alarm; // loss_detection_alarm
     uint16_t crypto_cnt; // crypto_count
     uint16_t tlp_cnt;    // tlp_count
     uint16_t rto_cnt;    // rto_count
 
-    uint8_t _unused2[2];
+    uint8_t reo_wnd_mult;    ///< RACK reordering window, in min_rtt/4.
+    uint8_t reo_wnd_persist; ///< Recoveries since @p reo_wnd_mult grew.
 
     ev_tstamp last_sent_crypto_t;  // time_of_last_sent_crypto_packet
     ev_tstamp last_sent_rtxable_t; // time_of_last_sent_retransmittable_packet
@@ -57,11 +60,40 @@ struct recovery {
     ev_tstamp rttvar;              // rttvar
     ev_tstamp loss_t;              // loss_time
 
+    ev_tstamp rack_tx_t;  ///< TX time of the newest delivered pkt.
+    ev_tstamp rack_rtt;   ///< RTT of that pkt.
+    uint64_t reo_thresh;  ///< Reordering threshold (in pkts).
+
+    // loss statistics
+    uint64_t lost_cnt;     ///< Pkts declared lost.
+    uint64_t spurious_cnt; ///< Pkts declared lost that were ACKed after all.
+    uint64_t undo_cnt;     ///< Recovery periods undone as spurious.
+
     // CC state
     uint64_t in_flight; // bytes_in_flight
     uint64_t cwnd;      // congestion_window
     uint64_t eor;       // end_of_recovery
     uint64_t ssthresh;
+    uint64_t undo_cwnd;       ///< cwnd before the last recovery period.
+    uint64_t undo_ssthresh;   ///< ssthresh before the last recovery period.
+    uint64_t undo_nr;         ///< First pkt it kept after declaring it lost.
+    uint64_t undo_pend;       ///< Kept lost pkts not ACKed since (or blocked).
+    const struct cc_ops * cc; ///< Congestion controller.
+    struct cubic cubic;       ///< State of cc_cubic.
+    struct bbr bbr;           ///< State of cc_bbr.
+    struct hystart hs;        ///< Slow start state of cc_newreno, cc_cubic.
+
+    // delivery rate estimation state
+    uint64_t delivered;     ///< Bytes delivered (ACKed) so far.
+    ev_tstamp delivered_t;  ///< When @p delivered was last updated.
+    ev_tstamp first_sent_t; ///< TX time of the pkt last ACKed.
+    uint64_t app_limited;   ///< @p delivered at end of app-limited phase.
+    struct rate_sample rs;  ///< Sample for the ACK being processed.
+
+    // pacing state
+    ev_timer pace_alarm;  ///< Restarts TX when the pacer allows it.
+    ev_tstamp pace_t;     ///< Last time @p pace_tokens was refilled.
+    uint64_t pace_tokens; ///< Bytes that may be sent without delay.
 };
 
 
@@ -110,6 +142,9 @@ extern ev_tstamp prev_srtt, prev_rttvar;
 
 extern void __attribute__((nonnull)) init_rec(struct q_conn * const c);
 
+extern void __attribute__((nonnull))
+set_cc(struct q_conn * const c, const q_cc_t cc);
+
 extern void __attribute__((nonnull))
 on_pkt_sent(struct q_stream * const s, struct w_iov * const v);
 
@@ -129,7 +164,13 @@ on_pkt_acked(struct q_conn * const c,
              struct pn_space * const pn,
              struct w_iov * const acked_pkt);
 
-extern struct w_iov * __attribute__((nonnull))
-find_sent_pkt(struct q_conn * const c,
-              struct pn_space * const pn,
-              const uint64_t nr);
+extern uint32_t __attribute__((nonnull)) pace_pkts(struct q_conn * const c);
+
+extern void __attribute__((nonnull)) on_app_limited(struct q_conn * const c);
+
+extern void __attribute__((nonnull))
+slow_start(struct q_conn * const c, const struct w_iov * const v);
+
+extern void __attribute__((nonnull))
+slow_start_on_lost(struct q_conn * const c);
+
@@ -42,6 +42,7 @@
 #include "pkt.h"
 #include "quic.h"
 #include "stream.h"
+#include "tls.h"
 
 
 #undef STRM_STATE
@@ -80,6 +81,7 @@ void apply_stream_limits(struct q_stream * const s)
                                           : c->tp_in.max_strm_data_bidi_remote)
                          : (is_uni(s->id) ? c->tp_in.max_strm_data_uni
                                           : c->tp_in.max_strm_data_bidi_local);
+    s->in_data_wnd = MAX(s->in_data_wnd, s->in_data_max);
     s->out_data_max =
         is_srv_ini(s->id) == c->is_clnt
             ? (is_uni(s->id) ? c->tp_out.max_strm_data_uni
@@ -89,6 +91,8 @@ void apply_stream_limits(struct q_stream * const s)
 
     // if limit is less than an MTU, we are already blocked
     s->blocked = s->out_data_max < w_mtu(c->w);
+    if (s->blocked)
+        sched_stream_ctrl(s);
 }
 
 
@@ -100,6 +104,8 @@ struct q_stream * new_stream(struct q_conn * const c, const int64_t id)
     sq_init(&s->in);
     s->c = c;
     s->id = id;
+    s->urgency = DEF_STRM_URGENCY;
+    s->weight = DEF_STRM_WEIGHT;
     strm_to_state(s, strm_open);
 
     if (is_uni(id))
@@ -146,16 +152,25 @@ void free_stream(struct q_stream * const s)
             kh_get(streams_by_id, c->streams_by_id, (khint64_t)s->id);
         ensure(k != kh_end(c->streams_by_id), "found");
         kh_del(streams_by_id, c->streams_by_id, k);
+        if (s->in_txq)
+            sq_remove(&c->strms_tx, s, q_stream, next_tx);
+        if (s->in_ctrlq)
+            sq_remove(&c->strms_ctrl, s, q_stream, next_ctrl);
+        if (s->in_rxq)
+            sq_remove(&c->strms_rx, s, q_stream, next_rx);
     } else
         s->c->cstreams[strm_epoch(s)] = 0;
 
     while (!splay_empty(&s->in_ooo)) {
         struct pkt_meta * const p = splay_min(ooo_by_off, &s->in_ooo);
-        // warn(ERR, "idx %u", pm_idx(p));
+        // warn(ERR, "idx %u", pm_idx(c->w, p));
         ensure(splay_remove(ooo_by_off, &s->in_ooo, p), "removed");
-        free_iov(w_iov(c->w, pm_idx(p)));
+        free_iov(w_iov(c->w, pm_idx(c->w, p)));
     }
     q_free(&s->out);
+    if (s->id >= 0)
+        // data the app never read doesn't hold on to connection credit
+        track_bytes_read(s, w_iov_sq_len(&s->in));
     q_free(&s->in);
 
     free(s);
@@ -171,6 +186,13 @@ void track_bytes_in(struct q_stream * const s, const uint64_t n)
 }
 
 
+void track_bytes_read(struct q_stream * const s, const uint64_t n)
+{
+    s->c->in_data_read += n;
+    s->in_data_read += n;
+}
+
+
 void track_bytes_out(struct q_stream * const s, const uint64_t n)
 {
     if (s->id >= 0)
@@ -184,10 +206,12 @@ static void __attribute__((nonnull)) reset_pm(const struct w_iov_sq * const q)
 {
     struct w_iov * v;
     sq_foreach (v, q, next) {
-        // don't reset stream_data_start!
+        // don't reset stream_data_start or buffer ownership!
+        const bool is_owned = meta(v).is_owned;
         memset(&meta(v), 0, offsetof(struct pkt_meta, stream_data_start));
         memset(&meta(v).stream_data_len, 0,
                sizeof(meta(v)) - offsetof(struct pkt_meta, stream_data_len));
+        meta(v).is_owned = is_owned;
     }
 }
 
@@ -195,7 +219,7 @@ static void __attribute__((nonnull)) reset_pm(const struct w_iov_sq * const q)
 void reset_stream(struct q_stream * const s, const bool forget)
 {
     // reset stream offsets
-    s->in_data_off = s->in_data = s->out_data = 0;
+    s->in_data_off = s->in_data = s->in_data_read = s->out_data = 0;
 
     if (forget) {
         s->out_nxt = s->out_una = 0;
@@ -217,6 +241,9 @@ void reset_stream(struct q_stream * const s, const bool forget)
         // reset pkt meta
         reset_pm(&s->in);
         reset_pm(&s->out);
+
+        if (s->out_una)
+            sched_stream_tx(s);
     }
 }
 
@@ -226,12 +253,18 @@ void do_stream_fc(struct q_stream * const s)
     if (s->c->state != conn_estb || s->id < 0)
         return;
 
-    const uint64_t inc =
-        is_uni(s->id) ? INIT_STRM_DATA_UNI : INIT_STRM_DATA_BIDI;
+    // extend the window once the app read half of it
+    struct q_conn * const c = s->c;
+    if (s->in_data_read + s->in_data_wnd / 2 >
+        MAX(s->in_data_max, s->new_in_data_max)) {
+        autotune_fc_wnd(c, &s->in_data_wnd, &s->fc_t, ped(c->w)->fc_budget);
+
+        // keep the connection window ahead of the stream windows
+        grow_conn_wnd(c, s->in_data_wnd + s->in_data_wnd / 2);
 
-    if (s->in_data + 2 * MAX_PKT_LEN + inc > s->in_data_max) {
-        s->tx_max_stream_data = s->c->needs_tx = true;
-        s->new_in_data_max = s->in_data_max + 2 * inc;
+        s->tx_max_stream_data = c->needs_tx = true;
+        s->new_in_data_max = s->in_data_read + s->in_data_wnd;
+        sched_stream_ctrl(s);
     }
 }
 
@@ -240,19 +273,24 @@ void do_stream_id_fc(struct q_conn * const c, const int64_t sid)
 {
 
     if (is_srv_ini(sid) == c->is_clnt) {
-        // this is a remote stream
-        if (is_uni(sid)) {
-            if ((sid >> 2) + 1 == c->tp_in.max_uni_streams) {
+        // this is a remote stream; grant more once the peer used up half of
+        // the last grant, and grant more the faster it opens streams
+        const bool uni = is_uni(sid);
+        int64_t * const new_max = uni ? &c->tp_in.new_max_uni_streams
+                                      : &c->tp_in.new_max_bidi_streams;
+        uint64_t * const wnd = uni ? &c->sid_wnd_uni : &c->sid_wnd_bidi;
+        const int64_t cnt = (sid >> 2) + 1;
+        if (cnt + (int64_t)(*wnd / 2) >=
+            MAX(*new_max, uni ? c->tp_in.max_uni_streams
+                              : c->tp_in.max_bidi_streams)) {
+            autotune_fc_wnd(c, wnd, uni ? &c->sid_t_uni : &c->sid_t_bidi,
+                            MAX_STRM_CREDIT);
+            *new_max = cnt + (int64_t)*wnd;
+            if (uni)
                 c->tx_max_sid_uni = true;
-                c->tp_in.new_max_uni_streams =
-                    c->tp_in.max_uni_streams + INIT_MAX_UNI_STREAMS;
-            }
-        } else {
-            if ((sid >> 2) + 1 == c->tp_in.max_bidi_streams) {
+            else
                 c->tx_max_sid_bidi = true;
-                c->tp_in.new_max_bidi_streams =
-                    c->tp_in.max_bidi_streams + INIT_MAX_BIDI_STREAMS;
-            }
+            c->needs_tx = true;
         }
 
     } else {
@@ -277,4 +315,102 @@ void concat_out(struct q_stream * const s, struct w_iov_sq * const q)
         s->out_una = sq_first(q);
 
     sq_concat(&s->out, q);
+    if (s->out_una)
+        sched_stream_tx(s);
+}
+
+
+void pack_out(struct q_stream * const s, struct w_iov_sq * const q)
+{
+    // copy small writes into the unsent tail of the stream (or into each
+    // other), so they share packets instead of getting one each; the small
+    // buffers of several streams share pkts via carry_stream_frames()
+    struct w_iov * t = sq_last(&s->out, w_iov, next);
+    if (t && (meta(t).is_owned == false || meta(t).tx_len || meta(t).is_lost))
+        t = 0;
+
+    struct w_iov_sq packed = w_iov_sq_initializer(packed);
+    while (!sq_empty(q)) {
+        struct w_iov * const v = sq_first(q);
+        sq_remove_head(q, next);
+
+        if (t && meta(t).stream_data_start == meta(v).stream_data_start) {
+            const uint16_t max =
+                (uint16_t)(s->c->pmtu - AEAD_LEN - meta(t).stream_data_start);
+            const uint16_t n =
+                (uint16_t)MIN(max > t->len ? max - t->len : 0, v->len);
+            memcpy(&t->buf[t->len], v->buf, n);
+            t->len += n;
+            if (n == v->len) {
+                free_iov(v);
+                continue;
+            }
+            memmove(v->buf, &v->buf[n], (size_t)(v->len - n));
+            v->len -= n;
+        }
+
+        sq_insert_tail(&packed, v, next);
+        t = v;
+    }
+    sq_concat(q, &packed);
+}
+
+
+void free_acked_out(struct q_stream * const s)
+{
+    // release ACKed data written by q_write_async() from the front of the queue
+    while (!sq_empty(&s->out)) {
+        struct w_iov * const v = sq_first(&s->out);
+        if (v == s->out_una || v == s->out_nxt || meta(v).is_owned == false ||
+            meta(v).is_acked == false)
+            break;
+        sq_remove_head(&s->out, next);
+        free_iov(v);
+    }
+}
+
+
+void sched_stream_tx(struct q_stream * const s)
+{
+    // crypto "streams" are always visited by tx()
+    if (s->in_txq || s->id < 0)
+        return;
+    sq_insert_tail(&s->c->strms_tx, s, next_tx);
+    s->in_txq = true;
+}
+
+
+void sched_stream_ctrl(struct q_stream * const s)
+{
+    if (s->in_ctrlq || s->id < 0)
+        return;
+    sq_insert_tail(&s->c->strms_ctrl, s, next_ctrl);
+    s->in_ctrlq = true;
+}
+
+
+void sched_stream_rx(struct q_stream * const s)
+{
+    if (s->in_rxq || s->id < 0)
+        return;
+    sq_insert_tail(&s->c->strms_rx, s, next_rx);
+    s->in_rxq = true;
+}
+
+
+void unsched_streams(struct q_conn * const c)
+{
+    // empty all stream queues, so free_stream() doesn't need to unlink
+    while (!sq_empty(&c->strms_tx)) {
+        sq_first(&c->strms_tx)->in_txq = false;
+        sq_remove_head(&c->strms_tx, next_tx);
+    }
+    while (!sq_empty(&c->strms_ctrl)) {
+        sq_first(&c->strms_ctrl)->in_ctrlq = false;
+        sq_remove_head(&c->strms_ctrl, next_ctrl);
+    }
+    while (!sq_empty(&c->strms_rx)) {
+        sq_first(&c->strms_rx)->in_rxq = false;
+        sq_remove_head(&c->strms_rx, next_rx);
+    }
 }
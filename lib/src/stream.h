@@ -43,8 +43,12 @@
 #define INIT_STRM_DATA_BIDI 65535
 #define INIT_STRM_DATA_UNI 65535
 #define INIT_MAX_UNI_STREAMS 2
+#define MAX_STRM_CREDIT 1024 ///< Max. streams granted ahead of the peer.
 #define INIT_MAX_BIDI_STREAMS 6 // XXX picoquic won't respect a lower count
 
+#define DEF_STRM_URGENCY 3
+#define DEF_STRM_WEIGHT 1
+
 #define STRM_STATE(k, v) k = v
 #define STRM_STATES                                                            \
     STRM_STATE(strm_idle, 0), STRM_STATE(strm_open, 1),                        \
@@ -60,11 +64,15 @@ extern const char * const strm_state_str[];
 
 struct q_stream {
     splay_entry(q_stream) node;
+    sq_entry(q_stream) next_tx;   ///< For the connection's strms_tx queue.
+    sq_entry(q_stream) next_ctrl; ///< For the connection's strms_ctrl queue.
+    sq_entry(q_stream) next_rx;   ///< For the connection's strms_rx queue.
     struct q_conn * c;
 
     struct w_iov_sq out;    ///< Tail queue containing outbound data.
     struct w_iov * out_una; ///< Lowest un-ACK'ed data chunk.
     struct w_iov * out_nxt; ///< Lowest unsent data chunk.
+    struct w_iov * tx_pos;  ///< Where the next round of tx() resumes.
     uint64_t out_data;      ///< Current outbound stream offset (= data sent).
     uint64_t out_data_max;  ///< Outbound max_stream_data.
 
@@ -73,15 +81,24 @@ struct q_stream {
     uint64_t in_data_max;     ///< Inbound max_stream_data.
     uint64_t new_in_data_max; ///< New inbound max_stream_data (for update).
     uint64_t in_data;         ///< In-order stream data received (total).
+    uint64_t in_data_read;    ///< Stream data returned to the app (total).
     uint64_t in_data_off;     ///< Next in-order stream data offset expected.
+    uint64_t in_data_wnd;     ///< Inbound window size, see autotune_fc_wnd().
+    ev_tstamp fc_t;           ///< When @p in_data_wnd was last used.
 
     int64_t id;
     strm_state_t state;
     uint8_t tx_max_stream_data : 1; ///< We need to open the receive window.
     uint8_t blocked : 1;            ///< We are receive-window-blocked.
     uint8_t tx_fin : 1;             ///< We need to send a FIN.
-    uint8_t : 5;
-    uint8_t _unused[3];
+    uint8_t in_txq : 1;             ///< Stream is listed in c->strms_tx.
+    uint8_t in_ctrlq : 1;           ///< Stream is listed in c->strms_ctrl.
+    uint8_t in_rxq : 1;             ///< Stream is listed in c->strms_rx.
+    uint8_t corked : 1;             ///< Hold back a partial last packet.
+    uint8_t : 1;
+    uint8_t urgency; ///< Scheduling urgency, lower is more urgent.
+    uint8_t weight;  ///< Scheduling weight, in packets per round.
+    uint8_t _unused;
 };
 
 
@@ -183,6 +200,9 @@ extern void __attribute__((nonnull)) free_stream(struct q_stream * const s);
 extern void __attribute__((nonnull))
 track_bytes_in(struct q_stream * const s, const uint64_t n);
 
+extern void __attribute__((nonnull))
+track_bytes_read(struct q_stream * const s, const uint64_t n);
+
 extern void __attribute__((nonnull))
 track_bytes_out(struct q_stream * const s, const uint64_t n);
 
@@ -200,5 +220,20 @@ do_stream_id_fc(struct q_conn * const c, const int64_t sid);
 extern void __attribute__((nonnull))
 concat_out(struct q_stream * const s, struct w_iov_sq * const q);
 
+extern void __attribute__((nonnull))
+pack_out(struct q_stream * const s, struct w_iov_sq * const q);
+
+extern void __attribute__((nonnull)) free_acked_out(struct q_stream * const s);
+
+extern void __attribute__((nonnull)) sched_stream_tx(struct q_stream * const s);
+
+extern void __attribute__((nonnull))
+sched_stream_ctrl(struct q_stream * const s);
+
+extern void __attribute__((nonnull)) sched_stream_rx(struct q_stream * const s);
+
+extern void __attribute__((nonnull))
+unsched_streams(struct q_conn * const c);
+
 extern int64_t __attribute__((nonnull))
 max_sid(const int64_t sid, const struct q_conn * const c);
@@ -27,6 +27,7 @@
 
 #include <assert.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -108,8 +109,12 @@ tls_ticket_cmp(const struct tls_ticket * const a,
 SPLAY_PROTOTYPE(tickets_by_peer, tls_ticket, node, tls_ticket_cmp)
 SPLAY_GENERATE(tickets_by_peer, tls_ticket, node, tls_ticket_cmp)
 
-ptls_context_t tls_ctx = {0};
+// XXX the following TLS state is shared by all engines; it is set up by the
+// first call to init_tls_ctx() and torn down by the last call to free_tls_ctx()
+static uint32_t tls_ctx_cnt = 0;
+static pthread_mutex_t tls_ctx_lock = PTHREAD_MUTEX_INITIALIZER; ///< For above.
 static struct tickets_by_peer tickets = {splay_initializer(tickets), {"\0"}};
+static pthread_mutex_t tickets_lock = PTHREAD_MUTEX_INITIALIZER; ///< For above.
 
 #ifdef PTLS_OPENSSL
 static ptls_openssl_sign_certificate_t sign_cert = {0};
@@ -123,6 +128,7 @@ static const size_t alpn_cnt = sizeof(alpn) / sizeof(alpn[0]);
 
 static struct cipher_ctx dec_tckt;
 static struct cipher_ctx enc_tckt;
+static pthread_mutex_t tckt_lock = PTHREAD_MUTEX_INITIALIZER; ///< For *_tckt.
 
 #define COOKIE_LEN 64
 static uint8_t cookie[COOKIE_LEN];
@@ -150,6 +156,9 @@ static bool do_tls_key_flips = false;
 
 #define TP_MAX (TP_ORIGINAL_CONNECTION_ID + 1)
 
+// outside of the TP_MAX range [draft-iyengar-quic-delayed-ack]
+#define TP_MIN_ACK_DELAY 0xde1a
+
 
 // quicly shim
 #define HKDF_BASE_LABEL "quic "
@@ -442,6 +451,13 @@ static int chk_tp(ptls_t * tls __attribute__((unused)),
         uint16_t tp = 0;
         i = dec(&tp, buf, len, i, sizeof(tp), "0x%04x");
 
+        if (tp == TP_MIN_ACK_DELAY) {
+            // the peer can handle ACK_FREQUENCY frames
+            dec_tp(&c->tp_out.min_ack_del, sizeof(uint32_t));
+            warn(INF, "\tmin_ack_delay = %u", c->tp_out.min_ack_del);
+            continue;
+        }
+
         // skip unknown TPs
         if (tp >= TP_MAX) {
             uint16_t unknown_len;
@@ -666,6 +682,7 @@ void init_tp(struct q_conn * const c)
     enc_tp(c, TP_INITIAL_MAX_DATA, c->tp_in.max_data, sizeof(uint32_t));
     enc_tp(c, TP_ACK_DELAY_EXPONENT, c->tp_in.ack_del_exp, sizeof(uint8_t));
     enc_tp(c, TP_MAX_ACK_DELAY, c->tp_in.max_ack_del, sizeof(uint8_t));
+    enc_tp(c, TP_MIN_ACK_DELAY, c->tp_in.min_ack_del, sizeof(uint32_t));
     enc_tp(c, TP_MAX_PACKET_SIZE, w_mtu(c->w), sizeof(uint16_t));
 
     if (!c->is_clnt) {
@@ -728,8 +745,10 @@ static int encrypt_ticket_cb(ptls_encrypt_ticket_t * self
         dst->off += sizeof(tid);
 
         // now encrypt ticket
+        pthread_mutex_lock(&tckt_lock);
         dst->off += ptls_aead_encrypt(enc_tckt.aead, dst->base + dst->off,
                                       src.base, src.len, tid, 0, 0);
+        pthread_mutex_unlock(&tckt_lock);
 
     } else {
         if (src.len < quant_commit_hash_len + sizeof(tid) +
@@ -749,8 +768,10 @@ static int encrypt_ticket_cb(ptls_encrypt_ticket_t * self
         src_base += sizeof(tid);
         src_len -= sizeof(tid);
 
+        pthread_mutex_lock(&tckt_lock);
         const size_t n = ptls_aead_decrypt(dec_tckt.aead, dst->base + dst->off,
                                            src_base, src_len, tid, 0, 0);
+        pthread_mutex_unlock(&tckt_lock);
 
         if (n > src_len) {
             warn(
@@ -778,6 +799,7 @@ static int save_ticket_cb(ptls_save_ticket_t * self __attribute__((unused)),
                           ptls_iovec_t src)
 {
     struct q_conn * const c = *ptls_get_data_ptr(tls);
+    pthread_mutex_lock(&tickets_lock);
     warn(NTE, "saving 0-RTT tickets to %s", tickets.file_name);
 
     FILE * const fp = fopen(tickets.file_name, "wbe");
@@ -845,6 +867,7 @@ static int save_ticket_cb(ptls_save_ticket_t * self __attribute__((unused)),
     }
 
     fclose(fp);
+    pthread_mutex_unlock(&tickets_lock);
     return 0;
 }
 
@@ -858,7 +881,8 @@ void init_tls(struct q_conn * const c)
     if (c->tls.t)
         // we are re-initializing during version negotiation
         free_tls(c);
-    ensure((c->tls.t = ptls_new(&tls_ctx, !c->is_clnt)) != 0, "ptls_new");
+    ensure((c->tls.t = ptls_new(&ped(c->w)->tls_ctx, !c->is_clnt)) != 0,
+           "ptls_new");
     *ptls_get_data_ptr(c->tls.t) = c;
     if (c->is_clnt)
         ensure(ptls_set_server_name(c->tls.t, c->peer_name, 0) == 0,
@@ -889,6 +913,7 @@ void init_tls(struct q_conn * const c)
     // try to find an existing session ticket
     struct tls_ticket which = {.sni = c->peer_name,
                                .alpn = (char *)alpn[0].base};
+    pthread_mutex_lock(&tickets_lock);
     struct tls_ticket * t = splay_find(tickets_by_peer, &tickets, &which);
     if (t == 0) {
         // if we couldn't find a ticket, try without an alpn
@@ -896,12 +921,17 @@ void init_tls(struct q_conn * const c)
         t = splay_find(tickets_by_peer, &tickets, &which);
     }
     if (t) {
-        hshk_prop->client.session_ticket =
-            ptls_iovec_init(t->ticket, t->ticket_len);
+        // use a copy, since other engines may update the ticket meanwhile
+        c->tls.tckt.base = malloc(t->ticket_len);
+        ensure(c->tls.tckt.base, "malloc");
+        memcpy(c->tls.tckt.base, t->ticket, t->ticket_len);
+        c->tls.tckt.len = t->ticket_len;
+        hshk_prop->client.session_ticket = c->tls.tckt;
         memcpy(&c->tp_out, &t->tp, sizeof(t->tp));
         c->vers_initial = c->vers = t->vers;
         c->try_0rtt = 1;
     }
+    pthread_mutex_unlock(&tickets_lock);
 
     init_prot(c);
 }
@@ -926,6 +956,8 @@ void free_tls(struct q_conn * const c)
 {
     if (c->tls.t)
         ptls_free(c->tls.t);
+    free(c->tls.tckt.base);
+    c->tls.tckt = ptls_iovec_init(0, 0);
     ptls_clear_memory(c->tls.secret, sizeof(c->tls.secret));
     free_prot(c);
 }
@@ -988,7 +1020,8 @@ int tls_io(struct q_stream * const s, struct w_iov * const iv)
             continue;
         // warn(DBG, "epoch %u: off %u len %u", e, epoch_off[e], out_len);
         struct w_iov_sq o = w_iov_sq_initializer(o);
-        alloc_off(w_engine(c->sock), &o, (uint32_t)out_len, OFFSET_HSHK);
+        alloc_off(w_engine(c->sock), &o, (uint32_t)out_len, MAX_PKT_LEN,
+                  OFFSET_HSHK);
         const uint8_t * data = tls_io.base + epoch_off[e];
         struct w_iov * ov = 0;
         sq_foreach (ov, &o, next) {
@@ -1124,7 +1157,8 @@ static int update_traffic_key_cb(ptls_update_traffic_key_t * const self
 }
 
 
-void init_tls_ctx(const char * const cert,
+void init_tls_ctx(ptls_context_t * const tls_ctx,
+                  const char * const cert,
                   const char * const key,
                   const char * const ticket_store,
                   const char * const tls_log,
@@ -1135,48 +1169,59 @@ void init_tls_ctx(const char * const cert,
                   ,
                   const bool flip_keys)
 {
-    do_tls_key_flips = flip_keys;
+    // engines may be set up on different threads
+    pthread_mutex_lock(&tls_ctx_lock);
+    const bool first = tls_ctx_cnt++ == 0;
+    if (first)
+        do_tls_key_flips = flip_keys;
 
     if (key) {
 #ifdef PTLS_OPENSSL
-        FILE * const fp = fopen(key, "rbe");
-        ensure(fp, "could not open key %s", key);
-        EVP_PKEY * const pkey = PEM_read_PrivateKey(fp, 0, 0, 0);
-        fclose(fp);
-        ensure(pkey, "failed to load private key");
-        ptls_openssl_init_sign_certificate(&sign_cert, pkey);
-        EVP_PKEY_free(pkey);
+        if (first) {
+            FILE * const fp = fopen(key, "rbe");
+            ensure(fp, "could not open key %s", key);
+            EVP_PKEY * const pkey = PEM_read_PrivateKey(fp, 0, 0, 0);
+            fclose(fp);
+            ensure(pkey, "failed to load private key");
+            ptls_openssl_init_sign_certificate(&sign_cert, pkey);
+            EVP_PKEY_free(pkey);
+        }
 #else
         // XXX ptls_minicrypto_load_private_key() only works for ECDSA keys
-        const int ret = ptls_minicrypto_load_private_key(&tls_ctx, key);
+        const int ret = ptls_minicrypto_load_private_key(tls_ctx, key);
         ensure(ret == 0, "could not open key %s", key);
 #endif
     }
 
     if (cert) {
-        const int ret = ptls_load_certificates(&tls_ctx, cert);
+        const int ret = ptls_load_certificates(tls_ctx, cert);
         ensure(ret == 0, "ptls_load_certificates");
     }
 
     if (ticket_store) {
-        strncpy(tickets.file_name, ticket_store, MAXPATHLEN);
-        tls_ctx.save_ticket = &save_ticket;
-        read_tickets();
+        tls_ctx->save_ticket = &save_ticket;
+        if (first) {
+            pthread_mutex_lock(&tickets_lock);
+            strncpy(tickets.file_name, ticket_store, MAXPATHLEN);
+            read_tickets();
+            pthread_mutex_unlock(&tickets_lock);
+        }
     } else {
-        tls_ctx.encrypt_ticket = &encrypt_ticket;
-        tls_ctx.max_early_data_size = 0xffffffff;
-        tls_ctx.ticket_lifetime = 60 * 60 * 24;
-        tls_ctx.require_dhe_on_psk = 0;
+        tls_ctx->encrypt_ticket = &encrypt_ticket;
+        tls_ctx->max_early_data_size = 0xffffffff;
+        tls_ctx->ticket_lifetime = 60 * 60 * 24;
+        tls_ctx->require_dhe_on_psk = 0;
     }
 
-    if (tls_log) {
+    if (tls_log && tls_log_file == 0) {
         tls_log_file = fopen(tls_log, "wbe");
         ensure(tls_log_file, "could not open TLS log %s", tls_log);
     }
 
 #ifdef PTLS_OPENSSL
-    ensure(ptls_openssl_init_verify_certificate(&verifier, 0) == 0,
-           "ptls_openssl_init_verify_certificate");
+    if (first)
+        ensure(ptls_openssl_init_verify_certificate(&verifier, 0) == 0,
+               "ptls_openssl_init_verify_certificate");
 #endif
 
     static ptls_key_exchange_algorithm_t * key_exchanges[] = {
@@ -1189,18 +1234,18 @@ void init_tls_ctx(const char * const cert,
     static ptls_update_traffic_key_t update_traffic_key = {
         update_traffic_key_cb};
 
-    tls_ctx.cipher_suites =
+    tls_ctx->cipher_suites =
 #ifdef PTLS_OPENSSL
         ptls_openssl_cipher_suites;
 #else
         ptls_minicrypto_cipher_suites;
 #endif
-    tls_ctx.key_exchanges = key_exchanges;
-    tls_ctx.on_client_hello = &on_client_hello;
-    tls_ctx.update_traffic_key = &update_traffic_key;
+    tls_ctx->key_exchanges = key_exchanges;
+    tls_ctx->on_client_hello = &on_client_hello;
+    tls_ctx->update_traffic_key = &update_traffic_key;
     if (tls_log)
-        tls_ctx.log_secret = &log_secret;
-    tls_ctx.random_bytes =
+        tls_ctx->log_secret = &log_secret;
+    tls_ctx->random_bytes =
 #ifdef PTLS_OPENSSL
         ptls_openssl_random_bytes;
 #else
@@ -1208,26 +1253,36 @@ void init_tls_ctx(const char * const cert,
 #endif
 
 #ifdef PTLS_OPENSSL
-    tls_ctx.sign_certificate = &sign_cert.super;
+    tls_ctx->sign_certificate = &sign_cert.super;
     if (verify_certs)
-        tls_ctx.verify_certificate = &verifier.super;
+        tls_ctx->verify_certificate = &verifier.super;
 #endif
-    tls_ctx.get_time = &ptls_get_time;
-    tls_ctx.hkdf_label_prefix = HKDF_BASE_LABEL;
-    tls_ctx.omit_end_of_early_data = true;
+    tls_ctx->get_time = &ptls_get_time;
+    tls_ctx->hkdf_label_prefix = HKDF_BASE_LABEL;
+    tls_ctx->omit_end_of_early_data = true;
 
-    ptls_openssl_random_bytes(cookie, COOKIE_LEN);
-
-    init_ticket_prot();
+    if (first) {
+        ptls_openssl_random_bytes(cookie, COOKIE_LEN);
+        init_ticket_prot();
+    }
+    pthread_mutex_unlock(&tls_ctx_lock);
 }
 
 
-void free_tls_ctx(void)
+void free_tls_ctx(ptls_context_t * const tls_ctx __attribute__((unused)))
 {
+    pthread_mutex_lock(&tls_ctx_lock);
+    if (--tls_ctx_cnt) {
+        // other engines are still using the shared state
+        pthread_mutex_unlock(&tls_ctx_lock);
+        return;
+    }
+
     dispose_cipher(&dec_tckt);
     dispose_cipher(&enc_tckt);
 
     // free ticket cache
+    pthread_mutex_lock(&tickets_lock);
     struct tls_ticket *t, *tmp;
     for (t = splay_min(tickets_by_peer, &tickets); t != 0; t = tmp) {
         tmp = splay_next(tickets_by_peer, &tickets, t);
@@ -1237,6 +1292,8 @@ void free_tls_ctx(void)
         free(t->ticket);
         free(t);
     }
+    pthread_mutex_unlock(&tickets_lock);
+    pthread_mutex_unlock(&tls_ctx_lock);
 }
 
 
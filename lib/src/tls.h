@@ -57,14 +57,12 @@ struct tls {
     ptls_raw_extension_t tp_ext[2];
     ptls_handshake_properties_t tls_hshk_prop;
     size_t max_early_data;
+    ptls_iovec_t tckt; ///< Copy of the session ticket we try to resume with.
     epoch_t epoch_out; // TODO: remove
     uint8_t tp_buf[196];
 };
 
 
-/// TLS context.
-extern ptls_context_t tls_ctx;
-
 extern void __attribute__((nonnull)) init_prot(struct q_conn * const c);
 
 extern void __attribute__((nonnull)) init_tls(struct q_conn * const c);
@@ -76,14 +74,17 @@ extern void __attribute__((nonnull)) free_tls(struct q_conn * const c);
 extern int __attribute__((nonnull(1)))
 tls_io(struct q_stream * const s, struct w_iov * const iv);
 
-extern void init_tls_ctx(const char * const cert,
-                         const char * const key,
-                         const char * const ticket_store,
-                         const char * const tls_log,
-                         const bool verify_certs,
-                         const bool flip_keys);
+extern void __attribute__((nonnull(1)))
+init_tls_ctx(ptls_context_t * const tls_ctx,
+             const char * const cert,
+             const char * const key,
+             const char * const ticket_store,
+             const char * const tls_log,
+             const bool verify_certs,
+             const bool flip_keys);
 
-extern void free_tls_ctx(void);
+extern void __attribute__((nonnull))
+free_tls_ctx(ptls_context_t * const tls_ctx);
 
 extern uint16_t __attribute__((nonnull))
 dec_aead(struct q_conn * const c,
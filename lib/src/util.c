@@ -35,14 +35,9 @@
 struct q_stream;
 
 
-void q_chunk_str(struct w_engine * const w,
-                 const char * const str,
-                 const size_t len,
-                 struct w_iov_sq * o)
+static void __attribute__((nonnull))
+copy_str(const char * const str, struct w_iov_sq * o)
 {
-    // allocate tail queue
-    q_alloc(w, o, len);
-
     // chunk up string
     const char * i = str;
     struct w_iov * v = 0;
@@ -53,15 +48,27 @@ void q_chunk_str(struct w_engine * const w,
 }
 
 
-void q_write_str(struct w_engine * const w,
+void q_chunk_str(struct q_engine * const qe,
+                 const char * const str,
+                 const size_t len,
+                 struct w_iov_sq * o)
+{
+    // allocate tail queue
+    q_alloc(qe, o, len);
+    copy_str(str, o);
+}
+
+
+void q_write_str(struct q_engine * const qe __attribute__((unused)),
                  struct q_stream * const s,
                  const char * const str,
                  const size_t len,
                  const bool fin)
 {
-    // allocate tail queue
+    // allocate tail queue in the packet size of the connection
     struct w_iov_sq o = w_iov_sq_initializer(o);
-    q_chunk_str(w, str, len, &o);
+    q_alloc_stream(s, &o, len);
+    copy_str(str, &o);
 
     // write it and free tail queue
     q_write(s, &o, fin);
@@ -69,15 +76,15 @@ void q_write_str(struct w_engine * const w,
 }
 
 
-void q_write_file(struct w_engine * const w,
+void q_write_file(struct q_engine * const qe __attribute__((unused)),
                   struct q_stream * const s,
                   const int f,
                   const size_t len,
                   const bool fin)
 {
-    // allocate tail queue
+    // allocate tail queue in the packet size of the connection
     struct w_iov_sq o = w_iov_sq_initializer(o);
-    q_alloc(w, &o, len);
+    q_alloc_stream(s, &o, len);
 
     struct w_iov * v;
     sq_foreach (v, &o, next) {
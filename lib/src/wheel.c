@@ -0,0 +1,210 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2018, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <stdint.h>
+#include <sys/param.h>
+
+#include <ev.h>
+
+#include "wheel.h"
+
+
+#define WHL_RANGE (UINT64_C(1) << (WHL_BITS * WHL_LEVELS))
+
+
+static inline uint64_t __attribute__((always_inline, const))
+to_ticks(const ev_tstamp t)
+{
+    return (uint64_t)(t / WHL_TICK);
+}
+
+
+static void __attribute__((nonnull))
+place(struct wheel * const w, struct tmr * const t)
+{
+    // the level is determined by how far in the future the timer expires;
+    // timers beyond the range of the wheel are parked in its last level, and
+    // are placed again when their slot there cascades
+    const uint64_t delta = t->expiry - w->now;
+    uint8_t lvl = 0;
+    while (lvl < WHL_LEVELS - 1 &&
+           delta >= (UINT64_C(1) << (WHL_BITS * (lvl + 1))))
+        lvl++;
+    const uint64_t at = delta < WHL_RANGE ? t->expiry : w->now + WHL_RANGE - 1;
+
+    struct tmr ** const head =
+        &w->slot[lvl][(at >> (WHL_BITS * lvl)) & (WHL_SLOTS - 1)];
+    t->next = *head;
+    if (t->next)
+        t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+
+static void __attribute__((nonnull)) unlink_tmr(struct tmr * const t)
+{
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->next = 0;
+    t->pprev = 0;
+}
+
+
+static void __attribute__((nonnull))
+arm(struct wheel * const w, const uint64_t tick)
+{
+    // wake up half a tick late, so that ev_now() is safely inside the tick
+    const ev_tstamp after = ((double)tick + 0.5) * WHL_TICK - ev_now(w->loop);
+    w->wakeup = tick;
+    ev_timer_stop(w->loop, &w->alarm);
+    ev_timer_set(&w->alarm, MAX(after, 0), 0);
+    ev_timer_start(w->loop, &w->alarm);
+}
+
+
+static void __attribute__((nonnull)) rearm(struct wheel * const w)
+{
+    if (w->cnt == 0) {
+        ev_timer_stop(w->loop, &w->alarm);
+        w->wakeup = UINT64_MAX;
+        return;
+    }
+
+    // wake up for the next non-empty level-0 slot, or else for the next
+    // cascade from level 1
+    uint64_t next = (w->now | (WHL_SLOTS - 1)) + 1;
+    for (uint64_t t = w->now + 1; t < next; t++)
+        if (w->slot[0][t & (WHL_SLOTS - 1)]) {
+            next = t;
+            break;
+        }
+    arm(w, next);
+}
+
+
+static void __attribute__((nonnull)) tick(struct wheel * const w)
+{
+    w->now++;
+
+    // move the timers of any higher-level slots that start now further down
+    for (uint8_t lvl = 1; lvl < WHL_LEVELS; lvl++) {
+        if (w->now & ((UINT64_C(1) << (WHL_BITS * lvl)) - 1))
+            break;
+        struct tmr ** const head =
+            &w->slot[lvl][(w->now >> (WHL_BITS * lvl)) & (WHL_SLOTS - 1)];
+        struct tmr * t = *head;
+        *head = 0;
+        while (t) {
+            struct tmr * const next = t->next;
+            place(w, t);
+            t = next;
+        }
+    }
+
+    // fire the timers that expire now; callbacks may re-arm timers, but
+    // always for a later tick
+    struct tmr ** const head = &w->slot[0][w->now & (WHL_SLOTS - 1)];
+    while (*head) {
+        struct tmr * const t = *head;
+        unlink_tmr(t);
+        w->cnt--;
+        t->cb(t);
+    }
+}
+
+
+static void __attribute__((nonnull))
+whl_alarm(struct ev_loop * const l,
+          ev_timer * const a,
+          int e __attribute__((unused)))
+{
+    struct wheel * const w = a->data;
+    w->wakeup = UINT64_MAX;
+
+    const uint64_t target = to_ticks(ev_now(l));
+    while (w->now < target) {
+        if (w->cnt == 0) {
+            w->now = target;
+            break;
+        }
+        tick(w);
+    }
+
+    rearm(w);
+}
+
+
+void whl_init(struct wheel * const w, struct ev_loop * const loop)
+{
+    *w = (struct wheel){.loop = loop,
+                        .now = to_ticks(ev_now(loop)),
+                        .wakeup = UINT64_MAX};
+    ev_init(&w->alarm, whl_alarm);
+    w->alarm.data = w;
+}
+
+
+void whl_free(struct wheel * const w)
+{
+    ev_timer_stop(w->loop, &w->alarm);
+}
+
+
+void tmr_start(struct wheel * const w,
+               struct tmr * const t,
+               const ev_tstamp after)
+{
+    if (tmr_active(t)) {
+        unlink_tmr(t);
+        w->cnt--;
+    }
+
+    const ev_tstamp now = ev_now(w->loop);
+    if (w->cnt == 0)
+        // an empty wheel isn't advanced, catch up
+        w->now = MAX(w->now, to_ticks(now));
+
+    // never expire early, and never in the current tick
+    t->expiry = MAX(w->now + 1, to_ticks(now + MAX(after, 0)) + 1);
+    place(w, t);
+    w->cnt++;
+
+    const uint64_t wake = MIN(t->expiry, (w->now | (WHL_SLOTS - 1)) + 1);
+    if (wake < w->wakeup)
+        arm(w, wake);
+}
+
+
+void tmr_stop(struct wheel * const w, struct tmr * const t)
+{
+    if (tmr_active(t) == false)
+        return;
+    unlink_tmr(t);
+    w->cnt--;
+}
@@ -0,0 +1,101 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2018, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <ev.h>
+
+
+#ifndef WHL_BITS
+#define WHL_BITS 6 ///< Log2 of the number of slots per level.
+#endif
+#define WHL_SLOTS (1 << WHL_BITS)
+
+#define WHL_LEVELS 4   ///< With 1 ms ticks, this covers about 4.6 hours.
+#define WHL_TICK 0.001 ///< Granularity of the wheel (in sec).
+
+struct tmr;
+struct wheel;
+
+typedef void (*tmr_cb)(struct tmr * const t);
+
+
+/// A timer on a struct wheel. Arming and canceling are O(1).
+struct tmr {
+    struct tmr * next;   ///< Next timer in the same slot.
+    struct tmr ** pprev; ///< Pointer pointing to us; zero if inactive.
+    uint64_t expiry;     ///< Expiry time (in ticks).
+    ev_tstamp repeat;    ///< Timeout used by tmr_again() (in sec).
+    tmr_cb cb;           ///< Callback to call on expiry.
+    void * data;         ///< For use by the callback.
+};
+
+
+/// A hierarchical timing wheel, driven by a single ev_timer, which is only
+/// armed for the next tick at which anything needs to happen.
+struct wheel {
+    struct tmr * slot[WHL_LEVELS][WHL_SLOTS];
+    struct ev_loop * loop;
+    ev_timer alarm;  ///< Advances the wheel.
+    uint64_t now;    ///< Current time (in ticks).
+    uint64_t wakeup; ///< Tick @p alarm is armed for, or UINT64_MAX.
+    uint64_t cnt;    ///< Number of active timers.
+};
+
+
+static inline bool __attribute__((nonnull, always_inline))
+tmr_active(const struct tmr * const t)
+{
+    return t->pprev != 0;
+}
+
+
+static inline void __attribute__((nonnull, always_inline))
+tmr_init(struct tmr * const t, const tmr_cb cb, void * const data)
+{
+    *t = (struct tmr){.cb = cb, .data = data};
+}
+
+
+extern void __attribute__((nonnull))
+whl_init(struct wheel * const w, struct ev_loop * const loop);
+
+extern void __attribute__((nonnull)) whl_free(struct wheel * const w);
+
+extern void __attribute__((nonnull))
+tmr_start(struct wheel * const w, struct tmr * const t, const ev_tstamp after);
+
+extern void __attribute__((nonnull))
+tmr_stop(struct wheel * const w, struct tmr * const t);
+
+
+/// (Re-)arm timer @p t to expire after its @p repeat timeout, like
+/// ev_timer_again().
+#define tmr_again(w, t) tmr_start((w), (t), (t)->repeat)
@@ -35,8 +35,12 @@ extern "C" {
 
 #include <picotls/openssl.h> // IWYU pragma: keep
 
+#include "bitset.h"
 #include "conn.h" // IWYU pragma: keep
+#include "frame.h"
+#include "marshall.h"
 #include "pkt.h"
+#include "pn.h"
 #include "quic.h"
 #include "tls.h" // IWYU pragma: keep
 
@@ -46,6 +50,7 @@ extern "C" {
 
 
 static struct q_conn * c;
+static struct q_engine * qe;
 static struct w_engine * w;
 
 
@@ -79,6 +84,61 @@ BENCHMARK(BM_quic_encryption)
     ;
 
 
+static void BM_ack_processing(benchmark::State & state)
+{
+    const auto cwnd = uint64_t(state.range(0));
+    const auto stale = state.range(1) != 0;
+    struct pn_space * const pn = &c->pn_data.pn;
+    struct w_iov * const v = alloc_iov(w, MAX_PKT_LEN, 0);
+    uint64_t base = 0;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        // put a cwnd's worth of pkts in flight
+        for (uint64_t nr = base; nr < base + cwnd; nr++) {
+            struct w_iov * const p = alloc_iov(w, 0, 0);
+            meta(p).hdr.nr = nr;
+            meta(p).pn = pn;
+            meta(p).tx_len = MAX_PKT_LEN;
+            meta(p).tx_t = ev_now(qe->loop);
+            bit_set(NUM_FRAM_TYPES, FRAM_TYPE_PING, &meta(p).frames);
+            pmr_insert(&pn->sent_pkts, &meta(p));
+            c->rec.in_flight += MAX_PKT_LEN;
+        }
+        pn->lg_sent = base + cwnd - 1;
+
+        // ACK them in one block, which optionally also covers the previous
+        // cwnd's worth of already-ACKed pkts
+        const uint8_t type = FRAM_TYPE_ACK;
+        const uint64_t zero = 0;
+        const uint64_t block = stale && base ? 2 * cwnd - 1 : cwnd - 1;
+        meta(v).hdr.type = F_SH;
+        v->len = MAX_PKT_LEN;
+        uint16_t i = enc(v->buf, v->len, 0, &type, sizeof(type), 0, "0x%02x");
+        i = enc(v->buf, v->len, i, &pn->lg_sent, 0, 0, FMT_PNR_OUT);
+        i = enc(v->buf, v->len, i, &zero, 0, 0, "%" PRIu64);
+        i = enc(v->buf, v->len, i, &zero, 0, 0, "%" PRIu64);
+        i = enc(v->buf, v->len, i, &block, 0, 0, "%" PRIu64);
+        v->len = i;
+        state.ResumeTiming();
+
+        benchmark::DoNotOptimize(dec_ack_frame(c, v, 0));
+        base += cwnd;
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * cwnd)); // NOLINT
+
+    free_iov(v);
+}
+
+
+BENCHMARK(BM_ack_processing)
+    ->RangeMultiplier(4)
+    ->Ranges({{16, 16384}, {0, 1}})
+    // ->MinTime(3)
+    // ->UseRealTime()
+    ;
+
+
 // BENCHMARK_MAIN()
 
 int main(int argc, char ** argv)
@@ -93,7 +153,8 @@ int main(int argc, char ** argv)
 #ifndef NDEBUG
     util_dlevel = INF;
 #endif
-    w = q_init(i, nullptr, nullptr, nullptr, nullptr, false, false);
+    qe = q_init(i, nullptr, nullptr, nullptr, nullptr, false, false);
+    w = qe->w;
     __extension__ struct cid cid = {
         .len = 4,
 #if defined(__GNUC__) && !defined(__clang__)
@@ -106,5 +167,5 @@ int main(int argc, char ** argv)
     init_tls(c);
     benchmark::RunSpecifiedBenchmarks();
 
-    q_cleanup(w);
+    q_cleanup(qe);
 }
@@ -37,14 +37,17 @@
 #include <warpcore/warpcore.h>
 
 
-static struct w_engine * w;
+static struct q_engine * w;
 static struct q_conn *cc, *sc;
 
 
-static inline uint32_t io(const uint32_t len)
+static inline uint32_t io(struct q_conn * const clnt,
+                          struct q_conn * const serv,
+                          const uint32_t len,
+                          const bool async)
 {
     // reserve a new stream
-    struct q_stream * const cs = q_rsv_stream(cc, true);
+    struct q_stream * const cs = q_rsv_stream(clnt, true);
     if (unlikely(cs == nullptr))
         return 0;
 
@@ -53,12 +56,15 @@ static inline uint32_t io(const uint32_t len)
     q_alloc(w, &o, len);
 
     // send the data
-    q_write(cs, &o, true);
+    if (async)
+        q_write_async(cs, &o, true);
+    else
+        q_write(cs, &o, true);
     q_close_stream(cs);
 
     // read the data
     struct w_iov_sq i = w_iov_sq_initializer(i);
-    struct q_stream * const ss = q_read(sc, &i, true);
+    struct q_stream * const ss = q_read(serv, &i, true);
     if (likely(ss) && !q_peer_has_closed_stream(ss))
         q_readall_str(ss, &i);
     if (likely(ss))
@@ -75,8 +81,9 @@ static inline uint32_t io(const uint32_t len)
 static void BM_conn(benchmark::State & state)
 {
     const auto len = uint32_t(state.range(0));
+    const auto async = state.range(1) != 0;
     for (auto _ : state) {
-        const uint32_t ilen = io(len);
+        const uint32_t ilen = io(cc, sc, len, async);
         if (ilen != len) {
             state.SkipWithError("error");
             return;
@@ -86,11 +93,199 @@ static void BM_conn(benchmark::State & state)
 }
 
 
-BENCHMARK(BM_conn)->RangeMultiplier(2)->Range(1024, 1024 * 1024 * 16)
+BENCHMARK(BM_conn)
+    ->RangeMultiplier(2)
+    ->Ranges({{1024, 1024 * 1024 * 16}, {0, 1}})
     // ->Unit(benchmark::kMillisecond)
     ;
 
 
+static void io_fresh(benchmark::State & state,
+                     const uint32_t len,
+                     const double delay)
+{
+    // emulate a path with a one-way @p delay over loopback
+    q_set_tx_delay(w, delay);
+
+    // use a fresh connection, so state from earlier runs doesn't count
+    __extension__ const struct sockaddr_in sip = {
+        .sin_family = AF_INET,
+        .sin_port = htons(55555),
+        .sin_addr = {.s_addr = inet_addr("127.0.0.1")}};
+    struct q_conn * const dcc =
+        q_connect(w, &sip, "localhost", nullptr, nullptr, true, 0);
+    struct q_conn * const dsc = dcc ? q_accept(w, 0) : nullptr;
+    if (dcc && dsc)
+        for (auto _ : state) {
+            const uint32_t ilen = io(dcc, dsc, len, false);
+            if (ilen != len) {
+                state.SkipWithError("error");
+                break;
+            }
+        }
+    else
+        state.SkipWithError("could not connect");
+    state.SetBytesProcessed(int64_t(state.iterations() * len)); // NOLINT
+
+    if (dcc)
+        q_close(dcc);
+    if (dsc)
+        q_close(dsc);
+    q_set_tx_delay(w, 0);
+}
+
+
+static void BM_conn_delay(benchmark::State & state)
+{
+    const auto len = uint32_t(state.range(0));
+    const auto budget = uint64_t(state.range(1));
+
+    // a 10 ms RTT; a budget of zero keeps the initial flow control windows
+    q_set_fc_budget(w, budget);
+    io_fresh(state, len, 0.005);
+}
+
+
+BENCHMARK(BM_conn_delay)
+    ->Args({1024 * 1024 * 16, 0})
+    ->Args({1024 * 1024 * 16, 1024 * 1024 * 16})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+
+static void BM_cc(benchmark::State & state)
+{
+    const auto cc_algo = q_cc_t(state.range(0));
+    const auto len = uint32_t(state.range(1));
+
+    // a long-fat path with a 50 ms RTT
+    struct q_engine_stats pre;
+    struct q_engine_stats post;
+    q_set_default_cc(w, cc_algo);
+    q_engine_stats(w, &pre);
+    io_fresh(state, len, 0.025);
+    q_engine_stats(w, &post);
+    q_set_default_cc(w, q_cc_newreno);
+
+    // report how slow start ended
+    state.counters["ss_exits_delay"] =
+        double(post.ss_exits_delay - pre.ss_exits_delay);
+    state.counters["ss_exits_loss"] =
+        double(post.ss_exits_loss - pre.ss_exits_loss);
+}
+
+
+BENCHMARK(BM_cc)
+    ->Args({q_cc_newreno, 1024 * 1024 * 16})
+    ->Args({q_cc_cubic, 1024 * 1024 * 16})
+    ->Args({q_cc_bbr, 1024 * 1024 * 16})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+
+static void BM_conn_small(benchmark::State & state)
+{
+    const auto len = uint32_t(state.range(0));
+    const auto cork = state.range(1) != 0;
+    const uint32_t cnt = 256;
+    for (auto _ : state) {
+        // send many small messages on a stream, with a q_write() each
+        struct q_stream * const cs = q_rsv_stream(cc, true);
+        if (unlikely(cs == nullptr)) {
+            state.SkipWithError("no stream");
+            return;
+        }
+        if (cork)
+            q_stream_cork(cs);
+        for (uint32_t n = 0; n < cnt; n++) {
+            struct w_iov_sq o = w_iov_sq_initializer(o);
+            q_alloc(w, &o, len);
+            q_write(cs, &o, n == cnt - 1);
+            q_free(&o);
+        }
+        q_close_stream(cs);
+
+        // read the data
+        struct w_iov_sq i = w_iov_sq_initializer(i);
+        struct q_stream * const ss = q_read(sc, &i, true);
+        if (likely(ss) && !q_peer_has_closed_stream(ss))
+            q_readall_str(ss, &i);
+        if (likely(ss))
+            q_close_stream(ss);
+
+        const uint32_t ilen = w_iov_sq_len(&i);
+        q_free(&i);
+        if (ilen != cnt * len) {
+            state.SkipWithError("error");
+            return;
+        }
+    }
+    state.SetBytesProcessed(int64_t(state.iterations() * cnt * len)); // NOLINT
+}
+
+
+BENCHMARK(BM_conn_small)->RangeMultiplier(4)->Ranges({{16, 1024}, {0, 1}});
+
+
+static void BM_conn_pack(benchmark::State & state)
+{
+    const auto len = uint32_t(state.range(0));
+    const auto strms = uint32_t(state.range(1));
+    const uint32_t cnt = 100;
+    struct q_engine_stats pre;
+    q_engine_stats(w, &pre);
+    for (auto _ : state) {
+        // spread small q_write_async() calls round-robin over the streams
+        struct q_stream * cs[cnt];
+        for (uint32_t n = 0; n < strms; n++) {
+            cs[n] = q_rsv_stream(cc, true);
+            if (unlikely(cs[n] == nullptr)) {
+                state.SkipWithError("no stream");
+                return;
+            }
+        }
+        for (uint32_t n = 0; n < cnt; n++) {
+            struct w_iov_sq o = w_iov_sq_initializer(o);
+            q_alloc(w, &o, len);
+            q_write_async(cs[n % strms], &o, n + strms >= cnt);
+        }
+        for (uint32_t n = 0; n < strms; n++)
+            q_close_stream(cs[n]);
+
+        // read the data of all streams
+        uint32_t ilen = 0;
+        for (uint32_t n = 0; n < strms; n++) {
+            struct w_iov_sq i = w_iov_sq_initializer(i);
+            struct q_stream * const ss = q_read(sc, &i, true);
+            if (likely(ss) && !q_peer_has_closed_stream(ss))
+                q_readall_str(ss, &i);
+            if (likely(ss))
+                q_close_stream(ss);
+            ilen += w_iov_sq_len(&i);
+            q_free(&i);
+        }
+        if (ilen != cnt * len) {
+            state.SkipWithError("error");
+            return;
+        }
+    }
+    state.SetBytesProcessed(int64_t(state.iterations() * cnt * len)); // NOLINT
+
+    // datagrams sent by both ends, including ACKs, per round of writes
+    struct q_engine_stats post;
+    q_engine_stats(w, &post);
+    state.counters["dgrams"] =
+        double(post.tx_dgrams - pre.tx_dgrams) / double(state.iterations());
+}
+
+
+BENCHMARK(BM_conn_pack)
+    ->Args({16, 1})
+    ->Args({16, 100})
+    ->Args({256, 1})
+    ->Args({256, 100});
+
+
 // BENCHMARK_MAIN()
 
 int main(int argc __attribute__((unused)), char ** argv)
@@ -123,7 +318,7 @@ int main(int argc __attribute__((unused)), char ** argv)
     ensure(cc, "is zero");
 
     // accept connection
-    sc = q_accept(0);
+    sc = q_accept(w, 0);
     ensure(sc, "is zero");
 
     benchmark::RunSpecifiedBenchmarks();
@@ -0,0 +1,113 @@
+// Copyright (c) 2014-2018, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+#include <arpa/inet.h>
+#include <cstdint>
+
+#include <benchmark/benchmark.h>
+#include <warpcore/warpcore.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "diet.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#define N 4096 ///< Packet numbers received per benchmark iteration.
+#define ACK_EVERY 64
+
+
+/// Packet number to receive at position @p n, when reversing the order of
+/// groups of @p reorder packets.
+///
+static inline uint64_t nr_at(const uint64_t n, const uint64_t reorder)
+{
+    return n - n % reorder + (reorder - 1 - n % reorder);
+}
+
+
+// this mirrors what the RX path does to the recv and recv_all diets of a
+// pn_space, plus the removal of ACKed ranges from recv
+static void BM_diet_rx(benchmark::State & state)
+{
+    const auto reorder = uint64_t(state.range(0));
+    const auto loss = uint64_t(state.range(1));
+
+    for (auto _ : state) {
+        struct diet recv = diet_initializer(recv);
+        struct diet recv_all = diet_initializer(recv_all);
+        uint64_t acked = 0;
+
+        for (uint64_t n = 0; n < N; n++) {
+            const uint64_t nr = nr_at(n, reorder);
+            if (loss && nr % loss == 0)
+                continue;
+
+            // duplicate detection, then tracking
+            if (diet_find(&recv_all, nr))
+                continue;
+            diet_insert(&recv, nr, 0);
+            diet_insert(&recv_all, nr, 0);
+
+            if (n % ACK_EVERY == ACK_EVERY - 1) {
+                // our ACK got ACKed, stop ACKing what it contained
+                for (; acked + ACK_EVERY < n; acked++)
+                    diet_remove(&recv, acked);
+            }
+        }
+        benchmark::DoNotOptimize(diet_cnt(&recv_all));
+
+        diet_free(&recv);
+        diet_free(&recv_all);
+    }
+    state.SetItemsProcessed(int64_t(state.iterations() * N)); // NOLINT
+}
+
+
+BENCHMARK(BM_diet_rx)
+    ->Args({1, 0})
+    ->Args({4, 0})
+    ->Args({32, 0})
+    ->Args({1, 100})
+    ->Args({1, 10})
+    ->Args({4, 10})
+    // ->MinTime(3)
+    // ->UseRealTime()
+    ;
+
+
+// BENCHMARK_MAIN()
+
+int main(int argc, char ** argv)
+{
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+}
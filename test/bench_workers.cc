@@ -0,0 +1,199 @@
+// Copyright (c) 2014-2018, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdint>
+#include <fcntl.h>
+#include <libgen.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+#include <quant/quant.h>
+#include <warpcore/warpcore.h>
+
+
+#define PORT 55556
+
+static std::atomic<bool> done; ///< Tells the server workers to exit.
+
+/// Client engines, one per benchmark thread.
+static struct q_engine * clnt[UINT8_MAX];
+
+static struct sockaddr_in sip;
+
+
+static void serve(struct q_engine * const qe,
+                  void * const arg __attribute__((unused)))
+{
+    struct q_conn * const lc = q_bind(qe, PORT);
+
+    // accepted conns are closed by the client and reclaimed by
+    // q_cleanup_workers()
+    while (!done) {
+        struct q_conn * const c = q_rx_ready(qe, 1);
+        if (c == nullptr)
+            continue;
+
+        if (c == lc) {
+            q_accept(qe, 0);
+            continue;
+        }
+
+        // echo whatever we got back to the client
+        struct w_iov_sq q = w_iov_sq_initializer(q);
+        struct q_stream * const s = q_read(c, &q, false);
+        if (s == nullptr)
+            continue;
+        if (!q_peer_has_closed_stream(s))
+            q_readall_str(s, &q);
+        q_write(s, &q, true);
+        q_free(&q);
+        q_close_stream(s);
+    }
+}
+
+
+static void BM_handshake(benchmark::State & state)
+{
+    struct q_engine * const qe = clnt[state.thread_index];
+    for (auto _ : state) {
+        struct q_conn * const c =
+            q_connect(qe, &sip, "localhost", nullptr, nullptr, true, 0);
+        if (unlikely(c == nullptr)) {
+            state.SkipWithError("q_connect failed");
+            break;
+        }
+        state.PauseTiming();
+        q_close(c);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(int64_t(state.iterations())); // NOLINT
+}
+
+
+static void BM_bulk(benchmark::State & state)
+{
+    struct q_engine * const qe = clnt[state.thread_index];
+    const auto len = uint32_t(state.range(0));
+    struct q_conn * const c =
+        q_connect(qe, &sip, "localhost", nullptr, nullptr, true, 0);
+    if (unlikely(c == nullptr)) {
+        state.SkipWithError("q_connect failed");
+        return;
+    }
+
+    for (auto _ : state) {
+        struct q_stream * const s = q_rsv_stream(c, true);
+        if (unlikely(s == nullptr)) {
+            state.SkipWithError("q_rsv_stream failed");
+            break;
+        }
+
+        struct w_iov_sq o = w_iov_sq_initializer(o);
+        q_alloc(qe, &o, len);
+        q_write(s, &o, true);
+
+        struct w_iov_sq i = w_iov_sq_initializer(i);
+        q_readall_str(s, &i);
+        const uint32_t ilen = w_iov_sq_len(&i);
+        q_free(&i);
+        q_free(&o);
+        q_close_stream(s);
+
+        if (ilen != len) {
+            state.SkipWithError("echo incomplete");
+            break;
+        }
+    }
+    state.SetBytesProcessed(int64_t(state.iterations() * len)); // NOLINT
+
+    q_close(c);
+}
+
+
+int main(int argc, char ** argv)
+{
+    benchmark::Initialize(&argc, argv);
+#ifndef NDEBUG
+    util_dlevel = ERR;
+#endif
+
+    const char * const ifname = "lo"
+#ifndef __linux__
+                                "0"
+#endif
+        ;
+
+    // the clients need a core each, too
+    const unsigned cores = std::max(2U, std::thread::hardware_concurrency());
+    const auto max_workers = uint8_t(std::min(unsigned(UINT8_MAX), cores / 2));
+
+    const int cwd = open(".", O_CLOEXEC);
+    ensure(cwd != -1, "cannot open");
+    ensure(chdir(dirname(argv[0])) == 0, "cannot chdir");
+
+    for (uint8_t i = 0; i < max_workers; i++)
+        clnt[i] = q_init(ifname, nullptr, nullptr, nullptr, nullptr, false,
+                         false);
+
+    sip.sin_family = AF_INET;
+    sip.sin_port = htons(PORT);
+    sip.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    // scale server workers (and client threads) from one to all cores
+    for (unsigned n = 1; n <= max_workers; n *= 2) {
+        done = false;
+        struct q_workers * const wrk =
+            q_init_workers(uint8_t(n), serve, nullptr, ifname, "dummy.crt",
+                           "dummy.key", nullptr, nullptr, false, false);
+
+        const std::string sfx = "/workers:" + std::to_string(n);
+        benchmark::RegisterBenchmark(("BM_handshake" + sfx).c_str(),
+                                     BM_handshake)
+            ->Threads(int(n))
+            ->UseRealTime();
+        benchmark::RegisterBenchmark(("BM_bulk" + sfx).c_str(), BM_bulk)
+            ->Arg(1024 * 1024)
+            ->Threads(int(n))
+            ->UseRealTime();
+        benchmark::RunSpecifiedBenchmarks();
+        benchmark::ClearRegisteredBenchmarks();
+
+        done = true;
+        q_cleanup_workers(wrk);
+    }
+
+    for (uint8_t i = 0; i < max_workers; i++)
+        q_cleanup(clnt[i]);
+    ensure(fchdir(cwd) == 0, "cannot fchdir");
+}
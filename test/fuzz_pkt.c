@@ -56,7 +56,7 @@ int LLVMFuzzerInitialize(int * argc __attribute__((unused)),
 #ifndef NDEBUG
     util_dlevel = DBG;
 #endif
-    w = q_init(i, 0, 0, 0, 0, false, true);
+    w = q_init(i, 0, 0, 0, 0, false, true)->w;
     c = new_conn(w, 0, 0, 0, 0, 0, 0, 0);
 
     return 0;
@@ -71,7 +71,7 @@ int LLVMFuzzerTestOneInput(const uint8_t * data, const size_t size)
     struct w_iov_sq i = w_iov_sq_initializer(i);
     sq_insert_head(&i, v, next);
 
-    rx_pkts(&i, &(struct q_conn_sl){0}, c->sock);
+    rx_pkts(&i, &(struct q_conn_sl){0}, c->sock, c->sport);
     free_iov(v);
 
     return 0;
@@ -27,7 +27,9 @@
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <libgen.h>
+#include <math.h>
 #include <netinet/in.h>
 #include <stdbool.h>
 #include <string.h>
@@ -42,6 +44,90 @@
 #include <quant/quant.h>
 #include <warpcore/warpcore.h>
 
+#include "conn.h"
+#include "pn.h"
+#include "quic.h"
+#include "recovery.h"
+#include "wheel.h"
+
+
+static struct q_conn * ready[2];
+static unsigned int n_ready = 0;
+
+
+static void on_conn_ready(struct q_conn * const c,
+                          void * const arg __attribute__((unused)))
+{
+    ensure(n_ready < sizeof(ready) / sizeof(ready[0]), "too many conns");
+    ready[n_ready++] = c;
+}
+
+
+/// Check that the pacer of @p c refills its token bucket at gain * cwnd / srtt
+/// and caps it at the larger of kPacingBurst packets and kPacingGranularity
+/// worth of tokens. Restores the recovery state it changes.
+///
+/// @param      c     Connection.
+///
+static void test_pacing(struct q_conn * const c)
+{
+    // NewReno has no pacing_rate callback, so the generic pacer applies
+    q_set_cc(c, q_cc_newreno);
+    const uint64_t cwnd = c->rec.cwnd;
+    const uint64_t ssthresh = c->rec.ssthresh;
+    const ev_tstamp srtt = c->rec.srtt;
+    struct ev_loop * const loop = ped(c->w)->loop;
+    if (ev_is_active(&c->rec.pace_alarm))
+        ev_timer_stop(loop, &c->rec.pace_alarm);
+    const ev_tstamp now = ev_now(loop);
+    const uint16_t mtu = c->pmtu;
+
+    // slow start: 2 * 1000 pkts / 100 ms; one 2 ms burst is 40 pkts
+    c->rec.cwnd = 1000 * (uint64_t)mtu;
+    c->rec.ssthresh = UINT64_MAX;
+    c->rec.srtt = 0.1;
+    const double rate = kPacingGainSS * (double)c->rec.cwnd / c->rec.srtt;
+
+    // a long idle period only refills up to the burst cap
+    c->rec.pace_tokens = 0;
+    c->rec.pace_t = now - 1;
+    ensure(pace_pkts(c) == 40, "burst not capped at rate * granularity");
+    ensure(c->rec.pace_tokens == 40 * (uint64_t)mtu, "tokens not capped");
+    ensure(is_zero(c->rec.pace_t - now), "refill time not updated");
+
+    // below the cap, the bucket refills at the pacing rate
+    c->rec.pace_tokens = mtu / 2;
+    c->rec.pace_t = now - 10 * mtu / rate;
+    ensure(pace_pkts(c) == 10, "refill not at gain * cwnd / srtt");
+
+    // no refill without time passing; without a full pkt, the alarm is armed
+    c->rec.pace_tokens = mtu / 2;
+    ensure(pace_pkts(c) == 0, "paced pkt without tokens");
+    ensure(ev_is_active(&c->rec.pace_alarm), "pace alarm not armed");
+    ensure(fabs(ev_timer_remaining(loop, &c->rec.pace_alarm) -
+                (mtu - mtu / 2) / rate) < 1e-6,
+           "pace alarm not set for the missing tokens");
+    ev_timer_stop(loop, &c->rec.pace_alarm);
+
+    // congestion avoidance uses the lower gain, which shrinks the burst
+    c->rec.ssthresh = c->rec.cwnd;
+    c->rec.pace_tokens = 0;
+    c->rec.pace_t = now - 1;
+    ensure(pace_pkts(c) == 25, "CA burst not at 1.25 * cwnd / srtt");
+
+    // small cwnd: the burst cap never drops below kPacingBurst pkts
+    c->rec.cwnd = 10 * (uint64_t)mtu;
+    c->rec.pace_tokens = 0;
+    c->rec.pace_t = now - 1;
+    ensure(pace_pkts(c) == kPacingBurst, "burst below kPacingBurst pkts");
+
+    c->rec.cwnd = cwnd;
+    c->rec.ssthresh = ssthresh;
+    c->rec.srtt = srtt;
+    c->rec.pace_tokens = 0;
+    c->rec.pace_t = now;
+}
+
 
 int main(int argc
 #ifdef NDEBUG
@@ -62,7 +148,7 @@ int main(int argc
     const int cwd = open(".", O_CLOEXEC);
     ensure(cwd != -1, "cannot open");
     ensure(chdir(dirname(argv[0])) == 0, "cannot chdir");
-    struct w_engine * const w =
+    struct q_engine * const w =
         q_init("lo"
 #ifndef __linux__
                "0"
@@ -82,7 +168,7 @@ int main(int argc
     ensure(cc, "is zero");
 
     // accept connection
-    struct q_conn * const sc = q_accept(0);
+    struct q_conn * const sc = q_accept(w, 0);
     ensure(sc, "is zero");
 
     // reserve a new stream
@@ -108,8 +194,65 @@ int main(int argc
     q_free(&i);
     q_free(&o);
 
+    // send a lone ACK-eliciting pkt (no FIN, which is ACKed right away), and
+    // check that the server ACKs it when its ACK timer expires
+    s = q_rsv_stream(cc, true);
+    q_alloc(w, &o, 100);
+    q_write_async(s, &o, false);
+    const struct pn_space * const spn = &sc->pn_data.pn;
+    for (int t = 0; !tmr_active(&spn->ack_alarm) && t < 100; t++)
+        q_run_once(w, 0.001);
+    ensure(tmr_active(&spn->ack_alarm), "ACK timer not armed");
+    for (int t = 0; tmr_active(&spn->ack_alarm) && t < 1000; t++)
+        q_run_once(w, 0.001);
+    ensure(has_unacked_rx(spn) == false, "ACK timer expired without ACK");
+
+    // check the pacer's token bucket
+    test_pacing(cc);
+
+    // small writes on several streams share pkts; the lone pkt's stream above
+    // has unread data, so skip it when reading
+    const uint64_t lone_sid = q_sid(s);
+    struct q_engine_stats pre;
+    q_engine_stats(w, &pre);
+    const uint32_t n_strms = 8;
+    for (uint32_t n = 0; n < n_strms; n++) {
+        q_alloc(w, &o, 100);
+        q_write_async(q_rsv_stream(cc, true), &o, true);
+    }
+    uint32_t ilen = 0;
+    for (uint32_t n = 0; n < n_strms;) {
+        s = q_read(sc, &i, true);
+        ensure(s, "is zero");
+        if (q_sid(s) != lone_sid) {
+            if (q_peer_has_closed_stream(s) == false)
+                q_readall_str(s, &i);
+            ilen += w_iov_sq_len(&i);
+            n++;
+        }
+        q_free(&i);
+    }
+    ensure(ilen == n_strms * 100, "data missing");
+    struct q_engine_stats post;
+    q_engine_stats(w, &post);
+    ensure(post.tx_dgrams - pre.tx_dgrams < n_strms,
+           "stream frames not packed, %" PRIu64 " dgrams",
+           post.tx_dgrams - pre.tx_dgrams);
+
     // close connections
     q_close(cc);
     q_close(sc);
+
+    // connect again, this time without blocking
+    const struct q_callbacks cb = {.on_conn_ready = on_conn_ready};
+    q_set_callbacks(w, &cb);
+    ensure(q_connect_async(w, &sip, "localhost", 0, 0, true, 0), "is zero");
+    for (int t = 0; n_ready < 2 && t < 10; t++)
+        q_run_once(w, 1);
+    ensure(n_ready == 2, "clnt and serv conn not ready");
+    q_set_callbacks(w, &(struct q_callbacks){0});
+    q_close(ready[0]);
+    q_close(ready[1]);
+
     q_cleanup(w);
 }
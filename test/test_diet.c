@@ -74,20 +74,20 @@ static void trace(struct diet * const d,
 
 static void chk(struct diet * const d)
 {
-    struct ival *i, *next;
-    for (i = splay_min(diet, d); i != 0; i = next) {
-        next = splay_next(diet, d, i);
+    struct ival *i, *prev = 0;
+    diet_foreach (i, d) {
 #ifdef DIET_CLASS
-        ensure(next == 0 || i->hi + 1 < next->lo ||
-                   diet_class(i) != diet_class(next),
+        ensure(prev == 0 || prev->hi + 1 < i->lo ||
+                   diet_class(prev) != diet_class(i),
                "%u.%" PRIu64 "-%" PRIu64 " %u.%" PRIu64 "-%" PRIu64,
-               diet_class(i), i->lo, i->hi, diet_class(next), next->lo,
-               next->hi);
+               diet_class(prev), prev->lo, prev->hi, diet_class(i), i->lo,
+               i->hi);
 #else
-        ensure(next == 0 || i->hi + 1 < next->lo,
-               "%" PRIu64 "-%" PRIu64 " %" PRIu64 "-%" PRIu64, i->lo, i->hi,
-               next->lo, next->hi);
+        ensure(prev == 0 || prev->hi + 1 < i->lo,
+               "%" PRIu64 "-%" PRIu64 " %" PRIu64 "-%" PRIu64, prev->lo,
+               prev->hi, i->lo, i->hi);
 #endif
+        prev = i;
     }
 }
 
@@ -127,7 +127,7 @@ int main()
     }
 
     // remove all items
-    while (!splay_empty(&d)) {
+    while (!diet_empty(&d)) {
         const uint64_t x = (uint64_t)random() % N;
         struct ival * const i = diet_find(&d, x);
         if (i) {
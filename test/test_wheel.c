@@ -0,0 +1,176 @@
+// SPDX-License-Identifier: BSD-2-Clause
+//
+// Copyright (c) 2016-2018, NetApp, Inc.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+//    this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <time.h>
+
+#include <ev.h>
+#include <warpcore/warpcore.h>
+
+#include "wheel.h"
+
+
+// this is built with a small WHL_BITS, so that all levels of the wheel and
+// the parking of timers beyond its range are exercised within about a second
+
+#define N 500
+#define MAX_REARMS 2
+
+
+struct tt {
+    struct tmr t;
+    ev_tstamp start; ///< When the timer was (re-)armed.
+    ev_tstamp after; ///< Timeout the timer was (re-)armed with.
+    uint64_t due;    ///< Tick during which the timer times out.
+    uint32_t fired;  ///< Number of times the timer fired.
+    uint8_t rearms;  ///< Number of re-arms left for the callback to do.
+    bool stopped;    ///< Timer was canceled and must not fire again.
+    uint8_t _unused[2];
+};
+
+
+static struct wheel whl;
+static struct tt tt[N];
+
+
+static uint64_t to_ticks(const ev_tstamp t)
+{
+    return (uint64_t)(t / WHL_TICK);
+}
+
+
+static ev_tstamp rnd_after(void)
+{
+    // pick a level (or the parking range beyond the last level) uniformly, so
+    // that the short timeouts of the lower levels are not drowned out
+    const uint64_t lvl = (uint64_t)random() % (WHL_LEVELS + 1);
+    const uint64_t span = UINT64_C(1) << (WHL_BITS * MIN(lvl + 1, WHL_LEVELS) +
+                                          (lvl == WHL_LEVELS ? 1 : 0));
+    return ((double)((uint64_t)random() % span) +
+            (double)random() / RAND_MAX) *
+           WHL_TICK;
+}
+
+
+static void arm(struct tt * const x)
+{
+    x->start = ev_now(whl.loop);
+    x->after = rnd_after();
+    x->due = to_ticks(x->start + x->after);
+    tmr_start(&whl, &x->t, x->after);
+}
+
+
+static void cb(struct tmr * const t)
+{
+    struct tt * const x = t->data;
+    const long i = x - tt;
+    const ev_tstamp now = ev_now(whl.loop);
+
+    ensure(x->stopped == false, "canceled timer %ld fired", i);
+    ensure(now >= x->start + x->after, "timer %ld early by %f", i,
+           x->start + x->after - now);
+    ensure(whl.now > x->due && whl.now <= x->due + 1,
+           "timer %ld fired in tick %" PRIu64 ", due in %" PRIu64, i, whl.now,
+           x->due);
+    x->fired++;
+
+    if (x->rearms) {
+        x->rearms--;
+        arm(x);
+    }
+
+    // sometimes, cancel some other timer from inside the callback
+    if (random() % 4 == 0) {
+        struct tt * const y = &tt[(uint64_t)random() % N];
+        if (y != x && tmr_active(&y->t)) {
+            tmr_stop(&whl, &y->t);
+            y->stopped = true;
+        }
+    }
+}
+
+
+int main()
+{
+    srandom((unsigned)time(0));
+#ifndef NDEBUG
+    util_dlevel = DLEVEL; // default to maximum compiled-in verbosity
+#endif
+    struct ev_loop * const loop = ev_default_loop(0);
+    whl_init(&whl, loop);
+
+    // arm timers across all levels, and cancel some right away
+    uint32_t want = 0;
+    for (uint32_t i = 0; i < N; i++) {
+        struct tt * const x = &tt[i];
+        tmr_init(&x->t, cb, x);
+        x->rearms = (uint8_t)((uint64_t)random() % (MAX_REARMS + 1));
+        arm(x);
+        if (random() % 8 == 0) {
+            tmr_stop(&whl, &x->t);
+            x->stopped = true;
+        }
+    }
+
+    // the wheel alarm is the only watcher, and stops once all timers are done
+    ev_run(loop, 0);
+    ensure(whl.cnt == 0, "%" PRIu64 " timers left", whl.cnt);
+
+    for (uint32_t i = 0; i < N; i++) {
+        const struct tt * const x = &tt[i];
+        ensure(tmr_active(&x->t) == false, "timer %u still active", i);
+        if (x->stopped)
+            continue;
+        ensure(x->fired >= 1 && x->rearms == 0,
+               "timer %u fired %u times, %u re-arms left", i, x->fired,
+               x->rearms);
+        want += x->fired;
+    }
+    warn(INF, "%u timer expirations", want);
+
+    // an idle wheel is not advanced, so arming a timer must first catch up
+    ev_sleep(20 * WHL_TICK);
+    ev_now_update(loop);
+    struct tt * const x = &tt[0];
+    *x = (struct tt){0};
+    tmr_init(&x->t, cb, x);
+    arm(x);
+    ensure(whl.now == to_ticks(ev_now(loop)),
+           "wheel at %" PRIu64 " after catch-up, now is %" PRIu64, whl.now,
+           to_ticks(ev_now(loop)));
+    ev_run(loop, 0);
+    ensure(x->fired == 1, "timer fired %u times after catch-up", x->fired);
+
+    whl_free(&whl);
+    ev_loop_destroy(loop);
+    return 0;
+}